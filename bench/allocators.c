@@ -0,0 +1,1061 @@
+// Allocator benchmark: runs each workload against glibc and against the library, and prints one JSON object per line,
+// so that runs can be kept and compared over time:
+//
+//     bench/allocators [-c case] [-a allocator] [-t threads] [-s scale] [-l live,...] [-b baseline.jsonl [-r percent]]
+//
+//     -c case		only run the named case: churn, churn_mt, prodcons, realloc, liveset, objects32, batch or unwinder
+//     -a allocator	only run the named allocator: glibc, managed, managed_fast, managed_slab or managed_batch, and not unwinder
+//     -t threads	most threads for churn_mt, and producer/consumer pairs * 2 for prodcons (default 4)
+//     -s scale		multiplies every case's iteration count (default 1)
+//     -l live,...	block counts for liveset, for example 1000000,10000000,50000000 (default 1000000)
+//     -b file		earlier output to compare throughput against, matched on case, allocator, threads, depth and blocks
+//     -r percent	with -b, exit with 1 if any case lost more than this much throughput (default 10)
+//
+// churn_mt is run at 1, 2, 4, 8 and so on up to -t threads, to show how each allocator scales, and -t itself if it isn't
+// a power of two. churn and churn_mt are run at backtrace depths 0, 8 and 32, and every case again as managed_fast, with blocks left out
+// of the registry (Mem_SetBlockRegistry(0)) and no backtraces, and as managed_slab, with small blocks carved from
+// size-class slabs (Mem_SetSlabBackend(1)). batch allocates and frees blocks 64 at a time, one call per block, and again
+// as managed_batch, through Mem_MallocBatch and Mem_FreeBatch; its ops are blocks, and a batch call's latency is shared
+// out between its blocks. objects32 holds 10M blocks of 32 bytes live, and its rows, like every row, give the RSS per
+// object and the size of the library's block header. make bench also builds bench/allocators_compact, the same with
+// MEM_COMPACT_HEADER, so that -c objects32 on each shows what compact headers save. Each case runs in a process of its own, twice:
+// once untimed, for throughput, RSS and Mem_MemoryUsed at the end of the workload while its blocks are still live, and
+// once with every call timed, for the latency percentiles.
+//
+// bench/preload.sh runs the glibc rows under LD_PRELOAD=libmanagedmalloc_preload.so, where their malloc and free go
+// through the interposer, to measure what it costs.
+//
+// unwinder isn't an allocator case: it times Platform_StackTrace_Snapshot, the frame-pointer walk the library takes its
+// backtraces with, against glibc's backtrace() at depths 8 and 32, with the unwinder in place of the allocator.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "../inc/platform.h"
+#include "../inc/memory.h"
+
+#define BENCH_LATENCY_SUB_BITS	3		// each power of two of latency is split into 8 buckets
+#define BENCH_LATENCY_BUCKETS	(64 << BENCH_LATENCY_SUB_BITS)
+#define BENCH_CHURN_SLOTS		4096	// live blocks per churn thread
+#define BENCH_REALLOC_VECTORS	64		// each grown until BENCH_REALLOC_MAX, then started again
+#define BENCH_REALLOC_MAX		65536
+#define BENCH_BATCH_SIZE		64		// blocks per batch, all of the same size
+#define BENCH_OBJECT_SIZE		32		// of every block in objects32
+#define BENCH_OBJECTS			10000000
+#define BENCH_RING_SIZE			1024	// blocks in flight from a producer to its consumer
+#define BENCH_RELEASE_STRIDE	1000003	// prime, so that the live blocks are freed in a scattered order
+#define BENCH_MAX_THREADS		64
+#define BENCH_MAX_LIVE_SETS		8
+#define BENCH_MAX_BASELINE		1024
+#define BENCH_NAME_SIZE			32
+#define BENCH_LIVE_SETS			((size_t)-1)	// one run for each of the -l counts
+#define BENCH_THREAD_SWEEP		-1		// one run for each power of two of threads up to -t, and -t
+#define BENCH_UNWIND_FRAMES		40		// frames below the unwinder, so that every depth fills its buffer
+#define BENCH_UNWIND_ITERATIONS	100000
+
+static const int g_bench_depths[] = {0, 8, 32};
+
+typedef struct bench_allocator_s
+{
+	const char	*name;
+	int			managed;
+	int			block_registry;
+	int			slab_backend;
+	int			batch;				// allocates and frees through Mem_MallocBatch and Mem_FreeBatch, only run on the batch case
+	void		*(*malloc_fp)(size_t size);
+	void		*(*malloc_aligned_fp)(size_t size, uint32_t alignment);
+	void		*(*realloc_fp)(void *ptr, size_t size);
+	void		(*free_fp)(void *ptr);
+}bench_allocator_t;
+
+typedef struct bench_unwinder_s
+{
+	const char	*name;
+	int			(*backtrace_fp)(void **stack, int entries);
+}bench_unwinder_t;
+
+typedef struct bench_latency_s
+{
+	uint64_t	count;
+	uint64_t	bucket[BENCH_LATENCY_BUCKETS];
+}bench_latency_t;
+
+// Single producer, single consumer
+typedef struct bench_ring_s
+{
+	int64_t		head PLATFORM_CACHE_ALIGN;
+	int64_t		tail PLATFORM_CACHE_ALIGN;
+	void		*slot[BENCH_RING_SIZE];
+}bench_ring_t;
+
+typedef struct bench_thread_s
+{
+	const bench_allocator_t	*allocator;
+	void					(*run_fp)(struct bench_thread_s *thread);
+	uint64_t				iterations;
+	uint64_t				seed;
+	int						timed;
+	int						consumer;
+	uint64_t				calls;
+	void					**blocks;		// left live by the workload, freed by Bench_Release
+	size_t					*sizes;
+	size_t					num_blocks;
+	bench_ring_t			*ring;
+	bench_latency_t			latency;
+	pthread_t				handle;
+}bench_thread_t;
+
+typedef struct bench_case_s
+{
+	const char	*name;
+	void		(*run_fp)(bench_thread_t *thread);
+	int			threads;			// 0 for the -t thread count, or BENCH_THREAD_SWEEP
+	int			vary_depth;			// run once for each of g_bench_depths
+	uint64_t	iterations;			// per thread, scaled by -s, or 0 for once per live block
+	size_t		live_blocks;		// per thread, or BENCH_LIVE_SETS
+}bench_case_t;
+
+typedef struct bench_run_s
+{
+	const bench_case_t		*bench_case;
+	const bench_allocator_t	*allocator;
+	int						threads;
+	int						backtrace_depth;
+	uint64_t				iterations;
+	size_t					live_blocks;
+}bench_run_t;
+
+// Written by the process that ran the case, read back by the parent
+typedef struct bench_result_s
+{
+	uint64_t	calls;
+	double		seconds;
+	double		p50_ns;
+	double		p99_ns;
+	double		p999_ns;
+	int64_t		rss_bytes;
+	int64_t		peak_rss_bytes;
+	size_t		requested_bytes;
+	size_t		mem_used_bytes;
+	size_t		live_count;		// blocks still live when the RSS was taken
+}bench_result_t;
+
+typedef struct bench_baseline_s
+{
+	char		name[BENCH_NAME_SIZE];
+	char		allocator[BENCH_NAME_SIZE];
+	int			threads;
+	int			backtrace_depth;
+	size_t		live_blocks;
+	double		ops_per_sec;
+}bench_baseline_t;
+
+static struct
+{
+	const char			*only_allocator;	// -a
+	double				cycles_per_ns;
+	uint64_t			timer_overhead;		// in cycles, taken off every timed call
+	bench_baseline_t	baseline[BENCH_MAX_BASELINE];
+	int					num_baseline;
+}g_bench;
+
+// Times the call into the thread's latency histogram, on the timed pass only
+#define BENCH_CALL(thread, call)	BENCH_BATCH_CALL(thread, 1, call)
+
+// The same for a call that allocates or frees count blocks, counted as count calls that each took an equal share
+#define BENCH_BATCH_CALL(thread, count, call) \
+	do \
+	{ \
+		if ((thread)->timed) \
+		{ \
+			uint64_t start_ = Platform_Cycles(); \
+			call; \
+			Bench_LatencyAdd(&(thread)->latency, Platform_Cycles() - start_, count); \
+		} \
+		else \
+			call; \
+		(thread)->calls += count; \
+	} while (0)
+
+static void *Bench_GlibcMalloc(size_t size)
+{
+	return malloc(size);
+}
+static void *Bench_GlibcMallocAligned(size_t size, uint32_t alignment)
+{
+	void *ptr;
+
+	return posix_memalign(&ptr, alignment, size) ? 0 : ptr;
+}
+static void *Bench_GlibcRealloc(void *ptr, size_t size)
+{
+	return realloc(ptr, size);
+}
+static void Bench_GlibcFree(void *ptr)
+{
+	free(ptr);
+}
+static void *Bench_ManagedMalloc(size_t size)
+{
+	return Mem_Malloc(size);
+}
+static void *Bench_ManagedMallocAligned(size_t size, uint32_t alignment)
+{
+	return Mem_MallocAligned(size, alignment);
+}
+static void *Bench_ManagedRealloc(void *ptr, size_t size)
+{
+	return Mem_Realloc(ptr, size);
+}
+static void Bench_ManagedFree(void *ptr)
+{
+	Mem_Free(ptr);
+}
+
+static const bench_allocator_t g_bench_glibc = {"glibc", 0, 0, 0, 0, Bench_GlibcMalloc, Bench_GlibcMallocAligned, Bench_GlibcRealloc, Bench_GlibcFree};
+static const bench_allocator_t g_bench_managed[] =
+{
+	{"managed", 1, 1, 0, 0, Bench_ManagedMalloc, Bench_ManagedMallocAligned, Bench_ManagedRealloc, Bench_ManagedFree},
+	{"managed_fast", 1, 0, 0, 0, Bench_ManagedMalloc, Bench_ManagedMallocAligned, Bench_ManagedRealloc, Bench_ManagedFree},
+	{"managed_slab", 1, 1, 1, 0, Bench_ManagedMalloc, Bench_ManagedMallocAligned, Bench_ManagedRealloc, Bench_ManagedFree},
+	{"managed_batch", 1, 1, 0, 1, Bench_ManagedMalloc, Bench_ManagedMallocAligned, Bench_ManagedRealloc, Bench_ManagedFree},
+};
+
+static int Bench_GlibcBacktrace(void **stack, int entries)
+{
+	return backtrace(stack, entries);
+}
+static int Bench_PlatformBacktrace(void **stack, int entries)
+{
+	return Platform_StackTrace_Snapshot(stack, entries, 0);
+}
+
+static const bench_unwinder_t g_bench_unwinders[] =
+{
+	{"glibc", Bench_GlibcBacktrace},
+	{"platform", Bench_PlatformBacktrace},
+};
+static const int g_bench_unwind_depths[] = {8, 32};
+
+static double Bench_Now()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+static int64_t Bench_Rss()
+{
+	long pages = 0;
+	FILE *file = fopen("/proc/self/statm", "r");
+
+	if (file)
+	{
+		if (fscanf(file, "%*s %ld", &pages) != 1)
+			pages = 0;
+		fclose(file);
+	}
+
+	return (int64_t)pages * sysconf(_SC_PAGESIZE);
+}
+static int64_t Bench_PeakRss()
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+
+	return (int64_t)usage.ru_maxrss * 1024;
+}
+// Platform_Cycles against the wall clock, and the cost of reading it, which timed calls have taken off
+static void Bench_CalibrateTimer()
+{
+	double start = Bench_Now();
+	uint64_t cycles = Platform_Cycles();
+	uint64_t overhead = UINT64_MAX;
+	int i;
+
+	while (Bench_Now() - start < 0.05)
+		;
+	g_bench.cycles_per_ns = (double)(Platform_Cycles() - cycles) / ((Bench_Now() - start) * 1e9);
+
+	for (i = 0; i < 1000; i++)
+	{
+		uint64_t before = Platform_Cycles();
+		uint64_t elapsed = Platform_Cycles() - before;
+
+		if (elapsed < overhead)
+			overhead = elapsed;
+	}
+	g_bench.timer_overhead = overhead;
+}
+
+static __forceinline uint64_t Bench_Random(uint64_t *seed)
+{
+	// xorshift64*
+	*seed ^= *seed >> 12;
+	*seed ^= *seed << 25;
+	*seed ^= *seed >> 27;
+
+	return *seed * 0x2545F4914F6CDD1Dull;
+}
+// Mostly small, as real programs are: 7 in 8 below 256 bytes, the rest up to 4KiB
+static __forceinline size_t Bench_Size(uint64_t r)
+{
+	return (r & 7) ? 8 + (size_t)((r >> 3) % 248) : 256 + (size_t)((r >> 3) % 3840);
+}
+
+// Adds count calls that took cycles between them
+static __forceinline void Bench_LatencyAdd(bench_latency_t *latency, uint64_t cycles, uint64_t count)
+{
+	int shift;
+	size_t index;
+
+	cycles = cycles > g_bench.timer_overhead ? (cycles - g_bench.timer_overhead) / count : 0;
+	if (cycles < (1 << BENCH_LATENCY_SUB_BITS))
+		index = (size_t)cycles;
+	else
+	{
+		shift = Platform_HighestBit(cycles) - BENCH_LATENCY_SUB_BITS;
+		index = ((size_t)(shift + 1) << BENCH_LATENCY_SUB_BITS) + (size_t)((cycles >> shift) & ((1 << BENCH_LATENCY_SUB_BITS) - 1));
+	}
+	latency->bucket[index] += count;
+	latency->count += count;
+}
+// The middle of the bucket holding the given fraction of the calls, in nanoseconds
+static double Bench_LatencyPercentile(const bench_latency_t *latency, double fraction)
+{
+	uint64_t rank = (uint64_t)(fraction * (double)latency->count);
+	uint64_t seen = 0;
+	size_t i;
+
+	for (i = 0; i < BENCH_LATENCY_BUCKETS; i++)
+	{
+		seen += latency->bucket[i];
+		if (seen > rank)
+		{
+			double low, high;
+
+			if (i < (1 << BENCH_LATENCY_SUB_BITS))
+				low = high = (double)i;
+			else
+			{
+				int shift = (int)(i >> BENCH_LATENCY_SUB_BITS) - 1;
+				uint64_t mantissa = (1 << BENCH_LATENCY_SUB_BITS) + (i & ((1 << BENCH_LATENCY_SUB_BITS) - 1));
+
+				low = (double)(mantissa << shift);
+				high = (double)((mantissa + 1) << shift);
+			}
+
+			return (low + high) / 2 / g_bench.cycles_per_ns;
+		}
+	}
+
+	return 0;
+}
+
+static void Bench_OutOfMemory(bench_thread_t *thread)
+{
+	fprintf(stderr, "%s: out of memory\n", thread->allocator->name);
+	_exit(1);
+}
+static __forceinline void Bench_Keep(bench_thread_t *thread, size_t slot, void *ptr, size_t size)
+{
+	if (!ptr)
+		Bench_OutOfMemory(thread);
+
+	// touch both ends, so that the pages are really in use
+	((volatile char*)ptr)[0] = (char)size;
+	((volatile char*)ptr)[size - 1] = (char)size;
+	thread->blocks[slot] = ptr;
+	thread->sizes[slot] = size;
+}
+
+static void Bench_Churn(bench_thread_t *thread)
+{
+	const bench_allocator_t *allocator = thread->allocator;
+	uint64_t i;
+
+	for (i = 0; i < thread->iterations; i++)
+	{
+		uint64_t r = Bench_Random(&thread->seed);
+		size_t slot = (size_t)(r % thread->num_blocks);
+		size_t size = Bench_Size(r >> 24);
+		void *ptr;
+
+		if (thread->blocks[slot])
+			BENCH_CALL(thread, allocator->free_fp(thread->blocks[slot]));
+		if (((r >> 16) & 7) == 0)
+			BENCH_CALL(thread, ptr = allocator->malloc_aligned_fp(size, 64));
+		else
+			BENCH_CALL(thread, ptr = allocator->malloc_fp(size));
+		Bench_Keep(thread, slot, ptr, size);
+	}
+}
+static void Bench_Realloc(bench_thread_t *thread)
+{
+	const bench_allocator_t *allocator = thread->allocator;
+	uint64_t i;
+
+	for (i = 0; i < thread->iterations; i++)
+	{
+		uint64_t r = Bench_Random(&thread->seed);
+		size_t slot = (size_t)(r % thread->num_blocks);
+		void *ptr = thread->blocks[slot];
+		size_t size = thread->sizes[slot];
+
+		if (!ptr || size >= BENCH_REALLOC_MAX)
+		{
+			if (ptr)
+				BENCH_CALL(thread, allocator->free_fp(ptr));
+			size = 16;
+			BENCH_CALL(thread, ptr = allocator->malloc_fp(size));
+		}
+		else
+		{
+			// grown by half again, as a vector would be
+			size += size / 2 + (size_t)((r >> 32) % 64);
+			BENCH_CALL(thread, ptr = allocator->realloc_fp(ptr, size));
+		}
+		Bench_Keep(thread, slot, ptr, size);
+	}
+}
+static void Bench_LiveSet(bench_thread_t *thread)
+{
+	const bench_allocator_t *allocator = thread->allocator;
+	size_t i;
+
+	for (i = 0; i < thread->num_blocks; i++)
+	{
+		size_t size = 16 + (size_t)(Bench_Random(&thread->seed) % 112);
+		void *ptr;
+
+		BENCH_CALL(thread, ptr = allocator->malloc_fp(size));
+		Bench_Keep(thread, i, ptr, size);
+	}
+}
+static void Bench_Objects(bench_thread_t *thread)
+{
+	const bench_allocator_t *allocator = thread->allocator;
+	size_t i;
+
+	for (i = 0; i < thread->num_blocks; i++)
+	{
+		void *ptr;
+
+		BENCH_CALL(thread, ptr = allocator->malloc_fp(BENCH_OBJECT_SIZE));
+		Bench_Keep(thread, i, ptr, BENCH_OBJECT_SIZE);
+	}
+}
+// Frees the last batch and allocates the next, of one size, either a block at a time or in one call
+static void Bench_Batch(bench_thread_t *thread)
+{
+	const bench_allocator_t *allocator = thread->allocator;
+	size_t count = thread->num_blocks;
+	uint64_t i;
+	size_t j;
+
+	for (i = 0; i < thread->iterations; i++)
+	{
+		size_t size = Bench_Size(Bench_Random(&thread->seed));
+		int failed = 0;
+
+		if (thread->blocks[0] && allocator->batch)
+			BENCH_BATCH_CALL(thread, count, Mem_FreeBatch(thread->blocks, count));
+		else if (thread->blocks[0])
+		{
+			for (j = 0; j < count; j++)
+				BENCH_CALL(thread, allocator->free_fp(thread->blocks[j]));
+		}
+
+		if (allocator->batch)
+			BENCH_BATCH_CALL(thread, count, failed = Mem_MallocBatch(count, size, thread->blocks));
+		else
+		{
+			for (j = 0; j < count; j++)
+				BENCH_CALL(thread, thread->blocks[j] = allocator->malloc_fp(size));
+		}
+		if (failed)
+			Bench_OutOfMemory(thread);
+		for (j = 0; j < count; j++)
+			Bench_Keep(thread, j, thread->blocks[j], size);
+	}
+}
+// Producers allocate, and their consumers free what they're passed
+static void Bench_ProducerConsumer(bench_thread_t *thread)
+{
+	const bench_allocator_t *allocator = thread->allocator;
+	bench_ring_t *ring = thread->ring;
+	uint64_t i;
+
+	for (i = 0; i < thread->iterations; i++)
+	{
+		if (thread->consumer)
+		{
+			int64_t tail = ring->tail;
+			void *ptr;
+
+			while (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail)
+				sched_yield();
+			ptr = ring->slot[tail % BENCH_RING_SIZE];
+			__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+			BENCH_CALL(thread, allocator->free_fp(ptr));
+		}
+		else
+		{
+			int64_t head = ring->head;
+			size_t size = Bench_Size(Bench_Random(&thread->seed));
+			void *ptr;
+
+			BENCH_CALL(thread, ptr = allocator->malloc_fp(size));
+			if (!ptr)
+				Bench_OutOfMemory(thread);
+			((volatile char*)ptr)[0] = (char)size;
+			while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == BENCH_RING_SIZE)
+				sched_yield();
+			ring->slot[head % BENCH_RING_SIZE] = ptr;
+			__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+		}
+	}
+}
+// Frees whatever the workload left live, in a scattered order
+static void Bench_Release(bench_thread_t *thread)
+{
+	const bench_allocator_t *allocator = thread->allocator;
+	size_t count = thread->num_blocks;
+	size_t stride = count % BENCH_RELEASE_STRIDE ? BENCH_RELEASE_STRIDE % count : 1;
+	size_t slot = 0;
+	size_t i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (thread->blocks[slot])
+		{
+			BENCH_CALL(thread, allocator->free_fp(thread->blocks[slot]));
+			thread->blocks[slot] = 0;
+		}
+		slot = (slot + stride) % count;
+	}
+}
+
+static void *Bench_ThreadMain(void *context)
+{
+	bench_thread_t *thread = (bench_thread_t*)context;
+
+	thread->run_fp(thread);
+
+	return 0;
+}
+
+// Returns the seconds taken for every thread to run fp
+static double Bench_RunThreads(bench_thread_t *threads, int count, void (*fp)(bench_thread_t *thread))
+{
+	double start = Bench_Now();
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		threads[i].run_fp = fp;
+		if (pthread_create(&threads[i].handle, 0, Bench_ThreadMain, &threads[i]))
+		{
+			fprintf(stderr, "couldn't create a thread\n");
+			_exit(1);
+		}
+	}
+	for (i = 0; i < count; i++)
+		pthread_join(threads[i].handle, 0);
+
+	return Bench_Now() - start;
+}
+
+// Runs in a process of its own, so that each case starts from a clean heap
+static void Bench_Execute(const bench_run_t *run, bench_result_t *result)
+{
+	bench_thread_t *threads = (bench_thread_t*)calloc((size_t)run->threads, sizeof(bench_thread_t));
+	bench_ring_t *rings = (bench_ring_t*)calloc((size_t)run->threads / 2 + 1, sizeof(bench_ring_t));
+	bench_latency_t latency;
+	int64_t rss_start;
+	int pass;
+	int i;
+
+	if (!threads || !rings)
+		_exit(1);
+
+	for (i = 0; i < run->threads; i++)
+	{
+		threads[i].allocator = run->allocator;
+		threads[i].iterations = run->iterations;
+		threads[i].num_blocks = run->live_blocks;
+		threads[i].consumer = i & 1;
+		threads[i].ring = &rings[i / 2];
+		// faulted in now, so that only the allocator's own memory shows in the RSS
+		threads[i].blocks = (void**)calloc(run->live_blocks + 1, sizeof(void*));
+		threads[i].sizes = (size_t*)calloc(run->live_blocks + 1, sizeof(size_t));
+		if (!threads[i].blocks || !threads[i].sizes)
+			_exit(1);
+		memset(threads[i].blocks, 0, (run->live_blocks + 1) * sizeof(void*));
+		memset(threads[i].sizes, 0, (run->live_blocks + 1) * sizeof(size_t));
+	}
+
+	if (run->allocator->managed)
+	{
+		Mem_Init();
+		Mem_SetBacktraceDepth((uint32_t)run->backtrace_depth);
+		Mem_SetBlockRegistry(run->allocator->block_registry);
+		Mem_SetSlabBackend(run->allocator->slab_backend);
+	}
+	rss_start = Bench_Rss();
+
+	memset(result, 0, sizeof(*result));
+	memset(&latency, 0, sizeof(latency));
+	for (pass = 0; pass < 2; pass++)
+	{
+		double seconds;
+
+		for (i = 0; i < run->threads; i++)
+		{
+			threads[i].seed = (uint64_t)i * 0x9E3779B97F4A7C15ull + 1;
+			threads[i].timed = pass;
+			threads[i].calls = 0;
+		}
+
+		seconds = Bench_RunThreads(threads, run->threads, run->bench_case->run_fp);
+		if (pass == 0)
+		{
+			result->rss_bytes = Bench_Rss() - rss_start;
+			// the peak is only updated now and then, so it can lag behind
+			result->peak_rss_bytes = Bench_PeakRss() - rss_start;
+			if (result->peak_rss_bytes < result->rss_bytes)
+				result->peak_rss_bytes = result->rss_bytes;
+			result->mem_used_bytes = run->allocator->managed ? Mem_MemoryUsed() : 0;
+			for (i = 0; i < run->threads; i++)
+			{
+				size_t j;
+
+				for (j = 0; j < threads[i].num_blocks; j++)
+				{
+					if (threads[i].blocks[j])
+					{
+						result->requested_bytes += threads[i].sizes[j];
+						result->live_count++;
+					}
+				}
+			}
+		}
+		seconds += Bench_RunThreads(threads, run->threads, Bench_Release);
+
+		for (i = 0; i < run->threads; i++)
+		{
+			if (pass == 0)
+				result->calls += threads[i].calls;
+			else
+			{
+				size_t j;
+
+				latency.count += threads[i].latency.count;
+				for (j = 0; j < BENCH_LATENCY_BUCKETS; j++)
+					latency.bucket[j] += threads[i].latency.bucket[j];
+			}
+		}
+		if (pass == 0)
+			result->seconds = seconds;
+	}
+
+	result->p50_ns = Bench_LatencyPercentile(&latency, 0.5);
+	result->p99_ns = Bench_LatencyPercentile(&latency, 0.99);
+	result->p999_ns = Bench_LatencyPercentile(&latency, 0.999);
+}
+// Returns nonzero if the case failed
+static int Bench_Fork(const bench_run_t *run, bench_result_t *result)
+{
+	int fds[2];
+	int status;
+	pid_t pid;
+	ssize_t got;
+
+	fflush(stdout);
+	if (pipe(fds))
+		return -1;
+
+	pid = fork();
+	if (pid < 0)
+	{
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	if (pid == 0)
+	{
+		close(fds[0]);
+		Bench_Execute(run, result);
+		_exit(write(fds[1], result, sizeof(*result)) == (ssize_t)sizeof(*result) ? 0 : 1);
+	}
+
+	close(fds[1]);
+	got = read(fds[0], result, sizeof(*result));
+	close(fds[0]);
+	waitpid(pid, &status, 0);
+
+	return got == (ssize_t)sizeof(*result) && WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+static void Bench_LoadBaseline(const char *path)
+{
+	char line[1024];
+	FILE *file = fopen(path, "r");
+
+	if (!file)
+	{
+		fprintf(stderr, "couldn't open %s\n", path);
+		exit(2);
+	}
+
+	// only what Bench_Print writes, which starts with the fields a case is matched on
+	while (g_bench.num_baseline < BENCH_MAX_BASELINE && fgets(line, sizeof(line), file))
+	{
+		bench_baseline_t *baseline = &g_bench.baseline[g_bench.num_baseline];
+
+		if (sscanf(line, "{\"case\":\"%31[^\"]\",\"allocator\":\"%31[^\"]\",\"threads\":%d,\"backtrace_depth\":%d,\"live_blocks\":%zu,\"ops_per_sec\":%lf",
+			baseline->name, baseline->allocator, &baseline->threads, &baseline->backtrace_depth, &baseline->live_blocks, &baseline->ops_per_sec) == 6)
+			g_bench.num_baseline++;
+	}
+	fclose(file);
+}
+static const bench_baseline_t *Bench_FindBaseline(const char *name, const char *allocator, int threads, int backtrace_depth, size_t live_blocks)
+{
+	int i;
+
+	for (i = 0; i < g_bench.num_baseline; i++)
+	{
+		const bench_baseline_t *baseline = &g_bench.baseline[i];
+
+		if (!strcmp(baseline->name, name) && !strcmp(baseline->allocator, allocator) && baseline->threads == threads
+			&& baseline->backtrace_depth == backtrace_depth && baseline->live_blocks == live_blocks)
+			return baseline;
+	}
+
+	return 0;
+}
+// Returns the throughput against the baseline's, or 0 if there's no baseline for the case
+static double Bench_Print(const bench_run_t *run, const bench_result_t *result, double glibc_ops_per_sec)
+{
+	const bench_baseline_t *baseline = Bench_FindBaseline(run->bench_case->name, run->allocator->name, run->threads, run->backtrace_depth,
+		run->live_blocks);
+	double ops_per_sec = result->seconds > 0 ? (double)result->calls / result->seconds : 0;
+	double vs_baseline = baseline && baseline->ops_per_sec > 0 ? ops_per_sec / baseline->ops_per_sec : 0;
+
+	printf("{\"case\":\"%s\",\"allocator\":\"%s\",\"threads\":%d,\"backtrace_depth\":%d,\"live_blocks\":%zu,\"ops_per_sec\":%.0f,", run->bench_case->name,
+		run->allocator->name, run->threads, run->backtrace_depth, run->live_blocks, ops_per_sec);
+	printf("\"ops\":%llu,\"seconds\":%.4f,\"p50_ns\":%.1f,\"p99_ns\":%.1f,\"p999_ns\":%.1f,", (unsigned long long)result->calls, result->seconds,
+		result->p50_ns, result->p99_ns, result->p999_ns);
+	printf("\"rss_bytes\":%lld,\"peak_rss_bytes\":%lld,\"requested_bytes\":%zu,", (long long)result->rss_bytes, (long long)result->peak_rss_bytes,
+		result->requested_bytes);
+	if (run->allocator->managed)
+		printf("\"mem_used_bytes\":%zu,", result->mem_used_bytes);
+	else
+		printf("\"mem_used_bytes\":null,");
+	// what each live block costs beyond the bytes asked for, from the RSS and, for the library, from Mem_MemoryUsed
+	if (result->live_count)
+		printf("\"overhead_per_object\":%.1f,", (double)(result->rss_bytes - (int64_t)result->requested_bytes) / (double)result->live_count);
+	else
+		printf("\"overhead_per_object\":null,");
+	if (run->allocator->managed && result->live_count)
+		printf("\"mem_used_overhead_per_object\":%.1f,", ((double)result->mem_used_bytes - (double)result->requested_bytes) / (double)result->live_count);
+	else
+		printf("\"mem_used_overhead_per_object\":null,");
+	if (result->live_count)
+		printf("\"bytes_per_object\":%.1f,", (double)result->rss_bytes / (double)result->live_count);
+	else
+		printf("\"bytes_per_object\":null,");
+	if (run->allocator->managed)
+		printf("\"header_bytes\":%zu,", sizeof(malloc_block_t));
+	else
+		printf("\"header_bytes\":null,");
+	printf("\"throughput_vs_glibc\":%.3f,", glibc_ops_per_sec > 0 ? ops_per_sec / glibc_ops_per_sec : 0);
+	if (baseline)
+		printf("\"throughput_vs_baseline\":%.3f}\n", vs_baseline);
+	else
+		printf("\"throughput_vs_baseline\":null}\n");
+
+	return vs_baseline;
+}
+
+// Recurses BENCH_UNWIND_FRAMES deep, then calls the unwinder iterations times, untimed for the throughput and then call
+// by call for the latency percentiles
+static __attribute__((noinline)) int Bench_Unwind(const bench_unwinder_t *unwinder, int depth, uint64_t iterations, int frames, bench_result_t *result)
+{
+	volatile int keep = 0;	// read after the call, so that the recursion can't become a loop
+	void *stack[64];
+	bench_latency_t latency;
+	double start;
+	uint64_t i;
+	int count;
+
+	if (frames > 0)
+	{
+		count = Bench_Unwind(unwinder, depth, iterations, frames - 1, result);
+		return count + keep;
+	}
+
+	// glibc's first backtrace() loads libgcc_s
+	count = unwinder->backtrace_fp(stack, depth);
+
+	start = Bench_Now();
+	for (i = 0; i < iterations; i++)
+		unwinder->backtrace_fp(stack, depth);
+	result->seconds = Bench_Now() - start;
+	result->calls = iterations;
+
+	memset(&latency, 0, sizeof(latency));
+	for (i = 0; i < iterations; i++)
+	{
+		uint64_t cycles = Platform_Cycles();
+
+		unwinder->backtrace_fp(stack, depth);
+		Bench_LatencyAdd(&latency, Platform_Cycles() - cycles, 1);
+	}
+	result->p50_ns = Bench_LatencyPercentile(&latency, 0.5);
+	result->p99_ns = Bench_LatencyPercentile(&latency, 0.99);
+	result->p999_ns = Bench_LatencyPercentile(&latency, 0.999);
+
+	return count;
+}
+// Prints the same leading fields as Bench_Print, with the unwinder as the allocator, and returns the throughput against
+// the baseline's, or 0 if there's no baseline for it
+static double Bench_PrintUnwinder(const bench_unwinder_t *unwinder, int depth, int frames, const bench_result_t *result, double glibc_ops_per_sec)
+{
+	const bench_baseline_t *baseline = Bench_FindBaseline("unwinder", unwinder->name, 1, depth, 0);
+	double ops_per_sec = result->seconds > 0 ? (double)result->calls / result->seconds : 0;
+	double vs_baseline = baseline && baseline->ops_per_sec > 0 ? ops_per_sec / baseline->ops_per_sec : 0;
+
+	printf("{\"case\":\"unwinder\",\"allocator\":\"%s\",\"threads\":1,\"backtrace_depth\":%d,\"live_blocks\":0,\"ops_per_sec\":%.0f,", unwinder->name,
+		depth, ops_per_sec);
+	printf("\"ops\":%llu,\"seconds\":%.4f,\"p50_ns\":%.1f,\"p99_ns\":%.1f,\"p999_ns\":%.1f,\"frames\":%d,", (unsigned long long)result->calls,
+		result->seconds, result->p50_ns, result->p99_ns, result->p999_ns, frames);
+	printf("\"throughput_vs_glibc\":%.3f,", glibc_ops_per_sec > 0 ? ops_per_sec / glibc_ops_per_sec : 0);
+	if (baseline)
+		printf("\"throughput_vs_baseline\":%.3f}\n", vs_baseline);
+	else
+		printf("\"throughput_vs_baseline\":null}\n");
+
+	return vs_baseline;
+}
+// Returns nonzero if the platform unwinder lost more than max_loss percent against the baseline
+static int Bench_Unwinders(double scale, double max_loss)
+{
+	uint64_t iterations = (uint64_t)((double)BENCH_UNWIND_ITERATIONS * scale);
+	int regressed = 0;
+	size_t d, u;
+
+	for (d = 0; d < sizeof(g_bench_unwind_depths) / sizeof(g_bench_unwind_depths[0]); d++)
+	{
+		double glibc_ops_per_sec = 0;
+
+		for (u = 0; u < sizeof(g_bench_unwinders) / sizeof(g_bench_unwinders[0]); u++)
+		{
+			const bench_unwinder_t *unwinder = &g_bench_unwinders[u];
+			int depth = g_bench_unwind_depths[d];
+			bench_result_t result;
+			double vs_baseline;
+			int frames;
+
+			memset(&result, 0, sizeof(result));
+			frames = Bench_Unwind(unwinder, depth, iterations, BENCH_UNWIND_FRAMES, &result);
+			if (u == 0)
+				glibc_ops_per_sec = result.seconds > 0 ? (double)result.calls / result.seconds : 0;
+
+			vs_baseline = Bench_PrintUnwinder(unwinder, depth, frames, &result, glibc_ops_per_sec);
+			if (u > 0 && vs_baseline > 0 && vs_baseline < 1 - max_loss / 100)
+			{
+				fprintf(stderr, "unwinder: %s at depth %d lost %.1f%% throughput\n", unwinder->name, depth, (1 - vs_baseline) * 100);
+				regressed = 1;
+			}
+		}
+	}
+
+	return regressed;
+}
+
+static const bench_case_t g_bench_cases[] =
+{
+	{"churn",		Bench_Churn,			1,	1,	1000000,	BENCH_CHURN_SLOTS},
+	{"churn_mt",	Bench_Churn,			BENCH_THREAD_SWEEP,	1,	250000,	BENCH_CHURN_SLOTS},
+	{"prodcons",	Bench_ProducerConsumer,	0,	0,	500000,		0},
+	{"realloc",		Bench_Realloc,			1,	0,	1000000,	BENCH_REALLOC_VECTORS},
+	{"liveset",		Bench_LiveSet,			1,	0,	0,			BENCH_LIVE_SETS},
+	{"objects32",	Bench_Objects,			1,	0,	0,			BENCH_OBJECTS},
+	{"batch",		Bench_Batch,			1,	0,	50000,		BENCH_BATCH_SIZE},
+};
+
+static int Bench_Selected(const bench_allocator_t *allocator)
+{
+	return !g_bench.only_allocator || !strcmp(g_bench.only_allocator, allocator->name);
+}
+// Runs the case against glibc and then every managed allocator, and returns nonzero if any of them failed
+static int Bench_RunAllocators(bench_run_t *run, double max_loss, int *regressed)
+{
+	const bench_case_t *bench_case = run->bench_case;
+	bench_result_t result;
+	double glibc_ops_per_sec = 0;
+	int failed = 0;
+	size_t a;
+	int d;
+
+	// glibc has no backtraces, so it's only run once, as the baseline for every depth
+	run->allocator = &g_bench_glibc;
+	run->backtrace_depth = 0;
+	if (Bench_Selected(run->allocator) && Bench_Fork(run, &result))
+	{
+		fprintf(stderr, "%s: %s failed\n", bench_case->name, run->allocator->name);
+		failed = 1;
+	}
+	else if (Bench_Selected(run->allocator))
+	{
+		glibc_ops_per_sec = result.seconds > 0 ? (double)result.calls / result.seconds : 0;
+		Bench_Print(run, &result, glibc_ops_per_sec);
+	}
+
+	// the fast tier is meant for production, where nothing takes backtraces, and the slab backend only changes where
+	// small blocks come from, so only the plain managed runs are repeated at each depth
+	for (a = 0; a < sizeof(g_bench_managed) / sizeof(g_bench_managed[0]); a++)
+	{
+		int varies = bench_case->vary_depth && g_bench_managed[a].block_registry && !g_bench_managed[a].slab_backend;
+		int depths = varies ? (int)(sizeof(g_bench_depths) / sizeof(g_bench_depths[0])) : 1;
+
+		if (g_bench_managed[a].batch && bench_case->run_fp != Bench_Batch)
+			continue;
+		if (!Bench_Selected(&g_bench_managed[a]))
+			continue;
+		run->allocator = &g_bench_managed[a];
+		for (d = 0; d < depths; d++)
+		{
+			double vs_baseline;
+
+			run->backtrace_depth = g_bench_depths[d];
+			if (Bench_Fork(run, &result))
+			{
+				fprintf(stderr, "%s: %s failed\n", bench_case->name, run->allocator->name);
+				failed = 1;
+				continue;
+			}
+
+			vs_baseline = Bench_Print(run, &result, glibc_ops_per_sec);
+			if (vs_baseline > 0 && vs_baseline < 1 - max_loss / 100)
+			{
+				fprintf(stderr, "%s: %s with %d threads at depth %d lost %.1f%% throughput\n", bench_case->name, run->allocator->name, run->threads,
+					run->backtrace_depth, (1 - vs_baseline) * 100);
+				*regressed = 1;
+			}
+		}
+	}
+
+	return failed;
+}
+
+int main(int argc, char **argv)
+{
+	const char *only = 0;
+	int threads = 4;
+	double scale = 1;
+	size_t live[BENCH_MAX_LIVE_SETS] = {1000000};
+	int num_live = 1;
+	double max_loss = 10;
+	int regressed = 0;
+	int failed = 0;
+	size_t c;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:a:t:s:l:b:r:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'c':
+			only = optarg;
+			break;
+		case 'a':
+			g_bench.only_allocator = optarg;
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 's':
+			scale = atof(optarg);
+			break;
+		case 'l':
+		{
+			char *next = optarg;
+
+			for (num_live = 0; num_live < BENCH_MAX_LIVE_SETS && *next; num_live++)
+			{
+				live[num_live] = (size_t)strtoull(next, &next, 0);
+				if (*next == ',')
+					next++;
+			}
+			break;
+		}
+		case 'b':
+			Bench_LoadBaseline(optarg);
+			break;
+		case 'r':
+			max_loss = atof(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-c case] [-a allocator] [-t threads] [-s scale] [-l live,...] [-b baseline.jsonl [-r percent]]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (threads < 2)
+		threads = 2;
+	if (threads > BENCH_MAX_THREADS)
+		threads = BENCH_MAX_THREADS;
+
+	Bench_CalibrateTimer();
+
+	for (c = 0; c < sizeof(g_bench_cases) / sizeof(g_bench_cases[0]); c++)
+	{
+		const bench_case_t *bench_case = &g_bench_cases[c];
+		int num_sizes = bench_case->live_blocks == BENCH_LIVE_SETS ? num_live : 1;
+		int s;
+
+		if (only && strcmp(only, bench_case->name))
+			continue;
+
+		for (s = 0; s < num_sizes; s++)
+		{
+			int max_threads = bench_case->threads > 0 ? bench_case->threads : threads;
+			int t = bench_case->threads == BENCH_THREAD_SWEEP ? 1 : max_threads;
+
+			for (;;)
+			{
+				bench_run_t run;
+
+				run.bench_case = bench_case;
+				run.threads = t;
+				if (bench_case->run_fp == Bench_ProducerConsumer)
+					run.threads &= ~1;
+				run.live_blocks = bench_case->live_blocks == BENCH_LIVE_SETS ? live[s] : bench_case->live_blocks;
+				run.iterations = bench_case->iterations ? (uint64_t)((double)bench_case->iterations * scale) : run.live_blocks;
+				failed |= Bench_RunAllocators(&run, max_loss, &regressed);
+
+				if (t == max_threads)
+					break;
+				t = t * 2 < max_threads ? t * 2 : max_threads;
+			}
+		}
+	}
+
+	if ((!only || !strcmp(only, "unwinder")) && !g_bench.only_allocator)
+		regressed |= Bench_Unwinders(scale, max_loss);
+
+	return failed ? 2 : regressed;
+}
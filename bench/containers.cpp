@@ -0,0 +1,101 @@
+// std::vector and std::unordered_map churn, with the default allocator against ManagedAllocator and the pmr adapter.
+// Prints one line per case: the case, the allocator, and nanoseconds per container operation.
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include "../inc/memory.hpp"
+
+#define BENCH_ROUNDS		200
+#define BENCH_VECTORS		1000	// per round, each grown element by element to BENCH_VECTOR_SIZE
+#define BENCH_VECTOR_SIZE	64
+#define BENCH_MAP_KEYS		20000	// per round, inserted then erased
+
+template <class Vector>
+static long VectorChurn(const Vector &prototype)
+{
+	long checksum = 0;
+
+	for (int round = 0; round < BENCH_ROUNDS; round++)
+	{
+		std::vector<Vector> vectors;
+
+		vectors.reserve(BENCH_VECTORS);
+		for (int i = 0; i < BENCH_VECTORS; i++)
+		{
+			// by allocator rather than by copy, which a pmr vector would give the default resource
+			vectors.emplace_back(prototype.get_allocator());
+			for (int j = 0; j < BENCH_VECTOR_SIZE; j++)
+				vectors.back().push_back(i + j);
+		}
+		for (const Vector &vector : vectors)
+			checksum += vector.back();
+	}
+
+	return checksum;
+}
+
+template <class Map>
+static long MapChurn(Map &map)
+{
+	long checksum = 0;
+
+	for (int round = 0; round < BENCH_ROUNDS; round++)
+	{
+		for (int i = 0; i < BENCH_MAP_KEYS; i++)
+			map[i * 7919] = i;
+		for (int i = 0; i < BENCH_MAP_KEYS; i++)
+			checksum += (long)map.erase(i * 7919);
+	}
+
+	return checksum;
+}
+
+static void Bench_Run(const char *name, const char *allocator, long operations, const std::function<long()> &run)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	long checksum = run();
+	double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+	printf("%-14s %-10s %8.2f ns/op   (checksum %ld)\n", name, allocator, ns / (double)operations, checksum);
+}
+
+int main()
+{
+	const long vector_ops = (long)BENCH_ROUNDS * BENCH_VECTORS * BENCH_VECTOR_SIZE;
+	const long map_ops = (long)BENCH_ROUNDS * BENCH_MAP_KEYS * 2;
+
+	Mem_Init();
+
+	Bench_Run("vector", "default", vector_ops, [] { return VectorChurn(std::vector<int>()); });
+	Bench_Run("vector", "managed", vector_ops, [] { return VectorChurn(std::vector<int, ManagedAllocator<int> >()); });
+	Bench_Run("unordered_map", "default", map_ops, []
+	{
+		std::unordered_map<int, int> map;
+		return MapChurn(map);
+	});
+	Bench_Run("unordered_map", "managed", map_ops, []
+	{
+		std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, ManagedAllocator<std::pair<const int, int> > > map;
+		return MapChurn(map);
+	});
+#ifdef MEM_HAS_MEMORY_RESOURCE
+	{
+		ManagedMemoryResource resource;
+
+		Bench_Run("vector", "pmr", vector_ops, [&resource] { return VectorChurn(std::pmr::vector<int>(&resource)); });
+		Bench_Run("unordered_map", "pmr", map_ops, [&resource]
+		{
+			std::pmr::unordered_map<int, int> map(&resource);
+			return MapChurn(map);
+		});
+	}
+#endif
+
+	Mem_Destroy();
+
+	return 0;
+}
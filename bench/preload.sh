@@ -0,0 +1,28 @@
+#!/bin/sh
+# What the LD_PRELOAD interposer costs. Runs the glibc rows of bench/allocators, whose calls go straight to malloc and
+# free, as they are, then under libmanagedmalloc_preload.so with MEM_PRELOAD_TRACKING=0, where every call is only
+# forwarded to glibc, and with MEM_PRELOAD_TRACKING=1, where every block is tracked. The rows under the interposer are
+# renamed preload_forwarding and preload_tracking, and their throughput_vs_baseline is against plain glibc.
+#
+#     make all bench && bench/preload.sh [-c case] [-t threads] [-s scale] [-l live,...]
+
+set -e
+cd "$(dirname "$0")/.."
+
+if [ ! -x bench/allocators ] || [ ! -f libmanagedmalloc_preload.so ]; then
+	echo "run make all bench first" >&2
+	exit 2
+fi
+
+plain=$(mktemp)
+trap 'rm -f "$plain"' EXIT
+
+bench/allocators -a glibc "$@" > "$plain"
+cat "$plain"
+
+# -r 100, since the interposer is expected to be slower than glibc alone
+for tracking in 0 1; do
+	if [ $tracking = 1 ]; then name=preload_tracking; else name=preload_forwarding; fi
+	LD_PRELOAD=./libmanagedmalloc_preload.so MEM_PRELOAD_TRACKING=$tracking bench/allocators -a glibc -b "$plain" -r 100 "$@" \
+		| sed "s/\"allocator\":\"glibc\"/\"allocator\":\"$name\"/"
+done
@@ -0,0 +1,40 @@
+// Append-only, deduplicated table of allocation call sites: where blocks were allocated from, the stack they were
+// allocated with, the budget they were charged to and the rate they were sampled at. Each distinct call site is stored
+// once and identified by a nonzero 32-bit id, so block headers only need to carry the id. Lookups never take a lock;
+// only interning a call site that hasn't been seen before does.
+
+#define CALLSITE_GENERATIONS		16		// the most recent generations each source line keeps statistics for
+
+typedef struct call_site_s
+{
+	const char		*file;					// compared by address, so these must be immutable
+	const char		*function;
+	int				line;
+	int				tag;
+	uint32_t		stack_id;
+	size_t			sample_rate;			// nonzero if blocks from here stand for others, at this many bytes per sample
+}call_site_t;
+
+// Running totals of every call site on the same source line, so blocks allocated with different stacks or tags still
+// add up to one line. Each line also keeps separate totals for the blocks of each of its last CALLSITE_GENERATIONS
+// generations (see Mem_MarkGeneration), in a ring that's only made once the line allocates after a mark, and one total
+// for all the generations before those.
+typedef struct call_site_stats_s
+{
+	volatile int64_t	live_bytes;
+	volatile int64_t	live_blocks;
+	volatile int64_t	total_allocs;
+	volatile int64_t	total_bytes;			// allocated over the lifetime
+	volatile int64_t	total_frees;
+	volatile int64_t	peak_bytes;
+}call_site_stats_t;
+
+uint32_t			CallSite_Intern(const call_site_t *site); // returns 0 if the call site couldn't be stored
+const call_site_t	*CallSite_Get(uint32_t id); // returns an empty call site for 0 or an unknown id
+call_site_stats_t	*CallSite_GetStats(uint32_t id); // statistics of the id's source line, NULL for 0 or an unknown id
+void				CallSite_ApplyGenerationStats(uint32_t id, uint32_t generation, void (*apply_fp)(call_site_stats_t *stats, const void *context), const void *context); // runs apply_fp, under the ring's lock, on the statistics of the id's source line within generation, or within the older generations once it has left the ring; nothing for generation 0
+int					CallSite_GetGenerationStats(uint32_t id, uint32_t since, call_site_stats_t *stats); // sums the id's source line over generation since and later, returns -1 if there's nothing, or 1 if since falls among the older generations, which can't be told apart
+uint32_t			CallSite_LineId(uint32_t id); // id of the call site with only the file, function and line of this one, 0 if unknown
+uint32_t			CallSite_Count(); // ids are always in [1, CallSite_Count()]
+size_t				CallSite_MemUsed();
+void				CallSite_Destroy(); // NOT thread-safe, invalidates every id
@@ -0,0 +1,15 @@
+typedef struct hash_table_s
+{
+	void					**slot;
+	size_t					capacity;		// always zero or a power-of-two
+	size_t					count;
+}hash_table_t;
+
+void			HashTable_Init(hash_table_t *table);
+int				HashTable_Insert(hash_table_t *table, void *value); // returns nonzero if the table could not grow
+int				HashTable_Contains(hash_table_t *table, void *value);
+int				HashTable_Delete(hash_table_t *table, void *value); // returns nonzero if the value was present
+void			HashTable_Destroy(hash_table_t *table, void *context, void (*delete_fp)(void *value, void *context));
+void			HashTable_Walk(hash_table_t *table, void *context, int (*callback_fp)(void *value, void *context)); // returns quicker when callback returns nonzero
+size_t			HashTable_MemUsed(hash_table_t *table);
+size_t			HashTable_InsertCost(hash_table_t *table); // how much HashTable_MemUsed grows by if the next insert has to resize
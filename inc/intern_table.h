@@ -0,0 +1,42 @@
+// Append-only, deduplicated table of records, each identified by a nonzero 32-bit id. Lookups by key or by id never take
+// a lock; only interning a record that isn't there yet does. Records are never freed or moved until the table is
+// destroyed. The stack depot and the call-site table are both built on it: each of their records starts with an
+// intern_record_t, followed by the owner's key and data.
+
+#define INTERNTABLE_NUM_BUCKETS		16384	// power-of-two
+#define INTERNTABLE_PAGE_SIZE		4096	// ids per page of the id -> record table
+#define INTERNTABLE_MAX_PAGES		1024	// so at most 4M distinct records
+#define INTERNTABLE_CHUNK_SIZE		65536	// records are bump-allocated from chunks of this size
+
+typedef struct intern_record_s
+{
+	struct intern_record_s * volatile	next;		// in the bucket chain
+	uint32_t							hash;
+	uint32_t							id;
+}intern_record_t;
+
+typedef struct intern_table_s
+{
+	mutex_t						mutex;			// serialises interning, never taken by lookups
+	intern_record_t * volatile	bucket[INTERNTABLE_NUM_BUCKETS];
+	intern_record_t ** volatile	page[INTERNTABLE_MAX_PAGES];
+	volatile int32_t			count;
+	char						*chunk;			// current chunk, bump-allocated from chunk_used
+	size_t						chunk_used;
+	void						*chunks;		// every chunk, singly linked through its first word
+	size_t						memory_used;
+}intern_table_t;
+
+#define INTERNTABLE_INIT	{ MUTEX_INIT, {0}, {0}, 0, 0, 0, 0, 0 }
+
+// equal_fp is only called on records with the same hash. init_fp fills in everything after the intern_record_t, before
+// the record is published.
+typedef int		(*intern_equal_fp)(const intern_record_t *record, const void *key);
+typedef void	(*intern_init_fp)(intern_record_t *record, const void *key, void *context);
+
+intern_record_t	*InternTable_Find(intern_table_t *table, uint32_t hash, const void *key, intern_equal_fp equal_fp); // NULL if the key isn't interned yet
+uint32_t		InternTable_Intern(intern_table_t *table, uint32_t hash, const void *key, size_t record_size, intern_equal_fp equal_fp, intern_init_fp init_fp, void *context); // returns 0 if the record couldn't be stored
+intern_record_t	*InternTable_Get(intern_table_t *table, uint32_t id); // NULL for 0 or an unknown id
+uint32_t		InternTable_Count(intern_table_t *table); // ids are always in [1, InternTable_Count()]
+size_t			InternTable_MemUsed(intern_table_t *table);
+void			InternTable_Destroy(intern_table_t *table); // NOT thread-safe, invalidates every id
@@ -1,53 +1,180 @@
-typedef struct backtrace_s
-{
-	int					num_entries;
-	void				**entry;
-}backtrace_t;
-
-typedef struct malloc_block_s
-{
-	void				*base;
-	char				*file_immutable;
-	char				*function_immutable;
-	backtrace_t			backtrace;
-	size_t				alignment;
-	size_t				memsize;			// the user-data size. NOT the size of the allocation + overhead.
-	int					line;
-}malloc_block_t;
-
-#define FREE_FAILURE_NULL		1
-#define FREE_FAILURE_DANGLING	2
-
-#define Mem_Malloc(x)				Mem_Malloc_IMP(x, __FILE__, __FUNCTION__, __LINE__)
-#define Mem_Realloc(x, y)			Mem_Realloc_IMP(x, y, __FILE__, __FUNCTION__, __LINE__)
-#define Mem_MallocAligned(x, y)		Mem_MallocAligned_IMP(x, y, __FILE__, __FUNCTION__, __LINE__)
-#define Mem_ReallocAligned(x, y, z)	Mem_ReallocAligned_IMP(x, y, z, __FILE__, __FUNCTION__, __LINE__)
-#define Mem_Free(x)					Mem_Free_IMP(x, __FILE__, __FUNCTION__, __LINE__)
-#define Mem_FreeZ(x)				Mem_FreeZ_IMP(x, __FILE__, __FUNCTION__, __LINE__)
-
-void Mem_Init();
-size_t Mem_MemSize(void *memblock);
-void *Mem_Malloc_IMP(size_t size, char *file, char *function, int line);
-void *Mem_Realloc_IMP(void *ptr, size_t size, char *file, char *function, int line);
-void *Mem_MallocAligned_IMP(size_t size, uint32_t alignment, char *file, char *function, int line);
-void *Mem_ReallocAligned_IMP(void *ptr, size_t size, uint32_t alignment, char *file, char *function, int line);
-void Mem_Free_IMP(void *memblock, char *file, char *function, int line);
-void Mem_FreeZ_IMP(void **memblock, char *file, char *function, int line);
-size_t Mem_ReportAllocatedBlocks();
-void Mem_FreeAll();
-void Mem_Destroy();
-size_t Mem_MemoryUsed();
-size_t Mem_MemoryLimit();
-size_t Mem_MemoryRemaining();
-void Mem_SetMallocFailCallback(void (*malloc_failure_fp)(size_t allocation_size, size_t max_memory, size_t memory_remaining));
-void Mem_SetFreeNullCallback(void (*free_failure_fp)(int type, void *old_block, size_t max_memory, size_t memory_remaining));
-void Mem_SetFreeDanglingCallback(void (*free_failure_fp)(int type, void *old_block, size_t max_memory, size_t memory_remaining));
-void Mem_SetFreeZNullCallback(void (*freeZ_failure_fp)(int type, void **old_block, size_t max_memory, size_t memory_remaining));
-void Mem_SetBacktraceDepth(uint32_t max_depth);
-void Mem_SetMemoryLimit(size_t size);
-void (*Mem_GetDefaultMallocFail())(size_t allocation_size, size_t max_memory, size_t memory_remaining);
-void (*Mem_GetDefaultFreeDanglingFail())(int type, void *old_block, size_t max_memory, size_t memory_remaining);
-void (*Mem_GetDefaultFreeNULLFail())(int type, void *old_block, size_t max_memory, size_t memory_remaining);
-void (*Mem_GetDefaultFreeZNULLFail())(int type, void **old_block, size_t max_memory, size_t memory_remaining);
-void *Mem_RawToManaged(void *memblock, size_t size);
+#include <stddef.h>
+#include <stdint.h>
+
+// Everything else known about a block (where it was allocated, its stack, its tag and whether it was sampled) lives in
+// a shared call-site record, so the header only carries what's needed to find and size the underlying allocation, and,
+// in the full header, the generation it was allocated in.
+#ifdef MEM_COMPACT_HEADER
+typedef struct malloc_block_s
+{
+	uint32_t			callsite;			// call-site id, 0 if it couldn't be recorded
+	uint32_t			offset;				// of this header from the start of the underlying allocation
+	uint64_t			memsize : 40;		// the user-data size. NOT the size of the allocation + overhead.
+	uint64_t			slack : 16;			// bytes of the underlying allocation past the user data, saturating
+	uint64_t			size_class : 8;		// nonzero if the underlying allocation can be recycled through a thread cache
+}malloc_block_t;
+#else
+// The cookie is a keyed hash of the header and its address, which also says whether the block is in the registry or was
+// freed. A freed block's cookie only covers the second half, since the first is reused once the block is cached.
+typedef struct malloc_block_s
+{
+	uint32_t			callsite;			// call-site id, 0 if it couldn't be recorded
+	uint32_t			generation;			// see Mem_MarkGeneration
+	uint64_t			allocsize : 56;		// the size of the underlying allocation, including this header and any alignment slack
+	uint64_t			size_class : 8;		// nonzero if the underlying allocation can be recycled through a thread cache
+	size_t				memsize;			// the user-data size. NOT the size of the allocation + overhead.
+	uint32_t			offset;				// of this header from the start of the underlying allocation
+	uint32_t			cookie;
+}malloc_block_t;
+#endif
+
+typedef struct mem_tag_stats_s
+{
+	const char			*name;
+	int					parent;
+	size_t				used;				// underlying allocation sizes, so including headers and alignment slack
+	size_t				peak;
+	size_t				limit;				// 0 if unlimited
+}mem_tag_stats_t;
+
+// Per source line, whatever stack, tag or sampling its blocks were allocated with
+typedef struct mem_callsite_stats_s
+{
+	const char			*file;
+	const char			*function;
+	int					line;
+	size_t				live_bytes;			// user-data sizes
+	size_t				live_blocks;
+	uint64_t			total_allocs;		// a reallocation counts as a free at the old line and an allocation at the new one
+	uint64_t			total_bytes;		// allocated over the lifetime
+	uint64_t			total_frees;
+	size_t				peak_bytes;			// of live_bytes, approximate while several threads use the line at once
+}mem_callsite_stats_t;
+
+// A live block, as seen by Mem_WalkAllocatedBlocks
+typedef struct mem_block_info_s
+{
+	void				*memblock;			// may already have been freed by the time the callback sees it
+	size_t				size;
+	const char			*file;
+	const char			*function;
+	int					line;
+	int					tag;
+	void				**stack;			// innermost frame first, NULL without a backtrace
+	int					stack_entries;
+	size_t				sample_rate;		// nonzero if the block was sampled, see Mem_SetSampleRate
+	uint32_t			generation;			// see Mem_MarkGeneration, always 0 with compact headers
+}mem_block_info_t;
+
+#define MEM_STATS_BUCKETS		64
+
+// Log2-bucketed: bucket 0 counts zeros, bucket i the values in [2^(i-1), 2^i)
+typedef struct mem_histogram_s
+{
+	uint64_t			count;
+	uint64_t			sum;
+	uint64_t			bucket[MEM_STATS_BUCKETS];
+}mem_histogram_t;
+
+// Allocator instrumentation, see Mem_GetStats. Durations are in Platform_Cycles units, and each thread only times one
+// call in 8, so the latency counts are about an eighth of the calls made.
+typedef struct mem_stats_s
+{
+	mem_histogram_t		malloc_cycles;
+	mem_histogram_t		realloc_cycles;		// including any move done through malloc and free
+	mem_histogram_t		free_cycles;
+	mem_histogram_t		request_size;		// of successful allocations and reallocations
+	mem_histogram_t		alignment;
+	uint64_t			lock_acquisitions;	// of the registry locks
+	mem_histogram_t		lock_wait_cycles;	// only the acquisitions that had to wait
+	mem_histogram_t		lifetime_cycles;	// from allocation to free, of about one block in 64
+}mem_stats_t;
+
+typedef struct mem_arena_s mem_arena_t;
+
+#define FREE_FAILURE_NULL		1
+#define FREE_FAILURE_DANGLING	2
+#define FREE_FAILURE_SIZE		3			// Mem_FreeSized of a live block with a different size, which is still freed
+#define FREE_FAILURE_CORRUPT	4			// the block's header was overwritten, so its cookie doesn't check out, and it's left alone
+
+#define MEM_TAG_NONE			0			// root of the budget tree, the whole process
+
+#define MEM_GENERATION_EXPIRED	((size_t)-1)	// from Mem_GetGenerationStats, for a since some line can no longer tell apart
+
+#define MEM_RECLAIM_SOFT		1			// over the soft watermark, called on the library's reclaim thread
+#define MEM_RECLAIM_HARD		2			// over the hard watermark, called on the allocating thread before it carries on
+#define MEM_RECLAIM_LIMIT		3			// an allocation is about to fail, called on its thread, which then retries it
+
+#define Mem_Malloc(x)				Mem_Malloc_IMP(x, __FILE__, __FUNCTION__, __LINE__)
+#define Mem_Realloc(x, y)			Mem_Realloc_IMP(x, y, __FILE__, __FUNCTION__, __LINE__)
+#define Mem_MallocAligned(x, y)		Mem_MallocAligned_IMP(x, y, __FILE__, __FUNCTION__, __LINE__)
+#define Mem_ReallocAligned(x, y, z)	Mem_ReallocAligned_IMP(x, y, z, __FILE__, __FUNCTION__, __LINE__)
+#define Mem_MallocTagged(t, x)		Mem_MallocTagged_IMP(t, x, 1, __FILE__, __FUNCTION__, __LINE__)
+#define Mem_MallocAlignedTagged(t, x, y)	Mem_MallocTagged_IMP(t, x, y, __FILE__, __FUNCTION__, __LINE__)
+#define Mem_Free(x)					Mem_Free_IMP(x, __FILE__, __FUNCTION__, __LINE__)
+#define Mem_FreeZ(x)				Mem_FreeZ_IMP(x, __FILE__, __FUNCTION__, __LINE__)
+#define Mem_FreeSized(x, s)			Mem_FreeSized_IMP(x, s, __FILE__, __FUNCTION__, __LINE__)
+#define Mem_MallocBatch(n, x, o)	Mem_MallocBatch_IMP(n, x, o, __FILE__, __FUNCTION__, __LINE__)
+#define Mem_FreeBatch(o, n)			Mem_FreeBatch_IMP(o, n, __FILE__, __FUNCTION__, __LINE__)
+#define Mem_ArenaCreate(x)			Mem_ArenaCreate_IMP(x, __FILE__, __FUNCTION__, __LINE__)
+
+void Mem_Init();
+size_t Mem_MemSize(void *memblock);
+size_t Mem_BlockTotalMemUsed(void *memblock); // of the underlying allocation, so including the header and any slack, or the whole mapping of a large block
+void *Mem_Malloc_IMP(size_t size, const char *file, const char *function, int line);
+void *Mem_Realloc_IMP(void *ptr, size_t size, const char *file, const char *function, int line);
+void *Mem_MallocAligned_IMP(size_t size, uint32_t alignment, const char *file, const char *function, int line);
+void *Mem_ReallocAligned_IMP(void *ptr, size_t size, uint32_t alignment, const char *file, const char *function, int line);
+void *Mem_MallocTagged_IMP(int tag, size_t size, uint32_t alignment, const char *file, const char *function, int line);
+void Mem_Free_IMP(void *memblock, const char *file, const char *function, int line);
+void Mem_FreeZ_IMP(void **memblock, const char *file, const char *function, int line);
+void Mem_FreeSized_IMP(void *memblock, size_t size, const char *file, const char *function, int line); // size as allocated, reported to the dangling callback if it doesn't match
+int Mem_TryFree(void *memblock); // like Mem_Free, but returns -1 instead of reporting memblock if it isn't a block at all. A corrupt header is still reported, and returns -2.
+int Mem_IsManaged(void *memblock); // nonzero if memblock is a live block, safe to call on any pointer
+int Mem_MallocBatch_IMP(size_t count, size_t size, void **out, const char *file, const char *function, int line); // count blocks of size into out, all or none, returns nonzero on failure
+void Mem_FreeBatch_IMP(void **memblocks, size_t count, const char *file, const char *function, int line); // reorders memblocks, skips NULLs, reports and sets to NULL any that aren't live
+size_t Mem_ReportAllocatedBlocks();
+size_t Mem_ReportSampledBlocks();
+int Mem_WalkAllocatedBlocks(void *context, int (*callback_fp)(const mem_block_info_t *block, void *context)); // stops when callback returns nonzero, returns nonzero on failure
+void Mem_FreeAll();
+void Mem_Destroy();
+size_t Mem_MemoryUsed();
+size_t Mem_MemoryLimit();
+size_t Mem_MemoryRemaining();
+void Mem_SetMallocFailCallback(void (*malloc_failure_fp)(size_t allocation_size, size_t max_memory, size_t memory_remaining));
+void Mem_SetFreeNullCallback(void (*free_failure_fp)(int type, void *old_block, size_t max_memory, size_t memory_remaining));
+void Mem_SetFreeDanglingCallback(void (*free_failure_fp)(int type, void *old_block, size_t max_memory, size_t memory_remaining));
+void Mem_SetFreeZNullCallback(void (*freeZ_failure_fp)(int type, void **old_block, size_t max_memory, size_t memory_remaining));
+void Mem_SetBacktraceDepth(uint32_t max_depth);
+void Mem_SetMemoryLimit(size_t size);
+void Mem_SetWatermarks(size_t soft, size_t hard); // in terms of Mem_MemoryUsed, 0 for none
+int Mem_AddReclaimCallback(int priority, void (*reclaim_fp)(int level, size_t bytes_wanted, void *context), void *context); // lowest priority is called first, returns an id, or -1 if there are too many
+void Mem_RemoveReclaimCallback(int id); // once it returns the callback isn't running and won't be called again, unless it's removed from within a callback
+void Mem_SetSlabBackend(int enabled);
+void Mem_SetLargeThreshold(size_t bytes); // blocks whose underlying allocation would be at least this large are mapped directly from the OS, 0 to never
+void Mem_SetHugePages(int enabled); // ask for transparent huge pages for large blocks of at least 2MiB
+void Mem_SetSampleRate(size_t bytes);
+void Mem_SetBlockRegistry(int enabled); // blocks allocated while it's off are marked in a lock-free presence map instead, and left out of reports, walks and Mem_FreeAll; no effect with compact headers
+int Mem_CreateTag(const char *name, int parent, size_t limit); // returns the new tag, or -1 if there are too many or parent is invalid
+void Mem_SetTagLimit(int tag, size_t limit);
+int Mem_SetThreadTag(int tag); // tag used by untagged allocations on this thread, returns the previous one
+int Mem_GetThreadTag();
+int Mem_GetTagStats(int tag, mem_tag_stats_t *stats); // returns nonzero if tag is invalid
+size_t Mem_GetCallSiteStats(mem_callsite_stats_t *stats, size_t max_count); // the max_count lines with the most live bytes, largest first, returns how many were filled in
+int Mem_WriteHeapProfile(const char *path); // pprof protobuf, returns nonzero on failure
+uint32_t Mem_MarkGeneration(); // blocks allocated from now on belong to a new generation, returns its number; compact headers have no room for it, so there every block stays in generation 0
+uint32_t Mem_GetGeneration();
+size_t Mem_GetGenerationStats(uint32_t since, mem_callsite_stats_t *stats, size_t max_count); // like Mem_GetCallSiteStats, for the blocks allocated in generation since or later, without peak_bytes; each line keeps its last 16 generations apart and adds up the ones before, so returns MEM_GENERATION_EXPIRED if since falls among those
+size_t Mem_ReportGenerationBlocks(uint32_t since); // like Mem_ReportAllocatedBlocks, for the blocks allocated in generation since or later
+int Mem_GetStats(mem_stats_t *stats); // every thread's so far, returns nonzero (and zeroes stats) if built with MEM_DISABLE_STATS
+mem_arena_t *Mem_ArenaCreate_IMP(size_t chunk_size, const char *file, const char *function, int line); // chunk_size 0 picks a default
+void *Mem_ArenaAlloc(mem_arena_t *arena, size_t size);
+void *Mem_ArenaAllocAligned(mem_arena_t *arena, size_t size, uint32_t alignment);
+void Mem_ArenaReset(mem_arena_t *arena); // releases every chunk but one, invalidating everything allocated from the arena
+void Mem_ArenaDestroy(mem_arena_t *arena);
+void (*Mem_GetDefaultMallocFail())(size_t allocation_size, size_t max_memory, size_t memory_remaining);
+void (*Mem_GetDefaultFreeDanglingFail())(int type, void *old_block, size_t max_memory, size_t memory_remaining);
+void (*Mem_GetDefaultFreeNULLFail())(int type, void *old_block, size_t max_memory, size_t memory_remaining);
+void (*Mem_GetDefaultFreeZNULLFail())(int type, void **old_block, size_t max_memory, size_t memory_remaining);
+void *Mem_RawToManaged(void *memblock, size_t size);
 void *Mem_RawToManagedAligned(void *memblock, size_t size, uint32_t alignment);
\ No newline at end of file
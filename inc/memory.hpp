@@ -0,0 +1,103 @@
+// C++ interface: ManagedAllocator<T> for the standard containers, and ManagedMemoryResource for std::pmr. To route every
+// new and delete through the library instead, link libmanagedmalloc_new.a (make cxx) as well, see src/memory_new.cpp.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <new>
+
+#if __cplusplus >= 201703L && __has_include(<memory_resource>)
+#include <memory_resource>
+#define MEM_HAS_MEMORY_RESOURCE		1
+#endif
+
+extern "C"
+{
+#include "memory.h"
+}
+
+// Stateless, so any two compare equal and blocks can be freed through any copy
+template <class T>
+class ManagedAllocator
+{
+public:
+	typedef T value_type;
+
+	ManagedAllocator() noexcept {}
+	template <class U> ManagedAllocator(const ManagedAllocator<U> &) noexcept {}
+
+	T *allocate(std::size_t count)
+	{
+		void *ptr;
+
+		if (count > std::numeric_limits<std::size_t>::max() / sizeof(T))
+			throw std::bad_array_new_length();
+
+		ptr = Mem_MallocAligned_IMP(count * sizeof(T), (uint32_t)alignof(T), __FILE__, __FUNCTION__, __LINE__);
+		if (!ptr)
+			throw std::bad_alloc();
+
+		return static_cast<T*>(ptr);
+	}
+	void deallocate(T *ptr, std::size_t count) noexcept
+	{
+		Mem_FreeSized_IMP(ptr, count * sizeof(T), __FILE__, __FUNCTION__, __LINE__);
+	}
+};
+
+template <class T, class U>
+bool operator==(const ManagedAllocator<T> &, const ManagedAllocator<U> &) noexcept
+{
+	return true;
+}
+template <class T, class U>
+bool operator!=(const ManagedAllocator<T> &, const ManagedAllocator<U> &) noexcept
+{
+	return false;
+}
+
+#ifdef MEM_HAS_MEMORY_RESOURCE
+// Allocates under a tag if one is given, otherwise under the allocating thread's tag
+class ManagedMemoryResource : public std::pmr::memory_resource
+{
+public:
+	ManagedMemoryResource() noexcept : m_tag(-1) {}
+	explicit ManagedMemoryResource(int tag) noexcept : m_tag(tag) {}
+
+	int tag() const noexcept
+	{
+		return m_tag;
+	}
+
+private:
+	int m_tag;
+
+	void *do_allocate(std::size_t bytes, std::size_t alignment) override
+	{
+		void *ptr;
+
+		if (alignment > UINT32_MAX)
+			throw std::bad_alloc();
+
+		if (m_tag < 0)
+			ptr = Mem_MallocAligned_IMP(bytes, (uint32_t)alignment, __FILE__, __FUNCTION__, __LINE__);
+		else
+			ptr = Mem_MallocTagged_IMP(m_tag, bytes, (uint32_t)alignment, __FILE__, __FUNCTION__, __LINE__);
+		if (!ptr)
+			throw std::bad_alloc();
+
+		return ptr;
+	}
+	void do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment) override
+	{
+		Mem_FreeSized_IMP(ptr, bytes, __FILE__, __FUNCTION__, __LINE__);
+	}
+	bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+	{
+		// blocks don't remember which resource they came from, so any of them can free any other's
+		return dynamic_cast<const ManagedMemoryResource*>(&other) != nullptr;
+	}
+};
+#endif
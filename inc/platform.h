@@ -0,0 +1,288 @@
+// Platform layer: everything the library needs from the OS and compiler. Locks and atomics are inline since they sit on
+// every allocation; the rest is implemented per platform in src/platform_win32.c and src/platform_linux.c.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef _WIN32
+
+#include <windows.h>
+#include <malloc.h>
+#include <intrin.h>
+
+#define PLATFORM_CALLBACK				WINAPI
+#define PLATFORM_THREAD_LOCAL			__declspec(thread)
+#define PLATFORM_CACHE_ALIGN			DECLSPEC_CACHEALIGN
+
+typedef SRWLOCK mutex_t;
+typedef DWORD thread_key_t;
+typedef struct platform_thread_s
+{
+	HANDLE				handle;
+	void				(*thread_fp)(void *arg);
+	void				*arg;
+}platform_thread_t;
+
+#define MUTEX_INIT						SRWLOCK_INIT
+#define THREAD_KEY_INVALID				FLS_OUT_OF_INDEXES
+
+static __forceinline void Mutex_Init(mutex_t *mutex)
+{
+	InitializeSRWLock(mutex);
+}
+static __forceinline void Mutex_Lock(mutex_t *mutex)
+{
+	AcquireSRWLockExclusive(mutex);
+}
+static __forceinline int Mutex_TryLock(mutex_t *mutex)
+{
+	return TryAcquireSRWLockExclusive(mutex) != 0;
+}
+static __forceinline void Mutex_Unlock(mutex_t *mutex)
+{
+	ReleaseSRWLockExclusive(mutex);
+}
+static __forceinline void Mutex_LockShared(mutex_t *mutex)
+{
+	AcquireSRWLockShared(mutex);
+}
+static __forceinline void Mutex_UnlockShared(mutex_t *mutex)
+{
+	ReleaseSRWLockShared(mutex);
+}
+static __forceinline void Mutex_Delete(mutex_t *mutex)
+{
+}
+
+static __forceinline int32_t Atomic_CompareExchange32(volatile int32_t *dst, int32_t exchange, int32_t comparand)
+{
+	return InterlockedCompareExchange((volatile LONG*)dst, exchange, comparand);
+}
+static __forceinline int32_t Atomic_Exchange32(volatile int32_t *dst, int32_t value)
+{
+	return InterlockedExchange((volatile LONG*)dst, value);
+}
+static __forceinline int64_t Atomic_CompareExchange64(volatile int64_t *dst, int64_t exchange, int64_t comparand)
+{
+	return InterlockedCompareExchange64(dst, exchange, comparand);
+}
+static __forceinline int64_t Atomic_Exchange64(volatile int64_t *dst, int64_t value)
+{
+	return InterlockedExchange64(dst, value);
+}
+static __forceinline int64_t Atomic_Add64(volatile int64_t *dst, int64_t value)
+{
+	return InterlockedExchangeAdd64(dst, value);
+}
+static __forceinline int64_t Atomic_Or64(volatile int64_t *dst, int64_t value)
+{
+	return InterlockedOr64(dst, value);
+}
+static __forceinline int64_t Atomic_And64(volatile int64_t *dst, int64_t value)
+{
+	return InterlockedAnd64(dst, value);
+}
+static __forceinline void *Atomic_CompareExchangePtr(void * volatile *dst, void *exchange, void *comparand)
+{
+	return InterlockedCompareExchangePointer(dst, exchange, comparand);
+}
+static __forceinline void *Atomic_ExchangePtr(void * volatile *dst, void *value)
+{
+	return InterlockedExchangePointer(dst, value);
+}
+
+static __forceinline uint64_t Platform_Cycles()
+{
+	return __rdtsc();
+}
+static __forceinline int Platform_HighestBit(uint64_t value) // value must be nonzero
+{
+	unsigned long index;
+
+	_BitScanReverse64(&index, value);
+
+	return (int)index;
+}
+
+#else
+
+#include <pthread.h>
+#include <alloca.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <time.h>
+
+#define __forceinline					inline __attribute__((always_inline))
+#define _alloca							alloca
+
+#define PLATFORM_CALLBACK
+#define PLATFORM_THREAD_LOCAL			__thread
+#define PLATFORM_CACHE_ALIGN			__attribute__((aligned(64)))
+#define PLATFORM_MUTEX_SPIN				100		// attempts before a contended lock parks on the futex
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PLATFORM_PAUSE()				__builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define PLATFORM_PAUSE()				__asm__ __volatile__("yield")
+#else
+#define PLATFORM_PAUSE()
+#endif
+
+// 0 = unlocked, 1 = locked, 2 = locked and somebody may be parked on the futex
+typedef struct mutex_s
+{
+	volatile int32_t	state;
+}mutex_t;
+typedef pthread_key_t thread_key_t;
+typedef struct platform_thread_s
+{
+	pthread_t			handle;
+	void				(*thread_fp)(void *arg);
+	void				*arg;
+}platform_thread_t;
+
+#define MUTEX_INIT						{0}
+#define THREAD_KEY_INVALID				((pthread_key_t)-1)
+
+static __forceinline void Mutex_Init(mutex_t *mutex)
+{
+	mutex->state = 0;
+}
+static inline void Mutex_LockContended(mutex_t *mutex)
+{
+	int32_t state;
+	int i;
+
+	for (i = 0; i < PLATFORM_MUTEX_SPIN; i++)
+	{
+		state = 0;
+		if (mutex->state == 0 && __atomic_compare_exchange_n(&mutex->state, &state, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return;
+		PLATFORM_PAUSE();
+	}
+
+	while (__atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE) != 0)
+		syscall(SYS_futex, &mutex->state, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+}
+static __forceinline void Mutex_Lock(mutex_t *mutex)
+{
+	int32_t state = 0;
+
+	if (!__atomic_compare_exchange_n(&mutex->state, &state, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		Mutex_LockContended(mutex);
+}
+static __forceinline int Mutex_TryLock(mutex_t *mutex)
+{
+	int32_t state = 0;
+
+	return __atomic_compare_exchange_n(&mutex->state, &state, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+static __forceinline void Mutex_Unlock(mutex_t *mutex)
+{
+	if (__atomic_exchange_n(&mutex->state, 0, __ATOMIC_RELEASE) == 2)
+		syscall(SYS_futex, &mutex->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+static __forceinline void Mutex_LockShared(mutex_t *mutex)
+{
+	Mutex_Lock(mutex);
+}
+static __forceinline void Mutex_UnlockShared(mutex_t *mutex)
+{
+	Mutex_Unlock(mutex);
+}
+static __forceinline void Mutex_Delete(mutex_t *mutex)
+{
+}
+
+static __forceinline int32_t Atomic_CompareExchange32(volatile int32_t *dst, int32_t exchange, int32_t comparand)
+{
+	__atomic_compare_exchange_n(dst, &comparand, exchange, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return comparand;
+}
+static __forceinline int32_t Atomic_Exchange32(volatile int32_t *dst, int32_t value)
+{
+	return __atomic_exchange_n(dst, value, __ATOMIC_SEQ_CST);
+}
+static __forceinline int64_t Atomic_CompareExchange64(volatile int64_t *dst, int64_t exchange, int64_t comparand)
+{
+	__atomic_compare_exchange_n(dst, &comparand, exchange, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return comparand;
+}
+static __forceinline int64_t Atomic_Exchange64(volatile int64_t *dst, int64_t value)
+{
+	return __atomic_exchange_n(dst, value, __ATOMIC_SEQ_CST);
+}
+static __forceinline int64_t Atomic_Add64(volatile int64_t *dst, int64_t value)
+{
+	return __atomic_fetch_add(dst, value, __ATOMIC_SEQ_CST);
+}
+static __forceinline int64_t Atomic_Or64(volatile int64_t *dst, int64_t value)
+{
+	return __atomic_fetch_or(dst, value, __ATOMIC_SEQ_CST);
+}
+static __forceinline int64_t Atomic_And64(volatile int64_t *dst, int64_t value)
+{
+	return __atomic_fetch_and(dst, value, __ATOMIC_SEQ_CST);
+}
+static __forceinline void *Atomic_CompareExchangePtr(void * volatile *dst, void *exchange, void *comparand)
+{
+	__atomic_compare_exchange_n(dst, &comparand, exchange, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return comparand;
+}
+static __forceinline void *Atomic_ExchangePtr(void * volatile *dst, void *value)
+{
+	return __atomic_exchange_n(dst, value, __ATOMIC_SEQ_CST);
+}
+
+// A cheap, monotonic count of some unspecified unit, only meant for comparing durations with each other
+static __forceinline uint64_t Platform_Cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+	uint64_t cycles;
+
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(cycles));
+
+	return cycles;
+#else
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+#endif
+}
+static __forceinline int Platform_HighestBit(uint64_t value) // value must be nonzero
+{
+	return 63 - __builtin_clzll(value);
+}
+
+#endif
+
+// An executable mapping of a module
+typedef struct platform_module_s
+{
+	uintptr_t		start;
+	uintptr_t		end;
+	uint64_t		offset;						// of start in the file
+	const char		*path;						// only valid during the callback
+}platform_module_t;
+
+void			Platform_Init();
+int				Platform_StackTrace_Snapshot(void **stack, int entries, int skip); // frame 0 is the caller's
+int				Platform_ResolveSymbol(void *address, char *file, size_t file_size, char *function, size_t function_size, int *line); // returns nonzero on failure, NOT thread-safe
+void			*Platform_MapSpan(size_t size); // size-aligned, zeroed, size must be a power-of-two of at least 64KiB
+void			Platform_UnmapSpan(void *span, size_t size);
+size_t			Platform_PageSize();
+void			*Platform_MapPages(size_t size, size_t alignment, size_t offset, int huge); // zeroed, ptr + offset is alignment-aligned, all three multiples of the page size; huge asks for transparent huge pages
+void			Platform_UnmapPages(void *ptr, size_t size);
+void			*Platform_RemapPages(void *ptr, size_t old_size, size_t new_size); // may move, returns NULL with the mapping untouched if it can't be resized
+thread_key_t	Platform_ThreadKeyCreate(void (PLATFORM_CALLBACK *destructor_fp)(void *value)); // destructor runs on thread exit
+void			Platform_ThreadKeySet(thread_key_t key, void *value);
+int				Platform_ThreadCreate(platform_thread_t *thread, void (*thread_fp)(void *arg), void *arg); // returns nonzero on failure, thread must stay put until joined
+void			Platform_ThreadJoin(platform_thread_t *thread);
+void			Platform_Wait(volatile int32_t *address, int32_t value, int timeout_ms); // sleeps while *address is value, up to timeout_ms unless it's negative, may wake early
+void			Platform_WakeAll(volatile int32_t *address);
+int				Platform_EnumerateModules(void *context, void (*callback_fp)(const platform_module_t *module, void *context)); // returns nonzero on failure
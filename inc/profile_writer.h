@@ -0,0 +1,33 @@
+// Streaming writer for heap profiles in pprof's protobuf format (github.com/google/pprof, proto/profile.proto). Every
+// message is written as soon as it's complete, so only the ids already written are kept in memory, never the samples.
+// Each sample carries alloc_objects, alloc_space, inuse_objects and inuse_space, in that order.
+
+#define PROFILE_NUM_VALUES		4
+
+typedef struct profile_mapping_s
+{
+	uintptr_t				start;
+	uintptr_t				end;
+}profile_mapping_t;
+
+typedef struct profile_writer_s
+{
+	FILE					*file;
+	int						failed;
+	uint8_t					*buffer;		// the message being built
+	size_t					buffer_size;
+	size_t					buffer_capacity;
+	int64_t					num_strings;
+	profile_mapping_t		*mapping;		// mapping ids are the index + 1
+	size_t					num_mappings;
+	size_t					mapping_capacity;
+	hash_table_t			frames;			// addresses already written as a location
+	hash_table_t			lines;			// line keys already written as a location
+	hash_table_t			functions;		// symbol names already written as a function
+	hash_table_t			site_functions;	// call-site function names already written as a function
+}profile_writer_t;
+
+int		ProfileWriter_Open(profile_writer_t *writer, const char *path); // returns nonzero on failure
+void	ProfileWriter_StackSample(profile_writer_t *writer, void **stack, int entries, const int64_t *values);
+void	ProfileWriter_LineSample(profile_writer_t *writer, uint32_t key, const char *file, const char *function, int line, const int64_t *values); // key identifies the line, nonzero
+int		ProfileWriter_Close(profile_writer_t *writer); // returns nonzero if anything failed since the open
@@ -0,0 +1,8 @@
+// Append-only, deduplicated store of stack traces. Each distinct stack is stored once and identified by a nonzero
+// 32-bit id. Lookups never take a lock; only interning a stack that hasn't been seen before does.
+
+uint32_t		StackDepot_Intern(void **stack, int num_entries); // returns 0 if the stack couldn't be stored
+int				StackDepot_Get(uint32_t id, void ***stack); // returns the number of entries, 0 for an unknown id
+uint32_t		StackDepot_Count(); // ids are always in [1, StackDepot_Count()]
+size_t			StackDepot_MemUsed();
+void			StackDepot_Destroy(); // NOT thread-safe, invalidates every id
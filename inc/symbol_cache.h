@@ -0,0 +1,14 @@
+// Address to symbol cache shared by the reports and the failure handlers. Every distinct address is resolved once, and
+// file and function names are interned, so the records and their strings stay valid until SymbolCache_Destroy.
+
+typedef struct symbol_s
+{
+	void				*address;
+	const char			*file;				// NULL if it couldn't be resolved
+	const char			*function;			// NULL if it couldn't be resolved
+	int					line;
+}symbol_t;
+
+const symbol_t	*SymbolCache_Resolve(void *address); // returns NULL only if the cache couldn't grow
+size_t			SymbolCache_MemUsed();
+void			SymbolCache_Destroy(); // NOT thread-safe, invalidates every record
@@ -0,0 +1,174 @@
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "../inc/platform.h"
+#include "../inc/memory.h"
+
+// Bump allocator over chunks taken from the managed allocator. The chunks are ordinary tracked blocks, attributed to the
+// arena's creation site and tag, so they show up in reports and count against the limits like anything else; the
+// allocations inside them are not tracked individually. An arena must not be used by two threads at once.
+
+#define MEM_ARENA_DEFAULT_CHUNK_SIZE	65536
+#define MEM_ARENA_ALIGNMENT				16		// of every chunk, and the least any allocation is aligned to
+#define MEM_ARENA_LARGE_DIV				4		// requests above chunk_size / MEM_ARENA_LARGE_DIV get a chunk of their own
+
+typedef struct mem_arena_chunk_s
+{
+	struct mem_arena_chunk_s	*next;
+	size_t						size;			// of the data following the header
+}mem_arena_chunk_t;
+
+struct mem_arena_s
+{
+	mem_arena_chunk_t	*chunks;			// the chunk being bump-allocated from first, then every other chunk
+	char				*cursor;
+	char				*end;
+	size_t				chunk_size;
+	int					tag;
+	const char			*file;
+	const char			*function;
+	int					line;
+};
+
+static __forceinline char *Mem_ArenaChunkData(mem_arena_chunk_t *chunk)
+{
+	return (char*)&chunk[1];
+}
+
+static __forceinline char *Mem_ArenaAlign(char *ptr, uint32_t alignment)
+{
+	return (char*)((((uintptr_t)ptr + alignment - 1) / alignment) * alignment);
+}
+
+static mem_arena_chunk_t *Mem_ArenaNewChunk(mem_arena_t *arena, size_t size)
+{
+	mem_arena_chunk_t *chunk = Mem_MallocTagged_IMP(arena->tag, sizeof(mem_arena_chunk_t) + size, MEM_ARENA_ALIGNMENT, arena->file, arena->function, arena->line);
+
+	if (!chunk)
+		return 0;
+
+	chunk->next = 0;
+	chunk->size = size;
+
+	return chunk;
+}
+
+mem_arena_t *Mem_ArenaCreate_IMP(size_t chunk_size, const char *file, const char *function, int line)
+{
+	int tag = Mem_GetThreadTag();
+	mem_arena_t *arena = Mem_MallocTagged_IMP(tag, sizeof(mem_arena_t), 1, file, function, line);
+
+	if (!arena)
+		return 0;
+
+	arena->chunks = 0;
+	arena->cursor = 0;
+	arena->end = 0;
+	arena->chunk_size = chunk_size ? chunk_size : MEM_ARENA_DEFAULT_CHUNK_SIZE;
+	arena->tag = tag;
+	arena->file = file;
+	arena->function = function;
+	arena->line = line;
+
+	return arena;
+}
+
+void *Mem_ArenaAllocAligned(mem_arena_t *arena, size_t size, uint32_t alignment)
+{
+	mem_arena_chunk_t *chunk;
+	char *ptr;
+
+	if (alignment < MEM_ARENA_ALIGNMENT)
+		alignment = MEM_ARENA_ALIGNMENT;
+
+	if (arena->cursor)
+	{
+		ptr = Mem_ArenaAlign(arena->cursor, alignment);
+		if (ptr <= arena->end && size <= (size_t)(arena->end - ptr))
+		{
+			arena->cursor = ptr + size;
+			return ptr;
+		}
+	}
+
+	if (size + alignment - 1 > arena->chunk_size / MEM_ARENA_LARGE_DIV)
+	{
+		// big requests get a chunk of their own, so that the current chunk keeps serving the small ones
+		chunk = Mem_ArenaNewChunk(arena, size + alignment - 1);
+		if (!chunk)
+			return 0;
+
+		if (arena->chunks)
+		{
+			chunk->next = arena->chunks->next;
+			arena->chunks->next = chunk;
+		}
+		else
+			arena->chunks = chunk;
+
+		return Mem_ArenaAlign(Mem_ArenaChunkData(chunk), alignment);
+	}
+
+	// whatever is left of the current chunk is abandoned until the next reset
+	chunk = Mem_ArenaNewChunk(arena, arena->chunk_size);
+	if (!chunk)
+		return 0;
+
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+	arena->end = Mem_ArenaChunkData(chunk) + chunk->size;
+
+	ptr = Mem_ArenaAlign(Mem_ArenaChunkData(chunk), alignment);
+	arena->cursor = ptr + size;
+
+	return ptr;
+}
+
+void *Mem_ArenaAlloc(mem_arena_t *arena, size_t size)
+{
+	return Mem_ArenaAllocAligned(arena, size, MEM_ARENA_ALIGNMENT);
+}
+
+void Mem_ArenaReset(mem_arena_t *arena)
+{
+	mem_arena_chunk_t *keep = 0;
+	mem_arena_chunk_t *chunk;
+	mem_arena_chunk_t *next;
+
+	// keep one regular chunk around, so that an arena reused per request doesn't go back to the allocator every time
+	for (chunk = arena->chunks; chunk; chunk = next)
+	{
+		next = chunk->next;
+		if (!keep && chunk->size == arena->chunk_size)
+			keep = chunk;
+		else
+			Mem_Free_IMP(chunk, arena->file, arena->function, arena->line);
+	}
+
+	arena->chunks = keep;
+	arena->cursor = 0;
+	arena->end = 0;
+	if (keep)
+	{
+		keep->next = 0;
+		arena->cursor = Mem_ArenaChunkData(keep);
+		arena->end = arena->cursor + keep->size;
+	}
+}
+
+void Mem_ArenaDestroy(mem_arena_t *arena)
+{
+	mem_arena_chunk_t *chunk;
+	mem_arena_chunk_t *next;
+
+	if (!arena)
+		return;
+
+	for (chunk = arena->chunks; chunk; chunk = next)
+	{
+		next = chunk->next;
+		Mem_Free_IMP(chunk, arena->file, arena->function, arena->line);
+	}
+
+	Mem_Free_IMP(arena, arena->file, arena->function, arena->line);
+}
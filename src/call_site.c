@@ -0,0 +1,271 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "../inc/platform.h"
+#include "../inc/intern_table.h"
+#include "../inc/call_site.h"
+
+// A line's statistics for each of its last CALLSITE_GENERATIONS generations, generation g in slot g % CALLSITE_GENERATIONS.
+// A slot is taken over by the first newer generation to land on it, and what it held is folded into older, as is
+// anything applied later for a generation that has left the ring, so blocks of old generations are never lost, only
+// no longer told apart. The generation a block belongs to is kept in its header, not in its call site.
+typedef struct call_site_generations_s
+{
+	mutex_t				mutex;
+	uint32_t			generation[CALLSITE_GENERATIONS];	// held by each slot, 0 if none yet
+	call_site_stats_t	stats[CALLSITE_GENERATIONS];
+	uint32_t			older_first;						// range of the generations folded into older, 0 if none yet
+	uint32_t			older_last;
+	call_site_stats_t	older;
+}call_site_generations_t;
+
+typedef struct call_site_record_s
+{
+	intern_record_t						intern;
+	uint32_t							line_id;		// id of the call site with only the file, function and line set
+	call_site_t							site;
+	call_site_stats_t					stats;			// only used on the lines' own records
+	call_site_generations_t * volatile	generations;	// the same, only on the lines' own records and made on demand
+}call_site_record_t;
+
+static intern_table_t g_sites = INTERNTABLE_INIT;
+static volatile int64_t g_generations_memory = 0;
+
+static const call_site_t g_unknown_site = {0};
+
+static __forceinline uint32_t CallSite_Hash(const call_site_t *site)
+{
+	uint64_t h = 0xCBF29CE484222325ull;
+
+	h = (h ^ (uint64_t)(uintptr_t)site->file) * 0x9E3779B97F4A7C15ull;
+	h = (h ^ (uint64_t)(uintptr_t)site->function) * 0x9E3779B97F4A7C15ull;
+	h = (h ^ (uint64_t)(uint32_t)site->line ^ ((uint64_t)(uint32_t)site->tag << 32)) * 0x9E3779B97F4A7C15ull;
+	h = (h ^ (uint64_t)site->stack_id ^ ((uint64_t)site->sample_rate << 32) ^ ((uint64_t)site->sample_rate >> 32)) * 0x9E3779B97F4A7C15ull;
+	h ^= h >> 29;
+
+	return (uint32_t)(h ^ (h >> 32));
+}
+
+static __forceinline int CallSite_IsLine(const call_site_t *site)
+{
+	return site->tag == 0 && site->stack_id == 0 && site->sample_rate == 0;
+}
+
+static __forceinline int CallSite_Equal(const call_site_t *a, const call_site_t *b)
+{
+	return a->file == b->file && a->function == b->function && a->line == b->line && a->tag == b->tag && a->stack_id == b->stack_id && a->sample_rate == b->sample_rate;
+}
+
+static int CallSite_RecordEqual(const intern_record_t *record, const void *key)
+{
+	return CallSite_Equal(&((const call_site_record_t*)record)->site, (const call_site_t*)key);
+}
+
+static void CallSite_Init(intern_record_t *record, const void *key, void *context)
+{
+	call_site_record_t *site_record = (call_site_record_t*)record;
+	const call_site_t *site = (const call_site_t*)key;
+
+	site_record->line_id = CallSite_IsLine(site) ? record->id : *(const uint32_t*)context;
+	site_record->site = *site;
+	memset(&site_record->stats, 0, sizeof(call_site_stats_t));
+	site_record->generations = 0;
+}
+
+uint32_t CallSite_Intern(const call_site_t *site)
+{
+	uint32_t hash = CallSite_Hash(site);
+	intern_record_t *record;
+	uint32_t line_id = 0;
+
+	record = InternTable_Find(&g_sites, hash, site, CallSite_RecordEqual);
+	if (record)
+		return record->id;
+
+	// the line's own record has to exist first, and interning it takes the mutex too
+	if (!CallSite_IsLine(site))
+	{
+		call_site_t line = *site;
+
+		line.tag = 0;
+		line.stack_id = 0;
+		line.sample_rate = 0;
+		line_id = CallSite_Intern(&line);
+	}
+
+	return InternTable_Intern(&g_sites, hash, site, sizeof(call_site_record_t), CallSite_RecordEqual, CallSite_Init, &line_id);
+}
+
+static call_site_record_t *CallSite_Record(uint32_t id)
+{
+	return (call_site_record_t*)InternTable_Get(&g_sites, id);
+}
+
+const call_site_t *CallSite_Get(uint32_t id)
+{
+	call_site_record_t *record = CallSite_Record(id);
+
+	return record ? &record->site : &g_unknown_site;
+}
+
+uint32_t CallSite_LineId(uint32_t id)
+{
+	call_site_record_t *record = CallSite_Record(id);
+
+	return record ? record->line_id : 0;
+}
+
+static call_site_record_t *CallSite_LineRecord(uint32_t id)
+{
+	call_site_record_t *record = CallSite_Record(id);
+
+	return record ? CallSite_Record(record->line_id) : 0;
+}
+
+call_site_stats_t *CallSite_GetStats(uint32_t id)
+{
+	call_site_record_t *line = CallSite_LineRecord(id);
+
+	return line ? &line->stats : 0;
+}
+
+// Returns the line's ring, making it if it doesn't exist yet, or NULL if it couldn't be made
+static call_site_generations_t *CallSite_Generations(call_site_record_t *line)
+{
+	call_site_generations_t *generations = line->generations;
+	call_site_generations_t *current;
+
+	if (generations)
+		return generations;
+
+	generations = calloc(1, sizeof(call_site_generations_t));
+	if (!generations)
+		return 0;
+	Mutex_Init(&generations->mutex);
+
+	current = Atomic_CompareExchangePtr((void * volatile*)&line->generations, generations, 0);
+	if (current)
+	{
+		Mutex_Delete(&generations->mutex);
+		free(generations);
+		return current;
+	}
+	Atomic_Add64(&g_generations_memory, (int64_t)sizeof(call_site_generations_t));
+
+	return generations;
+}
+
+static void CallSite_StatsAdd(call_site_stats_t *stats, const call_site_stats_t *add)
+{
+	stats->live_bytes += add->live_bytes;
+	stats->live_blocks += add->live_blocks;
+	stats->total_allocs += add->total_allocs;
+	stats->total_bytes += add->total_bytes;
+	stats->total_frees += add->total_frees;
+}
+
+// Only called with the ring's mutex locked
+static void CallSite_FoldOlder(call_site_generations_t *generations, uint32_t generation)
+{
+	if (generations->older_first == 0 || generation < generations->older_first)
+		generations->older_first = generation;
+	if (generation > generations->older_last)
+		generations->older_last = generation;
+}
+
+void CallSite_ApplyGenerationStats(uint32_t id, uint32_t generation, void (*apply_fp)(call_site_stats_t *stats, const void *context), const void *context)
+{
+	call_site_record_t *line = CallSite_LineRecord(id);
+	call_site_generations_t *generations;
+	int slot = (int)(generation % CALLSITE_GENERATIONS);
+
+	if (!line || generation == 0 || (generations = CallSite_Generations(line)) == 0)
+		return;
+
+	Mutex_Lock(&generations->mutex);
+	if (generations->generation[slot] < generation)
+	{
+		if (generations->generation[slot])
+		{
+			CallSite_StatsAdd(&generations->older, &generations->stats[slot]);
+			CallSite_FoldOlder(generations, generations->generation[slot]);
+		}
+		memset((void*)&generations->stats[slot], 0, sizeof(call_site_stats_t));
+		generations->generation[slot] = generation;
+	}
+	if (generations->generation[slot] == generation)
+		apply_fp(&generations->stats[slot], context);
+	else
+	{
+		apply_fp(&generations->older, context);
+		CallSite_FoldOlder(generations, generation);
+	}
+	Mutex_Unlock(&generations->mutex);
+}
+
+int CallSite_GetGenerationStats(uint32_t id, uint32_t since, call_site_stats_t *stats)
+{
+	call_site_record_t *line = CallSite_LineRecord(id);
+	call_site_generations_t *generations = line ? line->generations : 0;
+	int found = 0;
+	int slot;
+
+	memset(stats, 0, sizeof(call_site_stats_t));
+	if (!generations)
+		return -1;
+
+	Mutex_Lock(&generations->mutex);
+	// the older generations only add up as a whole, so since has to be at or before all of them, or after them all
+	if (generations->older_first && since > generations->older_first && since <= generations->older_last)
+	{
+		Mutex_Unlock(&generations->mutex);
+		return 1;
+	}
+	if (generations->older_first && since <= generations->older_first)
+	{
+		CallSite_StatsAdd(stats, &generations->older);
+		found = 1;
+	}
+	for (slot = 0; slot < CALLSITE_GENERATIONS; slot++)
+	{
+		if (generations->generation[slot] == 0 || generations->generation[slot] < since)
+			continue;
+
+		CallSite_StatsAdd(stats, &generations->stats[slot]);
+		found = 1;
+	}
+	Mutex_Unlock(&generations->mutex);
+
+	return found ? 0 : -1;
+}
+
+uint32_t CallSite_Count()
+{
+	return InternTable_Count(&g_sites);
+}
+
+size_t CallSite_MemUsed()
+{
+	return InternTable_MemUsed(&g_sites) + (size_t)g_generations_memory;
+}
+
+void CallSite_Destroy()
+{
+	uint32_t count = InternTable_Count(&g_sites);
+	uint32_t id;
+
+	for (id = 1; id <= count; id++)
+	{
+		call_site_record_t *record = CallSite_Record(id);
+
+		if (record && record->generations)
+		{
+			Mutex_Delete(&record->generations->mutex);
+			free(record->generations);
+		}
+	}
+	g_generations_memory = 0;
+
+	InternTable_Destroy(&g_sites);
+}
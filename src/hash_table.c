@@ -0,0 +1,192 @@
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "../inc/platform.h"
+#include "../inc/hash_table.h"
+
+// Open-addressing set of non-NULL pointers. Linear probing with backward-shift deletion, so there are no tombstones
+// and lookups never degrade after long runs of insert/delete.
+
+#define HASHTABLE_MIN_CAPACITY		64
+#define HASHTABLE_LOAD_NUM			7		// grow when count exceeds 7/10 of capacity
+#define HASHTABLE_LOAD_DEN			10
+#define HASHTABLE_SHRINK_DIV		8		// shrink when count drops below 1/8 of capacity
+
+static __forceinline size_t HashTable_Hash(void *value, size_t mask)
+{
+	uint64_t h = (uint64_t)(uintptr_t)value;
+
+	// pointers are at least 8-byte aligned, drop the always-zero bits before mixing
+	h >>= 3;
+	h *= 0x9E3779B97F4A7C15ull;
+	h ^= h >> 32;
+
+	return (size_t)h & mask;
+}
+
+static int HashTable_Resize(hash_table_t *table, size_t capacity)
+{
+	void **slot = calloc(capacity, sizeof(void*));
+	size_t mask = capacity - 1;
+	size_t i;
+
+	if (!slot)
+		return -1;
+
+	for (i = 0; i < table->capacity; i++)
+	{
+		size_t index;
+
+		if (!table->slot[i])
+			continue;
+
+		index = HashTable_Hash(table->slot[i], mask);
+		while (slot[index])
+			index = (index + 1) & mask;
+		slot[index] = table->slot[i];
+	}
+
+	free(table->slot);
+	table->slot = slot;
+	table->capacity = capacity;
+
+	return 0;
+}
+
+void HashTable_Init(hash_table_t *table)
+{
+	table->slot = 0;
+	table->capacity = 0;
+	table->count = 0;
+}
+
+int HashTable_Insert(hash_table_t *table, void *value)
+{
+	size_t mask;
+	size_t index;
+
+	if ((table->count + 1) * HASHTABLE_LOAD_DEN > table->capacity * HASHTABLE_LOAD_NUM)
+	{
+		if (HashTable_Resize(table, table->capacity ? table->capacity * 2 : HASHTABLE_MIN_CAPACITY))
+			return -1;
+	}
+
+	mask = table->capacity - 1;
+	index = HashTable_Hash(value, mask);
+
+	while (table->slot[index])
+	{
+		if (table->slot[index] == value)
+			return 0;
+		index = (index + 1) & mask;
+	}
+
+	table->slot[index] = value;
+	table->count++;
+
+	return 0;
+}
+
+int HashTable_Contains(hash_table_t *table, void *value)
+{
+	size_t mask;
+	size_t index;
+
+	if (!table->capacity)
+		return 0;
+
+	mask = table->capacity - 1;
+	index = HashTable_Hash(value, mask);
+
+	while (table->slot[index])
+	{
+		if (table->slot[index] == value)
+			return 1;
+		index = (index + 1) & mask;
+	}
+
+	return 0;
+}
+
+int HashTable_Delete(hash_table_t *table, void *value)
+{
+	size_t mask;
+	size_t index;
+	size_t next;
+
+	if (!table->capacity)
+		return 0;
+
+	mask = table->capacity - 1;
+	index = HashTable_Hash(value, mask);
+
+	while (table->slot[index] != value)
+	{
+		if (!table->slot[index])
+			return 0;
+		index = (index + 1) & mask;
+	}
+
+	// backward-shift: pull every following entry of the probe run back into the hole unless it already sits at or
+	// after its home slot relative to the hole
+	next = (index + 1) & mask;
+	while (table->slot[next])
+	{
+		size_t home = HashTable_Hash(table->slot[next], mask);
+
+		if (((next - home) & mask) >= ((next - index) & mask))
+		{
+			table->slot[index] = table->slot[next];
+			index = next;
+		}
+		next = (next + 1) & mask;
+	}
+	table->slot[index] = 0;
+	table->count--;
+
+	if (table->capacity > HASHTABLE_MIN_CAPACITY && table->count < table->capacity / HASHTABLE_SHRINK_DIV)
+		HashTable_Resize(table, table->capacity / 2);	// failure to shrink is harmless
+
+	return 1;
+}
+
+void HashTable_Destroy(hash_table_t *table, void *context, void (*delete_fp)(void *value, void *context))
+{
+	size_t i;
+
+	if (delete_fp)
+	{
+		for (i = 0; i < table->capacity; i++)
+		{
+			if (table->slot[i])
+				delete_fp(table->slot[i], context);
+		}
+	}
+
+	free(table->slot);
+	HashTable_Init(table);
+}
+
+void HashTable_Walk(hash_table_t *table, void *context, int (*callback_fp)(void *value, void *context))
+{
+	size_t i;
+
+	for (i = 0; i < table->capacity; i++)
+	{
+		if (table->slot[i] && callback_fp(table->slot[i], context))
+			return;
+	}
+}
+
+size_t HashTable_MemUsed(hash_table_t *table)
+{
+	return table->capacity * sizeof(void*);
+}
+
+size_t HashTable_InsertCost(hash_table_t *table)
+{
+	if ((table->count + 1) * HASHTABLE_LOAD_DEN > table->capacity * HASHTABLE_LOAD_NUM)
+		return (table->capacity ? table->capacity : HASHTABLE_MIN_CAPACITY) * sizeof(void*);
+
+	return 0;
+}
@@ -0,0 +1,153 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "../inc/platform.h"
+#include "../inc/intern_table.h"
+
+intern_record_t *InternTable_Find(intern_table_t *table, uint32_t hash, const void *key, intern_equal_fp equal_fp)
+{
+	intern_record_t *record;
+
+	for (record = table->bucket[hash & (INTERNTABLE_NUM_BUCKETS - 1)]; record; record = record->next)
+	{
+		if (record->hash == hash && equal_fp(record, key))
+			return record;
+	}
+
+	return 0;
+}
+
+// Only called with the mutex locked
+static intern_record_t *InternTable_NewRecord(intern_table_t *table, size_t record_size)
+{
+	size_t size = (record_size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+	intern_record_t *record;
+
+	if (!table->chunk || table->chunk_used + size > INTERNTABLE_CHUNK_SIZE)
+	{
+		size_t chunk_size = size + sizeof(void*) > INTERNTABLE_CHUNK_SIZE ? size + sizeof(void*) : INTERNTABLE_CHUNK_SIZE;
+		char *chunk = malloc(chunk_size);
+
+		if (!chunk)
+			return 0;
+
+		*(void**)chunk = table->chunks;
+		table->chunks = chunk;
+		table->chunk = chunk;
+		table->chunk_used = sizeof(void*);
+		table->memory_used += chunk_size;
+	}
+
+	record = (intern_record_t*)(table->chunk + table->chunk_used);
+	table->chunk_used += size;
+
+	return record;
+}
+
+uint32_t InternTable_Intern(intern_table_t *table, uint32_t hash, const void *key, size_t record_size, intern_equal_fp equal_fp, intern_init_fp init_fp, void *context)
+{
+	intern_record_t * volatile *bucket = &table->bucket[hash & (INTERNTABLE_NUM_BUCKETS - 1)];
+	intern_record_t *record;
+	uint32_t id;
+
+	record = InternTable_Find(table, hash, key, equal_fp);
+	if (record)
+		return record->id;
+
+	Mutex_Lock(&table->mutex);
+
+	// someone else may have interned it between the lookup and the lock
+	record = InternTable_Find(table, hash, key, equal_fp);
+	if (record)
+	{
+		Mutex_Unlock(&table->mutex);
+		return record->id;
+	}
+
+	id = (uint32_t)table->count + 1;
+	if (id / INTERNTABLE_PAGE_SIZE >= INTERNTABLE_MAX_PAGES)
+	{
+		Mutex_Unlock(&table->mutex);
+		return 0;
+	}
+	if (!table->page[id / INTERNTABLE_PAGE_SIZE])
+	{
+		intern_record_t **page = calloc(INTERNTABLE_PAGE_SIZE, sizeof(intern_record_t*));
+
+		if (!page)
+		{
+			Mutex_Unlock(&table->mutex);
+			return 0;
+		}
+		table->memory_used += INTERNTABLE_PAGE_SIZE * sizeof(intern_record_t*);
+		Atomic_ExchangePtr((void * volatile*)&table->page[id / INTERNTABLE_PAGE_SIZE], page);
+	}
+
+	record = InternTable_NewRecord(table, record_size);
+	if (!record)
+	{
+		Mutex_Unlock(&table->mutex);
+		return 0;
+	}
+
+	record->hash = hash;
+	record->id = id;
+	init_fp(record, key, context);
+	record->next = *bucket;
+
+	// publish: the record is complete before it becomes reachable from either the id table or the bucket
+	Atomic_ExchangePtr((void * volatile*)&table->page[id / INTERNTABLE_PAGE_SIZE][id % INTERNTABLE_PAGE_SIZE], record);
+	Atomic_ExchangePtr((void * volatile*)bucket, record);
+	Atomic_Exchange32(&table->count, (int32_t)id);
+
+	Mutex_Unlock(&table->mutex);
+
+	return id;
+}
+
+intern_record_t *InternTable_Get(intern_table_t *table, uint32_t id)
+{
+	intern_record_t **page;
+
+	if (id == 0 || id > (uint32_t)table->count)
+		return 0;
+
+	page = table->page[id / INTERNTABLE_PAGE_SIZE];
+
+	return page ? page[id % INTERNTABLE_PAGE_SIZE] : 0;
+}
+
+uint32_t InternTable_Count(intern_table_t *table)
+{
+	return (uint32_t)table->count;
+}
+
+size_t InternTable_MemUsed(intern_table_t *table)
+{
+	return table->memory_used;
+}
+
+void InternTable_Destroy(intern_table_t *table)
+{
+	void *chunk = table->chunks;
+	int i;
+
+	while (chunk)
+	{
+		void *next = *(void**)chunk;
+
+		free(chunk);
+		chunk = next;
+	}
+	for (i = 0; i < INTERNTABLE_MAX_PAGES; i++)
+		free(table->page[i]);
+
+	memset((void*)table->bucket, 0, sizeof(table->bucket));
+	memset((void*)table->page, 0, sizeof(table->page));
+	table->count = 0;
+	table->chunk = 0;
+	table->chunk_used = 0;
+	table->chunks = 0;
+	table->memory_used = 0;
+}
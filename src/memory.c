@@ -1,599 +1,3444 @@
-#include <windows.h>
-#include <stdio.h>
-#include <Dbghelp.h>
-#include <inttypes.h>
-
-#include "..\inc\avl_tree.h"
-#include "..\inc\memory.h"
-
-#define STACKTRACE_START_OFFSET			2
-#define STACKTRACE_MALLOC_FAIL_OFFSET	2
-#define STACKTRACE_FREE_FAIL_OFFSET		1
-#define STACKTRACE_ONFAIL_MAX_DEPTH		1024
-
-typedef SRWLOCK mutex_t;
-
-typedef struct mem_managed_s
-{
-	int				backtrace_max_depth;	// this will be allocated on the stack, so it's advised to keep this as small as possible
-	mutex_t			mutex;
-	avl_tree_node_t *tree;
-	size_t			max_memory;
-	size_t			memory_used;
-	void			(*malloc_failure_fp)(size_t allocation_size, size_t max_memory, size_t memory_remaining);
-	void			(*free_dangling_failure_fp)(int type, void *old_block, size_t max_memory, size_t memory_remaining);
-	void			(*free_null_failure_fp)(int type, void *old_block, size_t max_memory, size_t memory_remaining);
-	void			(*freeZ_null_failure_fp)(int type, void **old_block, size_t max_memory, size_t memory_remaining);
-}mem_managed_t;
-
-static mem_managed_t g_malloc = 
-{
-	.backtrace_max_depth = 0,
-	.mutex = 0,
-	.tree = 0,
-	.max_memory = 0,
-	.memory_used = 0,
-	.malloc_failure_fp = 0,
-	.free_dangling_failure_fp = 0,
-	.free_null_failure_fp = 0,
-	.freeZ_null_failure_fp = 0,
-};
-
-static __forceinline void Mutex_Init(mutex_t *mutex)
-{
-	InitializeSRWLock(mutex);
-}
-static __forceinline void Mutex_Lock(mutex_t *mutex)
-{
-	AcquireSRWLockExclusive(mutex);
-}
-static __forceinline void Mutex_Unlock(mutex_t *mutex)
-{
-	ReleaseSRWLockExclusive(mutex);
-}
-static __forceinline void Mutex_Delete(mutex_t *mutex)
-{
-}
-
-static size_t Mem_BlockTotalMemUsed(void *memblock)
-{
-	malloc_block_t *ptr = &((malloc_block_t*)memblock)[-1];
-
-	return sizeof(void*) * ptr->backtrace.num_entries + ptr->memsize + sizeof(malloc_block_t) + (ptr->alignment - 1);
-}
-
-static int Mem_AVLCompare(void *arg0, void *arg1, void *context)
-{
-	if (arg0 == arg1)
-		return 0;
-	else if (arg0 > arg1)
-		return 1;
-	else
-		return -1;
-}
-
-static void Mem_DestroyCB(void *value, void *context)
-{
-	malloc_block_t *ptr = (malloc_block_t*)value;
-	g_malloc.memory_used -= Mem_BlockTotalMemUsed(&((malloc_block_t*)value)[1]);
-	free(ptr->base);
-}
-
-static int Mem_StackTrace_Snapshot(void **stack, int entries, int start_offset)
-{
-	return CaptureStackBackTrace(start_offset + 1, entries, stack, NULL);
-}
-
-static void Mem_MallocFail(size_t size)
-{
-	if (g_malloc.malloc_failure_fp)
-	{
-		size_t maxmem = Mem_MemoryLimit();
-		size_t usedmem = Mem_MemoryUsed();
-		size_t remaining;
-
-		Mutex_Lock(&g_malloc.mutex);
-
-		if (usedmem > maxmem)
-			remaining = 0;
-		else
-			remaining = maxmem - usedmem;
-
-		if (g_malloc.malloc_failure_fp)	// needed because the pointer might've changed after the if but before the lock was acquired
-			g_malloc.malloc_failure_fp(size, maxmem, remaining);
-
-		Mutex_Unlock(&g_malloc.mutex);
-	}
-}
-static int Mem_StackTrace_UnpackEntry(void **stack, int index, char **filename, int *linenumber, char **function, void **address, size_t *allocated_mem, int canfail)
-{
-	DWORD				offset = 0;
-	SYMBOL_INFO			*symbol;
-	ULONG64				buffer[(sizeof(SYMBOL_INFO) + MAX_SYM_NAME*sizeof(TCHAR) + sizeof(ULONG64) - 1) / sizeof(ULONG64)];
-	IMAGEHLP_LINE64		line = {0};
-	int					filename_len;
-	int					function_len;
-	BOOL				ret;
-
-	*filename = 0;
-	*function = 0;
-	*linenumber = 0;
-	*address = 0;
-	if (allocated_mem)
-		*allocated_mem = 0;
-
-	symbol = (SYMBOL_INFO*)buffer;
-	symbol->MaxNameLen   = MAX_SYM_NAME;
-	symbol->SizeOfStruct = sizeof(SYMBOL_INFO);
-
-	line.SizeOfStruct = sizeof(IMAGEHLP_LINE64);
-
-	ret = SymFromAddr(GetCurrentProcess(), (DWORD64)(stack[index]), 0, symbol);
-	if (!ret)
-	{
-		return -1;
-	}
-	ret = SymGetLineFromAddr64(GetCurrentProcess(), (DWORD64)(stack[index]), &offset, &line);
-	if (!ret)
-	{
-		return -1;
-	}
-
-	filename_len = _scprintf("%s", line.FileName);
-	function_len = _scprintf("%s", symbol->Name);
-
-	*filename = malloc(filename_len + 1);
-	*function = malloc(function_len + 1);
-
-	if (!(*filename) || !(*function))
-	{
-		if (*filename == 0 && canfail)
-			Mem_MallocFail(filename_len + 1);
-		if (*function == 0 && canfail)
-			Mem_MallocFail(function_len + 1);
-
-		free(*filename);
-		free(*function);
-
-		*filename = 0;
-		*function = 0;
-
-		return -1;
-	}
-
-	*linenumber = line.LineNumber;
-	*address = (void*)symbol->Address;
-
-	_snprintf_s(*filename, filename_len + 1, filename_len, "%s", line.FileName);
-	_snprintf_s(*function, function_len + 1, function_len, "%s", symbol->Name);
-
-	if (allocated_mem)
-		*allocated_mem = (size_t)filename_len + (size_t)function_len + (size_t)2;
-
-	return 0;
-}
-
-static int Mem_WalkAVLTreePrint(void *value, void *context, int depth) // TODO: callback
-{
-	malloc_block_t *ptr = (malloc_block_t*)value;
-	*(size_t*)context += ptr->memsize;
-	int i;
-
-	printf("Block of size %zu (%zu) allocated at %s:%s():%i 0x%p\n", ((malloc_block_t*)value)->memsize, sizeof(void*) * ptr->backtrace.num_entries + ptr->memsize + sizeof(malloc_block_t), ((malloc_block_t*)value)->file_immutable, ((malloc_block_t*)value)->function_immutable, ((malloc_block_t*)value)->line, (void*)value);
-
-	for (i = ptr->backtrace.num_entries - 1; i >=0; i--)
-	{
-		int j;
-		char *filename;
-		char *function;
-		void *address;
-		int line;
-		size_t allocated;
-
-		Mem_StackTrace_UnpackEntry(ptr->backtrace.entry, i, &filename, &line, &function, &address, &allocated, 1);
-
-		for (j = 0; j < ptr->backtrace.num_entries - 1 - i; j++)
-			printf(" ");
-		printf("%s:%s():%i\n", filename ? filename : "<NULL>", function ? function : "<NULL>", line);
-		free(filename);
-		free(function);
-	}
-
-	return 0;
-}
-
-static void Mem_PerformStackTrace(backtrace_t *backtrace)
-{
-	int entries = g_malloc.backtrace_max_depth;
-
-	if (entries == 0)
-		return;
-
-	backtrace->entry = malloc(sizeof(void*) * entries);
-
-	backtrace->num_entries = Mem_StackTrace_Snapshot(backtrace->entry, entries, STACKTRACE_START_OFFSET);
-}
-
-static void Mem_FreeStackTrace(backtrace_t *backtrace)
-{
-	if (!backtrace->entry)
-		return;
-
-	free(backtrace->entry);
-}
-
-static void Mem_OnMallocFailDefault(size_t allocation_size, size_t max_memory, size_t memory_remaining)
-{
-	void *stack[STACKTRACE_ONFAIL_MAX_DEPTH];
-	int entries = STACKTRACE_ONFAIL_MAX_DEPTH;
-	int i;
-	
-	printf("Failed to allocate %zu bytes (%zu total available, %zu remaining)\n", allocation_size, max_memory, memory_remaining);
-
-	entries = Mem_StackTrace_Snapshot(stack, entries, STACKTRACE_MALLOC_FAIL_OFFSET);
-
-	for (i = entries - 1; i >= 0; i--)
-	{
-		char *filename = 0;
-		int line;
-		char *function = 0;
-		void *address;
-		int j;
-
-		Mem_StackTrace_UnpackEntry(stack, i, &filename, &line, &function, &address, 0, 0);
-
-		for (j = 0; j < entries - 1 - i; j++)
-			printf(" ");
-		printf("%s:%s():%i\n", filename ? filename : "<NULL>", function ? function : "<NULL>", line);
-
-		free(filename);
-		free(function);
-
-	}
-	fflush(stdout);
-	fflush(stderr);
-
-	*(int*)0 = 0;
-}
-static void Mem_OnFreeDanglingDefault(int type, void *old_block, size_t max_memory, size_t memory_remaining)
-{
-	void *stack[STACKTRACE_ONFAIL_MAX_DEPTH];
-	int entries = STACKTRACE_ONFAIL_MAX_DEPTH;
-	int i;
-
-	printf("Attempted to free dangling pointer 0x%p\n", old_block);
-
-	entries = Mem_StackTrace_Snapshot(stack, entries, STACKTRACE_FREE_FAIL_OFFSET);
-
-	for (i = entries - 1; i >= 0; i--)
-	{
-		char *filename = 0;
-		int line;
-		char *function = 0;
-		void *address;
-		int j;
-
-		Mem_StackTrace_UnpackEntry(stack, i, &filename, &line, &function, &address, 0, 0);
-
-		for (j = 0; j < entries - 1 - i; j++)
-			printf(" ");
-		printf("%s:%s():%i\n", filename ? filename : "<NULL>", function ? function : "<NULL>", line);
-
-		free(filename);
-		free(function);
-
-	}
-
-	fflush(stdout);
-	fflush(stderr);
-
-	*(int*)0 = 0;
-}
-
-void Mem_Init()
-{
-	Mutex_Init(&g_malloc.mutex);
-	g_malloc.tree = AVLTree_New();
-	SymSetOptions(SYMOPT_LOAD_LINES);
-	SymInitialize(GetCurrentProcess(), NULL, TRUE);
-	g_malloc.malloc_failure_fp = Mem_OnMallocFailDefault;
-	g_malloc.free_dangling_failure_fp = Mem_OnFreeDanglingDefault;
-}
-
-size_t Mem_MemSize(void *memblock)
-{
-	malloc_block_t *ptr;
-
-	if (!memblock)
-		return 0;
-
-	ptr = &((malloc_block_t*)memblock)[-1];
-
-	return ptr->memsize;
-}
-
-void *Mem_MallocAligned_IMP(size_t size, uint32_t alignment, char *file, char *function, int line)
-{
-	malloc_block_t *ptr;
-	malloc_block_t *ptr_offset;
-	backtrace_t backtrace = {0};
-	uintptr_t offset;
-
-	if (alignment < 1)
-		alignment = 1;
-
-	printf("allocating %zu -> %zu bytes\n", size, size + sizeof(malloc_block_t) + alignment - 1);
-	if (Mem_MemoryUsed() + size + sizeof(malloc_block_t) + alignment - 1 > Mem_MemoryLimit())
-		ptr = 0;
-	else
-		ptr = malloc(size + sizeof(malloc_block_t) + alignment - 1);
-
-	if (ptr == 0)
-	{
-		Mem_MallocFail(size);
-
-		return 0;
-	}
-
-	offset = (uintptr_t)ptr;
-	offset = ((offset + sizeof(malloc_block_t) + alignment - 1) / alignment) * alignment;
-
-	offset -= sizeof(malloc_block_t);
-	ptr_offset = (malloc_block_t*)offset;
-
-	ptr_offset->base = ptr;
-	ptr_offset->alignment = alignment;
-	ptr_offset->memsize = size;
-	ptr_offset->file_immutable = file;
-	ptr_offset->function_immutable = function;
-	ptr_offset->line = line;
-	ptr_offset->backtrace = backtrace;
-
-	Mem_PerformStackTrace(&ptr_offset->backtrace);
-
-	Mutex_Lock(&g_malloc.mutex);
-	g_malloc.memory_used += Mem_BlockTotalMemUsed(&ptr_offset[1]);
-	AVLTree_Insert(&g_malloc.tree, ptr_offset, 0, Mem_AVLCompare);
-	Mutex_Unlock(&g_malloc.mutex);
-
-	return &ptr_offset[1];
-}
-void *Mem_ReallocAligned_IMP(void *ptr, size_t size, uint32_t alignment, char *file, char *function, int line)
-{
-	void *memblock = Mem_MallocAligned_IMP(size, alignment, file, function, line);
-	malloc_block_t *old_ptr = &((malloc_block_t*)ptr)[-1];
-	malloc_block_t *new_ptr = &((malloc_block_t*)memblock)[-1];
-
-	if (memblock == 0)
-		return 0;
-
-	memcpy(memblock, ptr, old_ptr->memsize < new_ptr->memsize ? old_ptr->memsize : new_ptr->memsize);
-
-	Mem_Free(ptr);
-
-	return memblock;
-}
-void *Mem_Malloc_IMP(size_t size, char *file, char *function, int line)
-{
-	return Mem_MallocAligned_IMP(size, 1, file, function, line);
-}
-void *Mem_Realloc_IMP(void *ptr, size_t size, char *file, char *function, int line)
-{
-	return Mem_ReallocAligned_IMP(ptr, size, 1, file, function, line);
-}
-
-void Mem_Free_IMP(void *memblock, char *file, char *function, int line)
-{
-	malloc_block_t *ptr;
-
-	if (!memblock)
-	{
-		if (g_malloc.free_null_failure_fp)
-		{
-			size_t maxmem = Mem_MemoryLimit();
-			size_t usedmem = Mem_MemoryUsed();
-			size_t remaining;
-
-			Mutex_Lock(&g_malloc.mutex);
-
-			if (usedmem > maxmem)
-				remaining = 0;
-			else
-				remaining = maxmem - usedmem;
-			if (g_malloc.free_null_failure_fp)	// needed because the pointer might've changed after the if but before the lock was acquired
-				g_malloc.free_null_failure_fp(FREE_FAILURE_NULL, 0, maxmem, remaining);
-
-			Mutex_Unlock(&g_malloc.mutex);
-		}
-		return;
-	}
-
-	ptr = &((malloc_block_t*)memblock)[-1];
-
-	Mutex_Lock(&g_malloc.mutex);
-	if (AVLTree_Query(g_malloc.tree, ptr, 0, Mem_AVLCompare) == 0)
-	{
-		if (g_malloc.free_dangling_failure_fp)
-		{
-			size_t maxmem = Mem_MemoryLimit();
-			size_t usedmem = Mem_MemoryUsed();
-			size_t remaining;
-
-			if (usedmem > maxmem)
-				remaining = 0;
-			else
-				remaining = maxmem - usedmem;
-
-			if (g_malloc.free_dangling_failure_fp)	// needed because the pointer might've changed after the if but before the lock was acquired
-				g_malloc.free_dangling_failure_fp(FREE_FAILURE_DANGLING, memblock, maxmem, remaining);
-		}
-	}
-	else
-	{
-		g_malloc.memory_used -= Mem_BlockTotalMemUsed(memblock);
-		AVLTree_DeleteValue(&g_malloc.tree, ptr, 0, Mem_AVLCompare, 0);
-		Mem_FreeStackTrace(&ptr->backtrace);
-		free(ptr->base);
-	}
-	Mutex_Unlock(&g_malloc.mutex);
-}
-void Mem_FreeZ_IMP(void **memblock, char *file, char *function, int line)
-{
-	if (!memblock)
-	{
-		if (g_malloc.freeZ_null_failure_fp)
-		{
-			size_t maxmem = Mem_MemoryLimit();
-			size_t usedmem = Mem_MemoryUsed();
-			size_t remaining;
-
-			Mutex_Lock(&g_malloc.mutex);
-
-			if (usedmem > maxmem)
-				remaining = 0;
-			else
-				remaining = maxmem - usedmem;
-
-			if (g_malloc.freeZ_null_failure_fp)	// needed because the pointer might've changed after the if but before the lock was acquired
-				g_malloc.freeZ_null_failure_fp(FREE_FAILURE_NULL, 0, maxmem, remaining);
-
-			Mutex_Unlock(&g_malloc.mutex);
-		}
-		return;
-	}
-
-	Mem_Free_IMP(*memblock, file, function, line);
-	*memblock = 0;
-}
-size_t Mem_ReportAllocatedBlocks()
-{
-	size_t total = 0;
-
-	Mutex_Lock(&g_malloc.mutex);
-	AVLTree_Walk(g_malloc.tree, 0, &total, Mem_WalkAVLTreePrint);
-	Mutex_Unlock(&g_malloc.mutex);
-
-	return total;
-}
-void Mem_FreeAll()
-{
-	Mutex_Lock(&g_malloc.mutex);
-	AVLTree_Destroy(&g_malloc.tree, 0, Mem_DestroyCB);
-	g_malloc.tree = AVLTree_New();
-	Mutex_Unlock(&g_malloc.mutex);
-}
-void Mem_Destroy()
-{
-	AVLTree_Destroy(&g_malloc.tree, 0, Mem_DestroyCB);
-	memset(&g_malloc, 0, sizeof(mem_managed_t));
-}
-size_t Mem_MemoryUsed()
-{
-	// don't need mutex here
-	return g_malloc.memory_used;
-}
-size_t Mem_MemoryLimit()
-{
-	// don't need mutex here
-	return g_malloc.max_memory ? g_malloc.max_memory : (size_t)(-1);
-}
-size_t Mem_MemoryRemaining()
-{
-	size_t memory_rem;
-	size_t memory_used;
-	size_t memory_limit;
-	
-	Mutex_Lock(&g_malloc.mutex);
-	memory_limit = Mem_MemoryLimit();
-	memory_used = Mem_MemoryUsed();
-	if (memory_used > memory_limit)
-		memory_rem = 0;
-	else
-		memory_rem = memory_limit - memory_used;
-	Mutex_Unlock(&g_malloc.mutex);
-	return memory_rem;
-}
-void Mem_SetMallocFailCallback(void (*malloc_failure_fp)(size_t allocation_size, size_t max_memory, size_t memory_remaining))
-{
-	Mutex_Lock(&g_malloc.mutex);
-	g_malloc.malloc_failure_fp = malloc_failure_fp;
-	Mutex_Unlock(&g_malloc.mutex);
-}
-void Mem_SetFreeNullCallback(void (*free_failure_fp)(int type, void *old_block, size_t max_memory, size_t memory_remaining))
-{
-	Mutex_Lock(&g_malloc.mutex);
-	g_malloc.free_null_failure_fp = free_failure_fp;
-	Mutex_Unlock(&g_malloc.mutex);
-}
-void Mem_SetFreeDanglingCallback(void (*free_failure_fp)(int type, void *old_block, size_t max_memory, size_t memory_remaining))
-{
-	Mutex_Lock(&g_malloc.mutex);
-	g_malloc.free_dangling_failure_fp = free_failure_fp;
-	Mutex_Unlock(&g_malloc.mutex);
-}
-void Mem_SetFreeZNullCallback(void (*freeZ_failure_fp)(int type, void **old_block, size_t max_memory, size_t memory_remaining))
-{
-	Mutex_Lock(&g_malloc.mutex);
-	g_malloc.freeZ_null_failure_fp = freeZ_failure_fp;
-	Mutex_Unlock(&g_malloc.mutex);
-}
-void Mem_SetBacktraceDepth(uint32_t max_depth)
-{
-	Mutex_Lock(&g_malloc.mutex);
-	g_malloc.backtrace_max_depth = max_depth;
-	Mutex_Unlock(&g_malloc.mutex);
-}
-void Mem_SetMemoryLimit(size_t size)
-{
-	// don't need mutex here
-	g_malloc.max_memory = size;
-}
-
-void (*Mem_GetDefaultMallocFail())(size_t allocation_size, size_t max_memory, size_t memory_remaining)
-{
-	return Mem_OnMallocFailDefault;
-}
-void (*Mem_GetDefaultFreeDanglingFail())(int type, void *old_block, size_t max_memory, size_t memory_remaining)
-{
-	return Mem_OnFreeDanglingDefault;
-}
-void (*Mem_GetDefaultFreeNULLFail())(int type, void *old_block, size_t max_memory, size_t memory_remaining)
-{
-	return 0;
-}
-void (*Mem_GetDefaultFreeZNULLFail())(int type, void **old_block, size_t max_memory, size_t memory_remaining)
-{
-	return 0;
-}
-
-void *Mem_RawToManaged(void *memblock, size_t size)
-{
-	void *ptr = Mem_Malloc_IMP(size, __FILE__, __FUNCTION__, __LINE__);
-
-	memcpy(ptr, memblock, size);
-
-	free(memblock);
-
-	return ptr;
-}
-void *Mem_RawToManagedAligned(void *memblock, size_t size, uint32_t alignment)
-{
-	void *ptr = Mem_MallocAligned_IMP(size, alignment, __FILE__, __FUNCTION__, __LINE__);
-
-	memcpy(ptr, memblock, size);
-
-	free(memblock);
-
-	return ptr;
-}
-
-// Used by AVL tree, only called when the mutex is already locked
-
-void Mem_AddUsedLocked(size_t size)
-{
-	g_malloc.memory_used += size;
-}
-void Mem_SubtractUsedLocked(size_t size)
-{
-	g_malloc.memory_used -= size;
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include "../inc/platform.h"
+#include "../inc/hash_table.h"
+#include "../inc/stack_depot.h"
+#include "../inc/symbol_cache.h"
+#include "../inc/call_site.h"
+#include "../inc/profile_writer.h"
+#include "../inc/memory.h"
+
+#define STACKTRACE_START_OFFSET			2
+#define STACKTRACE_MALLOC_FAIL_OFFSET	2
+#define STACKTRACE_FREE_FAIL_OFFSET		1
+#define STACKTRACE_ONFAIL_MAX_DEPTH		1024
+#define STACKTRACE_SAMPLE_DEFAULT_DEPTH	32		// used for sampled blocks when no backtrace depth was set
+
+#define MEM_NUM_SHARDS_LOG2				6
+#define MEM_NUM_SHARDS					(1 << MEM_NUM_SHARDS_LOG2)
+
+// Compact headers only pay off if the classes are fine enough to not round the saving straight back up
+#ifdef MEM_COMPACT_HEADER
+#define MEM_TCACHE_GRANULARITY			16		// size class spacing, in bytes of underlying allocation
+#define MEM_TCACHE_NUM_CLASSES			64		// allocations larger than MEM_TCACHE_GRANULARITY * MEM_TCACHE_NUM_CLASSES bypass the cache
+#else
+#define MEM_TCACHE_GRANULARITY			32
+#define MEM_TCACHE_NUM_CLASSES			32
+#endif
+#define MEM_TCACHE_MAX_BLOCKS			64		// per size class, per thread
+
+#define MEM_SIZE_CLASS_MASK				0x7F
+#define MEM_SIZE_CLASS_SLAB				0x80	// set in malloc_block_t::size_class if the block is a slab slot
+#define MEM_SIZE_CLASS_LARGE			MEM_SIZE_CLASS_MASK	// malloc_block_t::size_class of a block mapped directly from the OS, never cached
+
+#define MEM_COMPACT_MAX_SIZE			(((uint64_t)1 << 40) - 1)
+#define MEM_COMPACT_MAX_SLACK			0xFFFF
+
+#define MEM_CREDIT_BATCH				65536	// bytes a thread reserves ahead from the shared counter
+#define MEM_CREDIT_MAX					(2 * MEM_CREDIT_BATCH)	// unused credit above this goes back to the shared counter
+
+#define MEM_MAX_TAGS					256
+
+#define MEM_SITE_DELTA_SLOTS			64		// per thread, direct-mapped by call-site id and generation
+#define MEM_SITE_DELTA_MAX_OPS			256		// a slot is applied to the shared statistics after this many allocations and frees
+#define MEM_SITE_DELTA_MAX_BYTES		65536	// or once its live bytes have moved by this much
+
+#define MEM_STATS_TIMING_INTERVAL		8		// per thread, one call in this many is timed (power-of-two)
+#define MEM_STATS_LIFETIME_SLOTS		128		// per shard, sampled live blocks whose allocation time is kept
+#define MEM_STATS_LIFETIME_PROBES		8
+#define MEM_STATS_LIFETIME_SHIFT		6		// one block address in 2^this is sampled
+
+#define MEM_SIZE_UNKNOWN				((size_t)-1)	// passed for the size when freeing a block of any size
+
+#define MEM_SPAN_SIZE					65536	// spans are aligned to their size
+#define MEM_SPAN_HEADER_SIZE			64
+#define MEM_SLAB_ALIGNMENT				MEM_TCACHE_GRANULARITY	// slots are this aligned, so any alignment dividing both it and the header size needs no slack
+
+#define MEM_LARGE_DEFAULT_THRESHOLD		(1024 * 1024)	// underlying allocations this large are mapped directly, see Mem_SetLargeThreshold
+#define MEM_HUGE_PAGE_SIZE				(2 * 1024 * 1024)	// large blocks at least this size are aligned to it when huge pages are on
+
+#define MEM_BLOCK_TRACKED				0		// what a block's cookie says it is
+#define MEM_BLOCK_UNTRACKED				1		// live, but left out of the registry
+#define MEM_BLOCK_FREED					2
+#define MEM_BLOCK_CORRUPT				3		// matches none of the others
+
+#define MEM_PRESENCE_GRANULARITY_LOG2	4		// an untracked block's header must be aligned to this, or it goes in the registry
+#define MEM_PRESENCE_LEAF_LOG2			20		// address bits covered by one presence bitmap, which takes 8KiB
+#define MEM_PRESENCE_NODE_LOG2			34		// by one node of bitmap pointers, which takes 128KiB
+#define MEM_PRESENCE_ADDRESS_LOG2		48		// blocks above this go in the registry
+#define MEM_PRESENCE_ROOT_SIZE			(1 << (MEM_PRESENCE_ADDRESS_LOG2 - MEM_PRESENCE_NODE_LOG2))
+#define MEM_PRESENCE_NODE_SIZE			(1 << (MEM_PRESENCE_NODE_LOG2 - MEM_PRESENCE_LEAF_LOG2))
+#define MEM_PRESENCE_LEAF_WORDS			(1 << (MEM_PRESENCE_LEAF_LOG2 - MEM_PRESENCE_GRANULARITY_LOG2 - 6))
+
+#define MEM_MAX_RECLAIMERS				32
+#define MEM_RECLAIM_RETRY_MS			100		// how long the reclaim thread waits before trying again when usage stays over the soft watermark
+
+typedef struct mem_lifetime_sample_s
+{
+	malloc_block_t	*block;
+	uint64_t		allocated;				// Platform_Cycles
+}mem_lifetime_sample_t;
+
+// Blocks are tracked in one of MEM_NUM_SHARDS independent shards, selected by a hash of the block header address, so
+// that threads allocating and freeing unrelated blocks rarely contend on the same lock.
+typedef struct PLATFORM_CACHE_ALIGN mem_shard_s
+{
+	mutex_t			mutex;
+	hash_table_t	registry;				// every live malloc_block_t of this shard, keyed by header address
+#ifndef MEM_DISABLE_STATS
+	mem_lifetime_sample_t lifetime[MEM_STATS_LIFETIME_SLOTS];	// best effort, a sample that finds no free slot is dropped
+#endif
+}mem_shard_t;
+
+// Slab span, carved into equally sized slots of one size class. The span header sits at the start of the span, and the
+// span of any slot is found by rounding the slot address down to MEM_SPAN_SIZE.
+typedef struct mem_span_s
+{
+	struct mem_span_s	*next;				// in the class's list of spans with free slots
+	struct mem_span_s	*prev;
+	void				*free;				// slots freed back to the span, singly linked through their first word
+	char				*bump;				// next never-used slot
+	int					size_class;
+	int					used;
+	int					capacity;
+}mem_span_t;
+
+typedef struct PLATFORM_CACHE_ALIGN mem_slab_class_s
+{
+	mutex_t				mutex;
+	mem_span_t			*partial;			// spans with at least one free slot
+}mem_slab_class_t;
+
+// Node of the budget tree. A block charged to a tag is also charged to every ancestor of it, and an allocation fails if
+// any of them would go over its limit. Tags are never deleted, so they can be read without a lock.
+typedef struct PLATFORM_CACHE_ALIGN mem_tag_s
+{
+	const char			*name;
+	int					parent;
+	volatile int64_t	used;
+	volatile int64_t	peak;
+	volatile int64_t	limit;				// 0 if unlimited
+}mem_tag_t;
+
+// Presence map of the untracked blocks, a bit per possible header address. It stands in for the registry, telling a live
+// block from a freed or foreign pointer without reading anything at that address, but needs no lock: a block is claimed
+// by atomically clearing its bit. Bitmaps and nodes are made on demand and kept until Mem_Destroy.
+typedef struct mem_presence_leaf_s
+{
+	volatile int64_t	bits[MEM_PRESENCE_LEAF_WORDS];
+}mem_presence_leaf_t;
+
+typedef struct mem_presence_node_s
+{
+	mem_presence_leaf_t	* volatile leaf[MEM_PRESENCE_NODE_SIZE];
+}mem_presence_node_t;
+
+typedef struct mem_reclaimer_s
+{
+	void			(*reclaim_fp)(int level, size_t bytes_wanted, void *context);
+	void			*context;
+	int				priority;
+	int				id;
+}mem_reclaimer_t;
+
+typedef struct mem_managed_s
+{
+	volatile int32_t initialized;			// 1 while Mem_Init runs, 2 once it's done
+	int				backtrace_max_depth;	// this will be allocated on the stack, so it's advised to keep this as small as possible
+	mutex_t			mutex;					// protects the configuration and serialises the failure callbacks
+	size_t			max_memory;
+	void			(*malloc_failure_fp)(size_t allocation_size, size_t max_memory, size_t memory_remaining);
+	void			(*free_dangling_failure_fp)(int type, void *old_block, size_t max_memory, size_t memory_remaining);
+	void			(*free_null_failure_fp)(int type, void *old_block, size_t max_memory, size_t memory_remaining);
+	void			(*freeZ_null_failure_fp)(int type, void **old_block, size_t max_memory, size_t memory_remaining);
+	int				slab_enabled;
+	size_t			large_threshold;		// 0 if every block goes to the C runtime or the slabs
+	int				huge_pages;
+	size_t			sample_rate;			// average number of bytes between sampled allocations, 0 samples every allocation
+	volatile int32_t untracked;				// new blocks are left out of the registry
+	volatile int32_t untracked_ever;		// some blocks may not be in the registry, so a registry miss looks at the presence map
+	mem_presence_node_t * volatile presence[MEM_PRESENCE_ROOT_SIZE];
+	size_t			soft_watermark;
+	size_t			hard_watermark;
+	volatile int64_t reclaim_trigger;		// the lower of the watermarks that are set, 0 if neither is
+	int				num_reclaimers;			// protected by mutex
+	int				next_reclaimer_id;
+	mem_reclaimer_t	reclaimer[MEM_MAX_RECLAIMERS];	// by priority, lowest first
+	mutex_t			reclaim_mutex;			// held while the reclaim callbacks run, so only one thread runs them at a time
+	volatile int32_t reclaim_requested;		// the reclaim thread has been asked to get usage under the soft watermark
+	volatile int32_t reclaim_thread_state;	// 0 = not started, 1 = starting, 2 = running, 3 = couldn't be started
+	volatile int32_t reclaim_stop;
+	platform_thread_t reclaim_thread;
+	PLATFORM_CACHE_ALIGN volatile int64_t memory_used;	// everything charged, including the threads' unused credit
+	volatile int64_t memory_peak;			// of memory_used, so it can be ahead by the credit
+	mem_shard_t		shard[MEM_NUM_SHARDS];
+	mem_slab_class_t slab[MEM_TCACHE_NUM_CLASSES];
+	volatile int32_t generation;			// stamped on every block, so blocks can be told apart by when they were allocated
+	volatile int32_t num_tags;				// highest valid tag, the root isn't stored
+	mem_tag_t		tag[MEM_MAX_TAGS];
+}mem_managed_t;
+
+// Call-site statistics the thread hasn't applied to the shared table yet
+typedef struct mem_site_delta_s
+{
+	uint32_t			callsite;
+	uint32_t			generation;			// of the blocks allocated or freed
+	uint32_t			ops;
+	int64_t				bytes;
+	int64_t				high;				// highest bytes reached since the last apply, so the peak isn't lost in between
+	int64_t				alloc_bytes;
+	int64_t				allocs;
+	int64_t				frees;
+}mem_site_delta_t;
+
+// Per-thread cache of freed blocks, bucketed by the size of their underlying allocation. Cached blocks are no longer in
+// the registry (so freeing them again is still reported as dangling), but they stay charged to memory_used until they
+// are released, and a recycled block simply takes its charge over. Any thread may recycle any block, so cross-thread
+// frees simply land in the freeing thread's cache. Records are never released, only recycled once their thread exits,
+// so the list can be walked without a lock.
+//
+// Each thread also holds some credit: bytes already reserved against the limit in memory_used but not yet handed out,
+// so most allocations and frees only touch their own thread's counter. The same goes for the call-site statistics, which
+// are buffered per thread and applied in batches, or by whoever wants to read them.
+typedef struct mem_thread_s
+{
+	mutex_t				mutex;				// only ever contended when another thread flushes this cache
+	struct mem_thread_s	*next;
+	volatile int32_t	in_use;
+	size_t				cache_bytes;
+	volatile int64_t	credit;				// only taken by its own thread, but any thread may reclaim it
+	void				*bin[MEM_TCACHE_NUM_CLASSES];	// singly linked through the first word of each underlying allocation
+	int					bin_count[MEM_TCACHE_NUM_CLASSES];
+	int64_t				sample_bytes_left;	// the next allocation to take this below zero is sampled
+	uint64_t			sample_rng;
+	call_site_t			last_site;			// most allocations repeat the previous call site, so skip the table for those
+	uint32_t			last_site_id;
+	mem_site_delta_t	site_delta[MEM_SITE_DELTA_SLOTS];	// protected by mutex
+#ifndef MEM_DISABLE_STATS
+	mem_stats_t			stats;				// only written by its own thread, so readers may see it mid-update
+	uint32_t			stats_calls;
+#endif
+}mem_thread_t;
+
+typedef struct mem_threads_s
+{
+	mem_thread_t * volatile	head;
+	thread_key_t			thread_key;		// only used for its destructor, which recycles the record on thread exit
+}mem_threads_t;
+
+// kept outside g_malloc so that it survives Mem_Destroy; threads hold on to their record for their whole lifetime
+static mem_threads_t g_threads =
+{
+	.head = 0,
+	.thread_key = THREAD_KEY_INVALID,
+};
+static uint64_t g_cookie_key = 0;		// random, so that a cookie can't be made up without reading one first
+static PLATFORM_THREAD_LOCAL mem_thread_t *g_thread = 0;
+static PLATFORM_THREAD_LOCAL int g_thread_tag = MEM_TAG_NONE;
+static PLATFORM_THREAD_LOCAL int g_thread_reclaiming = 0;	// running the reclaim callbacks, which must not end up running them again
+
+static mem_managed_t g_malloc = 
+{
+	.initialized = 0,
+	.backtrace_max_depth = 0,
+	.mutex = MUTEX_INIT,
+	.max_memory = 0,
+	.malloc_failure_fp = 0,
+	.free_dangling_failure_fp = 0,
+	.free_null_failure_fp = 0,
+	.freeZ_null_failure_fp = 0,
+	.slab_enabled = 0,
+	.large_threshold = MEM_LARGE_DEFAULT_THRESHOLD,
+	.huge_pages = 0,
+	.sample_rate = 0,
+	.reclaim_mutex = MUTEX_INIT,
+};
+
+static __forceinline int Mem_ShardIndex(malloc_block_t *block)
+{
+	uint64_t h = (uint64_t)(uintptr_t)block;
+
+	// a different multiplier to the registry hash, so that the shard index and the slot index are uncorrelated
+	h = (h >> 4) * 0xFF51AFD7ED558CCDull;
+
+	return (int)(h >> (64 - MEM_NUM_SHARDS_LOG2));
+}
+static __forceinline mem_shard_t *Mem_Shard(malloc_block_t *block)
+{
+	return &g_malloc.shard[Mem_ShardIndex(block)];
+}
+
+// Header accessors. A compact header stores the base as an offset and the allocation size as the slack past the user
+// data; slack too large for it is dropped, so such a block is both charged and reported as the smaller size.
+#ifdef MEM_COMPACT_HEADER
+static __forceinline char *Mem_BlockBase(malloc_block_t *block)
+{
+	return (char*)block - block->offset;
+}
+static __forceinline size_t Mem_BlockAllocSize(malloc_block_t *block)
+{
+	return (size_t)block->offset + sizeof(malloc_block_t) + (size_t)block->memsize + (size_t)block->slack;
+}
+static __forceinline int Mem_BlockLayoutFits(malloc_block_t *block, size_t allocsize, size_t memsize)
+{
+	return allocsize - (size_t)block->offset - sizeof(malloc_block_t) - memsize <= MEM_COMPACT_MAX_SLACK;
+}
+static __forceinline void Mem_BlockSetLayout(malloc_block_t *block, char *base, size_t allocsize, size_t memsize)
+{
+	size_t slack;
+
+	block->offset = (uint32_t)((char*)block - base);
+	block->memsize = memsize;
+	slack = allocsize - (size_t)block->offset - sizeof(malloc_block_t) - memsize;
+	block->slack = slack < MEM_COMPACT_MAX_SLACK ? slack : MEM_COMPACT_MAX_SLACK;
+}
+// Nor for a generation, so every block is in generation 0
+static __forceinline uint32_t Mem_CurrentGeneration()
+{
+	return 0;
+}
+static __forceinline uint32_t Mem_BlockGeneration(malloc_block_t *block)
+{
+	return 0;
+}
+static __forceinline void Mem_BlockSetGeneration(malloc_block_t *block, uint32_t generation)
+{
+}
+// There's no room for a cookie, so every block is in the registry and taken at its word
+static __forceinline int Mem_BlockState(malloc_block_t *block)
+{
+	return MEM_BLOCK_TRACKED;
+}
+static __forceinline void Mem_BlockSeal(malloc_block_t *block, int state)
+{
+}
+#else
+static __forceinline char *Mem_BlockBase(malloc_block_t *block)
+{
+	return (char*)block - block->offset;
+}
+static __forceinline size_t Mem_BlockAllocSize(malloc_block_t *block)
+{
+	return block->allocsize;
+}
+static __forceinline int Mem_BlockLayoutFits(malloc_block_t *block, size_t allocsize, size_t memsize)
+{
+	return 1;
+}
+static __forceinline void Mem_BlockSetLayout(malloc_block_t *block, char *base, size_t allocsize, size_t memsize)
+{
+	block->offset = (uint32_t)((char*)block - base);
+	block->allocsize = allocsize;
+	block->memsize = memsize;
+}
+// The generation new blocks are stamped with
+static __forceinline uint32_t Mem_CurrentGeneration()
+{
+	return (uint32_t)g_malloc.generation;
+}
+static __forceinline uint32_t Mem_BlockGeneration(malloc_block_t *block)
+{
+	return block->generation;
+}
+static __forceinline void Mem_BlockSetGeneration(malloc_block_t *block, uint32_t generation)
+{
+	block->generation = generation;
+}
+
+// The cookie of a block in the given state. Once freed, the first half of the header may belong to a free list.
+static __forceinline uint32_t Mem_BlockCookie(malloc_block_t *block, int state)
+{
+	uint64_t h = (uint64_t)block->memsize * 0x9E3779B97F4A7C15ull + block->offset + (uint64_t)state;
+
+	if (state != MEM_BLOCK_FREED)
+		h += (uint64_t)block->allocsize * 0xC2B2AE3D27D4EB4Full + ((uint64_t)block->size_class << 32 | block->callsite) + (uint64_t)block->generation * 0x165667B19E3779F9ull;
+	h ^= (uint64_t)(uintptr_t)block ^ g_cookie_key;
+	h *= 0xFF51AFD7ED558CCDull;
+	h ^= h >> 32;
+	h *= 0xC4CEB9FE1A85EC53ull;
+
+	return (uint32_t)(h >> 32);
+}
+static __forceinline int Mem_BlockState(malloc_block_t *block)
+{
+	uint32_t cookie = block->cookie;
+
+	if (cookie == Mem_BlockCookie(block, MEM_BLOCK_TRACKED))
+		return MEM_BLOCK_TRACKED;
+	if (cookie == Mem_BlockCookie(block, MEM_BLOCK_UNTRACKED))
+		return MEM_BLOCK_UNTRACKED;
+	if (cookie == Mem_BlockCookie(block, MEM_BLOCK_FREED))
+		return MEM_BLOCK_FREED;
+
+	return MEM_BLOCK_CORRUPT;
+}
+// after anything the cookie covers has changed
+static __forceinline void Mem_BlockSeal(malloc_block_t *block, int state)
+{
+	block->cookie = Mem_BlockCookie(block, state);
+}
+#endif
+
+// The tag is only looked up once tags exist, blocks allocated before that are all MEM_TAG_NONE
+static __forceinline int Mem_BlockTag(malloc_block_t *block)
+{
+	return g_malloc.num_tags ? CallSite_Get(block->callsite)->tag : MEM_TAG_NONE;
+}
+
+static __forceinline int Mem_SizeClass(size_t allocsize)
+{
+	size_t size_class = (allocsize + MEM_TCACHE_GRANULARITY - 1) / MEM_TCACHE_GRANULARITY;
+
+	return size_class <= MEM_TCACHE_NUM_CLASSES ? (int)size_class : 0;
+}
+
+// Raises memory_peak to used, if it's below it
+static __forceinline void Mem_UpdatePeak(int64_t used)
+{
+	int64_t peak;
+
+	while ((peak = g_malloc.memory_peak) < used && Atomic_CompareExchange64(&g_malloc.memory_peak, used, peak) != peak)
+		;
+}
+// Adds bytes to memory_used unless that would take Mem_MemoryUsed over the limit. Returns nonzero on failure.
+static int Mem_Reserve(size_t bytes)
+{
+	size_t limit;
+	size_t metadata;
+
+	if (g_malloc.max_memory == 0)
+	{
+		Mem_UpdatePeak(Atomic_Add64(&g_malloc.memory_used, (int64_t)bytes) + (int64_t)bytes);
+		return 0;
+	}
+
+	limit = Mem_MemoryLimit();
+	metadata = StackDepot_MemUsed() + SymbolCache_MemUsed() + CallSite_MemUsed();
+
+	for (;;)
+	{
+		int64_t used = g_malloc.memory_used;
+
+		if (bytes > limit || metadata > limit - bytes || (size_t)used > limit - bytes - metadata)
+			return -1;
+		if (Atomic_CompareExchange64(&g_malloc.memory_used, used + (int64_t)bytes, used) == used)
+		{
+			Mem_UpdatePeak(used + (int64_t)bytes);
+			return 0;
+		}
+	}
+}
+static __forceinline void Mem_Release(size_t bytes)
+{
+	if (bytes)
+		Atomic_Add64(&g_malloc.memory_used, -(int64_t)bytes);
+}
+
+static __forceinline void Mem_TagUncharge(int tag, int stop, size_t bytes)
+{
+	for (; tag != stop; tag = g_malloc.tag[tag].parent)
+		Atomic_Add64(&g_malloc.tag[tag].used, -(int64_t)bytes);
+}
+
+// Charges bytes to tag and all of its ancestors. Returns 0 on success, otherwise the tag that would have gone over its
+// limit, with nothing charged.
+static int Mem_TagCharge(int tag, size_t bytes)
+{
+	int t;
+
+	for (t = tag; t != MEM_TAG_NONE; t = g_malloc.tag[t].parent)
+	{
+		mem_tag_t *budget = &g_malloc.tag[t];
+		int64_t used;
+
+		do
+		{
+			used = budget->used;
+			if (budget->limit && used + (int64_t)bytes > budget->limit)
+			{
+				Mem_TagUncharge(tag, t, bytes);
+				return t;
+			}
+		} while (Atomic_CompareExchange64(&budget->used, used + (int64_t)bytes, used) != used);
+	}
+
+	// only once the whole chain took the charge, so a rolled back charge never shows up as a peak
+	for (t = tag; t != MEM_TAG_NONE; t = g_malloc.tag[t].parent)
+	{
+		mem_tag_t *budget = &g_malloc.tag[t];
+		int64_t used = budget->used;
+		int64_t peak;
+
+		while ((peak = budget->peak) < used && Atomic_CompareExchange64(&budget->peak, used, peak) != peak)
+			;
+	}
+
+	return 0;
+}
+
+static void *Mem_SlabAlloc(int size_class)
+{
+	mem_slab_class_t *slab = &g_malloc.slab[size_class - 1];
+	mem_span_t *span;
+	void *slot;
+
+	Mutex_Lock(&slab->mutex);
+	span = slab->partial;
+	if (!span)
+	{
+		span = Platform_MapSpan(MEM_SPAN_SIZE);
+		if (!span)
+		{
+			Mutex_Unlock(&slab->mutex);
+			return 0;
+		}
+		span->next = 0;
+		span->prev = 0;
+		span->free = 0;
+		span->bump = (char*)span + MEM_SPAN_HEADER_SIZE;
+		span->size_class = size_class;
+		span->used = 0;
+		span->capacity = (MEM_SPAN_SIZE - MEM_SPAN_HEADER_SIZE) / (size_class * MEM_TCACHE_GRANULARITY);
+		slab->partial = span;
+	}
+
+	if (span->free)
+	{
+		slot = span->free;
+		span->free = *(void**)slot;
+	}
+	else
+	{
+		slot = span->bump;
+		span->bump += size_class * MEM_TCACHE_GRANULARITY;
+	}
+
+	if (++span->used == span->capacity)
+	{
+		slab->partial = span->next;
+		if (span->next)
+			span->next->prev = 0;
+		span->next = 0;
+	}
+	Mutex_Unlock(&slab->mutex);
+
+	return slot;
+}
+
+static void Mem_SlabFree(void *slot)
+{
+	mem_span_t *span = (mem_span_t*)((uintptr_t)slot & ~(uintptr_t)(MEM_SPAN_SIZE - 1));
+	mem_slab_class_t *slab = &g_malloc.slab[span->size_class - 1];
+
+	Mutex_Lock(&slab->mutex);
+	*(void**)slot = span->free;
+	span->free = slot;
+
+	if (span->used-- == span->capacity)
+	{
+		// was full, so it isn't linked anywhere yet
+		span->prev = 0;
+		span->next = slab->partial;
+		if (slab->partial)
+			slab->partial->prev = span;
+		slab->partial = span;
+	}
+
+	if (span->used == 0)
+	{
+		if (span->prev)
+			span->prev->next = span->next;
+		else
+			slab->partial = span->next;
+		if (span->next)
+			span->next->prev = span->prev;
+
+		Platform_UnmapSpan(span, MEM_SPAN_SIZE);
+	}
+	Mutex_Unlock(&slab->mutex);
+}
+
+// Nonzero if a block of size bytes of user data, with its header and alignment slack, can't be sized in a size_t. Every
+// path that sizes a block checks this before any arithmetic on size.
+static __forceinline int Mem_SizeOverflows(size_t size, uint32_t alignment)
+{
+	return size > SIZE_MAX - sizeof(malloc_block_t) - alignment;
+}
+
+// Large blocks. The header sits at the end of the first page when the alignment is above a page, or else at the start
+// of the mapping, and the mapping is rounded up to whole pages, so the only slack is what's left of the last page.
+static __forceinline int Mem_IsLarge(size_t allocsize)
+{
+	return g_malloc.large_threshold && allocsize >= g_malloc.large_threshold;
+}
+// Returns the mapping size for size bytes of user data, or 0 if that would overflow
+static size_t Mem_LargeSize(size_t size, uint32_t alignment)
+{
+	size_t page = Platform_PageSize();
+	size_t lead = alignment > page ? page : (sizeof(malloc_block_t) + alignment - 1) / alignment * alignment;
+
+	if (Mem_SizeOverflows(size, alignment) || size > SIZE_MAX - lead - page)
+		return 0;
+
+	return (lead + size + page - 1) / page * page;
+}
+static void *Mem_LargeMap(size_t allocsize, uint32_t alignment)
+{
+	size_t page = Platform_PageSize();
+	size_t map_alignment = alignment > page ? alignment : page;
+	size_t map_offset = alignment > page ? page : 0;
+	int huge = g_malloc.huge_pages && allocsize >= MEM_HUGE_PAGE_SIZE;
+
+	// a huge page can only back an aligned range of them, so start the user data on one
+	if (huge && map_alignment < MEM_HUGE_PAGE_SIZE)
+		map_alignment = MEM_HUGE_PAGE_SIZE;
+
+	return Platform_MapPages(allocsize, map_alignment, map_offset, huge);
+}
+// Resizes a mapping whose block needs no more than page alignment, copying it to a new one if it can't be resized as
+// it is. Returns NULL, with the old mapping untouched, on failure.
+static void *Mem_LargeRemap(void *base, size_t old_allocsize, size_t allocsize)
+{
+	void *remapped = Platform_RemapPages(base, old_allocsize, allocsize);
+
+	if (!remapped)
+	{
+		remapped = Mem_LargeMap(allocsize, 1);
+		if (!remapped)
+			return 0;
+
+		memcpy(remapped, base, old_allocsize < allocsize ? old_allocsize : allocsize);
+		Platform_UnmapPages(base, old_allocsize);
+	}
+
+	return remapped;
+}
+
+// Returns an underlying allocation to wherever it came from. allocsize is only needed for large blocks.
+static __forceinline void Mem_ReleaseBase(void *base, int size_class, size_t allocsize)
+{
+	if (size_class == MEM_SIZE_CLASS_LARGE)
+		Platform_UnmapPages(base, allocsize);
+	else if (size_class & MEM_SIZE_CLASS_SLAB)
+		Mem_SlabFree(base);
+	else
+		free(base);
+}
+
+static void Mem_ThreadCacheFlush(mem_thread_t *thread)
+{
+	int i;
+
+	Mutex_Lock(&thread->mutex);
+	for (i = 0; i < MEM_TCACHE_NUM_CLASSES; i++)
+	{
+		while (thread->bin[i])
+		{
+			void *base = thread->bin[i];
+
+			thread->bin[i] = ((void**)base)[0];
+			Mem_ReleaseBase(base, (int)(intptr_t)((void**)base)[1], 0);
+		}
+		thread->bin_count[i] = 0;
+	}
+	Mem_Release(thread->cache_bytes);
+	thread->cache_bytes = 0;
+	Mutex_Unlock(&thread->mutex);
+}
+
+static void Mem_SiteStatsApply(call_site_stats_t *stats, const mem_site_delta_t *delta)
+{
+	int64_t live = Atomic_Add64(&stats->live_bytes, delta->bytes);
+	int64_t peak;
+
+	live += delta->high;
+	Atomic_Add64(&stats->live_blocks, delta->allocs - delta->frees);
+	Atomic_Add64(&stats->total_allocs, delta->allocs);
+	Atomic_Add64(&stats->total_bytes, delta->alloc_bytes);
+	Atomic_Add64(&stats->total_frees, delta->frees);
+	while ((peak = stats->peak_bytes) < live && Atomic_CompareExchange64(&stats->peak_bytes, live, peak) != peak)
+		;
+}
+
+static void Mem_SiteStatsApplyCB(call_site_stats_t *stats, const void *context)
+{
+	Mem_SiteStatsApply(stats, (const mem_site_delta_t*)context);
+}
+
+static void Mem_SiteDeltaApply(mem_site_delta_t *delta)
+{
+	call_site_stats_t *stats = CallSite_GetStats(delta->callsite);
+
+	if (stats && delta->ops)
+	{
+		Mem_SiteStatsApply(stats, delta);
+		CallSite_ApplyGenerationStats(delta->callsite, delta->generation, Mem_SiteStatsApplyCB, delta);
+	}
+
+	delta->ops = 0;
+	delta->bytes = 0;
+	delta->high = 0;
+	delta->alloc_bytes = 0;
+	delta->allocs = 0;
+	delta->frees = 0;
+}
+
+static void Mem_SiteDeltaFlush(mem_thread_t *thread)
+{
+	int i;
+
+	Mutex_Lock(&thread->mutex);
+	for (i = 0; i < MEM_SITE_DELTA_SLOTS; i++)
+		Mem_SiteDeltaApply(&thread->site_delta[i]);
+	Mutex_Unlock(&thread->mutex);
+}
+
+static void PLATFORM_CALLBACK Mem_ThreadDetach(void *value)
+{
+	mem_thread_t *thread = (mem_thread_t*)value;
+
+	if (!thread)
+		return;
+
+	// Run on the exiting thread, which may still allocate from a later destructor. It then attaches again rather than
+	// using a record another thread may have taken by then.
+	if (g_thread == thread)
+		g_thread = 0;
+
+	Mem_ThreadCacheFlush(thread);
+	Mem_SiteDeltaFlush(thread);
+	Mem_Release((size_t)Atomic_Exchange64(&thread->credit, 0));
+	Atomic_Exchange32(&thread->in_use, 0);
+}
+
+static mem_thread_t *Mem_ThreadAttach()
+{
+	mem_thread_t *thread;
+
+	for (thread = g_threads.head; thread; thread = thread->next)
+	{
+		if (thread->in_use == 0 && Atomic_CompareExchange32(&thread->in_use, 1, 0) == 0)
+			break;
+	}
+
+	if (!thread)
+	{
+		thread = calloc(1, sizeof(mem_thread_t));
+		if (!thread)
+			return 0;
+
+		Mutex_Init(&thread->mutex);
+		thread->in_use = 1;
+		do
+		{
+			thread->next = g_threads.head;
+		} while (Atomic_CompareExchangePtr((void * volatile*)&g_threads.head, thread, thread->next) != thread->next);
+	}
+
+	if (g_threads.thread_key != THREAD_KEY_INVALID)
+		Platform_ThreadKeySet(g_threads.thread_key, thread);
+
+	return thread;
+}
+
+static __forceinline mem_thread_t *Mem_Thread()
+{
+	if (!g_thread)
+		g_thread = Mem_ThreadAttach();
+
+	return g_thread;
+}
+
+// Hands every thread's unused credit back to memory_used
+static void Mem_ReclaimCredit()
+{
+	mem_thread_t *thread;
+
+	for (thread = g_threads.head; thread; thread = thread->next)
+		Mem_Release((size_t)Atomic_Exchange64(&thread->credit, 0));
+}
+
+// Charges bytes against the limit, from the calling thread's credit where possible. Returns nonzero on failure.
+static int Mem_Charge(size_t bytes)
+{
+	mem_thread_t *thread = Mem_Thread();
+	int64_t credit;
+
+	if (!thread)
+		return Mem_Reserve(bytes);
+
+	credit = thread->credit;
+	if (credit >= (int64_t)bytes && Atomic_CompareExchange64(&thread->credit, credit - (int64_t)bytes, credit) == credit)
+		return 0;
+
+	// reserve a batch on top, so the next few allocations don't touch the shared counter
+	if (Mem_Reserve(bytes + MEM_CREDIT_BATCH) == 0)
+	{
+		Atomic_Add64(&thread->credit, MEM_CREDIT_BATCH);
+		return 0;
+	}
+	if (Mem_Reserve(bytes) == 0)
+		return 0;
+
+	// close to the limit, the other threads' credit is the only headroom left
+	Mem_ReclaimCredit();
+
+	return Mem_Reserve(bytes);
+}
+static void Mem_Uncharge(size_t bytes)
+{
+	mem_thread_t *thread = Mem_Thread();
+
+	if (!thread)
+	{
+		Mem_Release(bytes);
+		return;
+	}
+
+	if (Atomic_Add64(&thread->credit, (int64_t)bytes) + (int64_t)bytes > MEM_CREDIT_MAX)
+	{
+		int64_t credit = Atomic_Exchange64(&thread->credit, 0);
+
+		if (credit > MEM_CREDIT_BATCH)
+		{
+			Mem_Release((size_t)(credit - MEM_CREDIT_BATCH));
+			credit = MEM_CREDIT_BATCH;
+		}
+		Atomic_Add64(&thread->credit, credit);
+	}
+}
+
+// Returns the underlying allocation of a cached block of the given class, or NULL if the bin is empty. Both slab slots
+// and C runtime blocks share the bins, so the second word of a cached block records which one it is.
+static __forceinline void *Mem_ThreadCachePop(int size_class, int *block_size_class)
+{
+	mem_thread_t *thread = Mem_Thread();
+	void *base;
+
+	if (!thread)
+		return 0;
+
+	Mutex_Lock(&thread->mutex);
+	base = thread->bin[size_class - 1];
+	if (base)
+	{
+		thread->bin[size_class - 1] = ((void**)base)[0];
+		*block_size_class = (int)(intptr_t)((void**)base)[1];
+		thread->bin_count[size_class - 1]--;
+		thread->cache_bytes -= (size_t)size_class * MEM_TCACHE_GRANULARITY;
+	}
+	Mutex_Unlock(&thread->mutex);
+
+	return base;
+}
+
+// Returns nonzero if the underlying allocation was taken by the cache
+static __forceinline int Mem_ThreadCachePush(void *base, int block_size_class)
+{
+	mem_thread_t *thread = Mem_Thread();
+	int size_class = block_size_class & MEM_SIZE_CLASS_MASK;
+	int ret = 0;
+
+	// large blocks go straight back to the OS
+	if (!thread || block_size_class == MEM_SIZE_CLASS_LARGE)
+		return 0;
+
+	Mutex_Lock(&thread->mutex);
+	if (thread->bin_count[size_class - 1] < MEM_TCACHE_MAX_BLOCKS)
+	{
+		((void**)base)[0] = thread->bin[size_class - 1];
+		((void**)base)[1] = (void*)(intptr_t)block_size_class;
+		thread->bin[size_class - 1] = base;
+		thread->bin_count[size_class - 1]++;
+		thread->cache_bytes += (size_t)size_class * MEM_TCACHE_GRANULARITY;
+		ret = 1;
+	}
+	Mutex_Unlock(&thread->mutex);
+
+	return ret;
+}
+
+// Adds an allocation or a free of bytes in the given generation to the call site's statistics, through the calling
+// thread's buffer
+static void Mem_SiteStatsAdd(uint32_t callsite, uint32_t generation, int64_t bytes, int64_t allocs, int64_t frees)
+{
+	mem_thread_t *thread;
+	mem_site_delta_t *delta;
+
+	if (callsite == 0)
+		return;
+
+	thread = Mem_Thread();
+	if (!thread)
+	{
+		mem_site_delta_t direct = {callsite, generation, 1, bytes, bytes > 0 ? bytes : 0, allocs ? bytes : 0, allocs, frees};
+
+		Mem_SiteDeltaApply(&direct);
+		return;
+	}
+
+	Mutex_Lock(&thread->mutex);
+	delta = &thread->site_delta[(callsite ^ generation) % MEM_SITE_DELTA_SLOTS];
+	if (delta->callsite != callsite || delta->generation != generation)
+	{
+		Mem_SiteDeltaApply(delta);
+		delta->callsite = callsite;
+		delta->generation = generation;
+	}
+	delta->ops++;
+	delta->bytes += bytes;
+	if (delta->high < delta->bytes)
+		delta->high = delta->bytes;
+	if (allocs)
+		delta->alloc_bytes += bytes;
+	delta->allocs += allocs;
+	delta->frees += frees;
+	if (delta->ops >= MEM_SITE_DELTA_MAX_OPS || delta->bytes >= MEM_SITE_DELTA_MAX_BYTES || delta->bytes <= -MEM_SITE_DELTA_MAX_BYTES)
+		Mem_SiteDeltaApply(delta);
+	Mutex_Unlock(&thread->mutex);
+}
+static __forceinline void Mem_SiteStatsAlloc(uint32_t callsite, uint32_t generation, size_t size)
+{
+	Mem_SiteStatsAdd(callsite, generation, (int64_t)size, 1, 0);
+}
+static __forceinline void Mem_SiteStatsFree(uint32_t callsite, uint32_t generation, size_t size)
+{
+	Mem_SiteStatsAdd(callsite, generation, -(int64_t)size, 0, 1);
+}
+
+// Instrumentation. Each thread records into its own histograms without atomics, Mem_GetStats adds them all up. Building
+// with MEM_DISABLE_STATS leaves nothing behind but the plain shard lock.
+#ifndef MEM_DISABLE_STATS
+static __forceinline void Mem_HistogramAdd(mem_histogram_t *histogram, uint64_t value)
+{
+	int bucket = value ? Platform_HighestBit(value) + 1 : 0;
+
+	histogram->count++;
+	histogram->sum += value;
+	histogram->bucket[bucket < MEM_STATS_BUCKETS ? bucket : MEM_STATS_BUCKETS - 1]++;
+}
+// Reading the cycle counter is the bulk of the cost, so only one call in MEM_STATS_TIMING_INTERVAL is timed. Returns
+// the start time of a timed call, 0 otherwise.
+static __forceinline uint64_t Mem_StatsStart()
+{
+	mem_thread_t *thread = g_thread;
+
+	if (thread && (++thread->stats_calls & (MEM_STATS_TIMING_INTERVAL - 1)) == 0)
+		return Platform_Cycles();
+
+	return 0;
+}
+static __forceinline void Mem_StatsMalloc(uint64_t start, size_t size, uint32_t alignment)
+{
+	mem_thread_t *thread = g_thread;
+
+	if (!thread)
+		return;
+	if (start)
+		Mem_HistogramAdd(&thread->stats.malloc_cycles, Platform_Cycles() - start);
+	Mem_HistogramAdd(&thread->stats.request_size, size);
+	Mem_HistogramAdd(&thread->stats.alignment, alignment);
+}
+static __forceinline void Mem_StatsRealloc(uint64_t start, size_t size, uint32_t alignment)
+{
+	mem_thread_t *thread = g_thread;
+
+	if (!thread)
+		return;
+	if (start)
+		Mem_HistogramAdd(&thread->stats.realloc_cycles, Platform_Cycles() - start);
+	Mem_HistogramAdd(&thread->stats.request_size, size);
+	Mem_HistogramAdd(&thread->stats.alignment, alignment);
+}
+static __forceinline void Mem_StatsFree(uint64_t start)
+{
+	mem_thread_t *thread = g_thread;
+
+	if (thread && start)
+		Mem_HistogramAdd(&thread->stats.free_cycles, Platform_Cycles() - start);
+}
+// Only a lock that's already taken is timed, so the uncontended path costs a single compare-exchange as before
+static __forceinline void Mem_ShardLock(mem_shard_t *shard)
+{
+	mem_thread_t *thread = g_thread;
+	uint64_t start;
+
+	if (thread)
+		thread->stats.lock_acquisitions++;
+	if (Mutex_TryLock(&shard->mutex))
+		return;
+
+	start = Platform_Cycles();
+	Mutex_Lock(&shard->mutex);
+	if (thread)
+		Mem_HistogramAdd(&thread->stats.lock_wait_cycles, Platform_Cycles() - start);
+}
+
+// Block lifetimes are sampled by address, so that a free finds out whether its block was sampled without touching
+// anything but the header. The lifetime table helpers are only called with the shard mutex locked.
+static __forceinline int Mem_LifetimeSampled(malloc_block_t *block)
+{
+	uint64_t h = ((uint64_t)(uintptr_t)block >> 4) * 0xC4CEB9FE1A85EC53ull;
+
+	return (h >> (64 - MEM_STATS_LIFETIME_SHIFT)) == 0;
+}
+static __forceinline size_t Mem_LifetimeSlot(malloc_block_t *block)
+{
+	return (size_t)(((uintptr_t)block >> 4) % MEM_STATS_LIFETIME_SLOTS);
+}
+// allocated is 0 for now
+static void Mem_LifetimeStart(mem_shard_t *shard, malloc_block_t *block, uint64_t allocated)
+{
+	mem_lifetime_sample_t *empty = 0;
+	size_t slot;
+	int i;
+
+	if (!Mem_LifetimeSampled(block))
+		return;
+	if (!allocated)
+		allocated = Platform_Cycles();
+
+	slot = Mem_LifetimeSlot(block);
+	for (i = 0; i < MEM_STATS_LIFETIME_PROBES; i++)
+	{
+		mem_lifetime_sample_t *sample = &shard->lifetime[(slot + i) % MEM_STATS_LIFETIME_SLOTS];
+
+		if (sample->block == block)
+		{
+			sample->allocated = allocated;
+			return;
+		}
+		if (!sample->block && !empty)
+			empty = sample;
+	}
+	if (empty)
+	{
+		empty->block = block;
+		empty->allocated = allocated;
+	}
+}
+// Returns when the block was allocated, or 0 if it wasn't sampled
+static uint64_t Mem_LifetimeTake(mem_shard_t *shard, malloc_block_t *block)
+{
+	size_t slot;
+	int i;
+
+	if (!Mem_LifetimeSampled(block))
+		return 0;
+
+	slot = Mem_LifetimeSlot(block);
+	for (i = 0; i < MEM_STATS_LIFETIME_PROBES; i++)
+	{
+		mem_lifetime_sample_t *sample = &shard->lifetime[(slot + i) % MEM_STATS_LIFETIME_SLOTS];
+
+		if (sample->block == block)
+		{
+			sample->block = 0;
+			return sample->allocated;
+		}
+	}
+
+	return 0;
+}
+static __forceinline void Mem_LifetimeRecord(uint64_t allocated, uint64_t now)
+{
+	mem_thread_t *thread = g_thread;
+
+	if (allocated && thread)
+		Mem_HistogramAdd(&thread->stats.lifetime_cycles, (now ? now : Platform_Cycles()) - allocated);
+}
+static __forceinline void Mem_LifetimeClear(mem_shard_t *shard)
+{
+	memset(shard->lifetime, 0, sizeof(shard->lifetime));
+}
+#else
+static __forceinline uint64_t Mem_StatsStart()
+{
+	return 0;
+}
+static __forceinline void Mem_StatsMalloc(uint64_t start, size_t size, uint32_t alignment)
+{
+}
+static __forceinline void Mem_StatsRealloc(uint64_t start, size_t size, uint32_t alignment)
+{
+}
+static __forceinline void Mem_StatsFree(uint64_t start)
+{
+}
+static __forceinline void Mem_ShardLock(mem_shard_t *shard)
+{
+	Mutex_Lock(&shard->mutex);
+}
+static __forceinline void Mem_LifetimeStart(mem_shard_t *shard, malloc_block_t *block, uint64_t allocated)
+{
+}
+static __forceinline uint64_t Mem_LifetimeTake(mem_shard_t *shard, malloc_block_t *block)
+{
+	return 0;
+}
+static __forceinline void Mem_LifetimeRecord(uint64_t allocated, uint64_t now)
+{
+}
+static __forceinline void Mem_LifetimeClear(mem_shard_t *shard)
+{
+}
+#endif
+
+static void Mem_ThreadCacheFlushAll()
+{
+	mem_thread_t *thread;
+
+	for (thread = g_threads.head; thread; thread = thread->next)
+		Mem_ThreadCacheFlush(thread);
+}
+
+static int Mem_StackTrace_Snapshot(void **stack, int entries, int start_offset)
+{
+	return Platform_StackTrace_Snapshot(stack, entries, start_offset + 1);
+}
+
+static void Mem_FreeDanglingFail(void *memblock, int type)
+{
+	if (g_malloc.free_dangling_failure_fp)
+	{
+		size_t maxmem = Mem_MemoryLimit();
+		size_t usedmem = Mem_MemoryUsed();
+		size_t remaining;
+
+		Mutex_Lock(&g_malloc.mutex);
+
+		if (usedmem > maxmem)
+			remaining = 0;
+		else
+			remaining = maxmem - usedmem;
+
+		if (g_malloc.free_dangling_failure_fp)	// needed because the pointer might've changed after the if but before the lock was acquired
+			g_malloc.free_dangling_failure_fp(type, memblock, maxmem, remaining);
+
+		Mutex_Unlock(&g_malloc.mutex);
+	}
+}
+
+static void Mem_TagFail(size_t size, int tag)
+{
+	if (g_malloc.malloc_failure_fp)
+	{
+		size_t maxmem = (size_t)g_malloc.tag[tag].limit;
+		size_t usedmem = (size_t)g_malloc.tag[tag].used;
+		size_t remaining;
+
+		Mutex_Lock(&g_malloc.mutex);
+
+		if (usedmem > maxmem)
+			remaining = 0;
+		else
+			remaining = maxmem - usedmem;
+
+		if (g_malloc.malloc_failure_fp)	// needed because the pointer might've changed after the if but before the lock was acquired
+			g_malloc.malloc_failure_fp(size, maxmem, remaining);
+
+		Mutex_Unlock(&g_malloc.mutex);
+	}
+}
+
+static void Mem_MallocFail(size_t size)
+{
+	if (g_malloc.malloc_failure_fp)
+	{
+		size_t maxmem = Mem_MemoryLimit();
+		size_t usedmem = Mem_MemoryUsed();
+		size_t remaining;
+
+		Mutex_Lock(&g_malloc.mutex);
+
+		if (usedmem > maxmem)
+			remaining = 0;
+		else
+			remaining = maxmem - usedmem;
+
+		if (g_malloc.malloc_failure_fp)	// needed because the pointer might've changed after the if but before the lock was acquired
+			g_malloc.malloc_failure_fp(size, maxmem, remaining);
+
+		Mutex_Unlock(&g_malloc.mutex);
+	}
+}
+// Calls the reclaim callbacks in order of priority until usage is down to target. No lock of ours is held while they run,
+// so they can free (and allocate), but only one thread runs them at a time.
+static void Mem_Reclaim(int level, size_t target)
+{
+	mem_reclaimer_t reclaimer[MEM_MAX_RECLAIMERS];
+	size_t used;
+	int count;
+	int i;
+
+	if (g_thread_reclaiming)
+		return;
+
+	Mutex_Lock(&g_malloc.reclaim_mutex);
+	g_thread_reclaiming = 1;
+
+	// a copy, so that callbacks can be added meanwhile, even by the callbacks themselves
+	Mutex_Lock(&g_malloc.mutex);
+	count = g_malloc.num_reclaimers;
+	memcpy(reclaimer, g_malloc.reclaimer, sizeof(mem_reclaimer_t) * count);
+	Mutex_Unlock(&g_malloc.mutex);
+
+	for (i = 0; i < count && (used = Mem_MemoryUsed()) > target; i++)
+	{
+		reclaimer[i].reclaim_fp(level, used - target, reclaimer[i].context);
+
+		// whatever the callback freed is sitting in this thread's cache, still charged
+		if (g_thread)
+			Mem_ThreadCacheFlush(g_thread);
+	}
+
+	g_thread_reclaiming = 0;
+	Mutex_Unlock(&g_malloc.reclaim_mutex);
+}
+static void Mem_ReclaimThreadMain(void *arg)
+{
+	while (!g_malloc.reclaim_stop)
+	{
+		size_t soft = g_malloc.soft_watermark;
+
+		if (!g_malloc.reclaim_requested)
+		{
+			Platform_Wait(&g_malloc.reclaim_requested, 0, -1);
+			continue;
+		}
+
+		if (soft)
+			Mem_Reclaim(MEM_RECLAIM_SOFT, soft);
+
+		// still over means the callbacks have nothing more to give for now, so don't spin on them
+		if (soft && Mem_MemoryUsed() > soft)
+			Platform_Wait(&g_malloc.reclaim_stop, 0, MEM_RECLAIM_RETRY_MS);
+		else
+			Atomic_Exchange32(&g_malloc.reclaim_requested, 0);
+	}
+}
+// Started on first use, returns nonzero once it's running
+static int Mem_ReclaimThreadStart()
+{
+	if (g_malloc.reclaim_thread_state == 0 && Atomic_CompareExchange32(&g_malloc.reclaim_thread_state, 1, 0) == 0)
+		Atomic_Exchange32(&g_malloc.reclaim_thread_state, Platform_ThreadCreate(&g_malloc.reclaim_thread, Mem_ReclaimThreadMain, 0) ? 3 : 2);
+
+	return g_malloc.reclaim_thread_state == 2;
+}
+static void Mem_ReclaimThreadStop()
+{
+	if (g_malloc.reclaim_thread_state != 2)
+		return;
+
+	// requested as well, in case the thread is just about to wait on it
+	Atomic_Exchange32(&g_malloc.reclaim_stop, 1);
+	Atomic_Exchange32(&g_malloc.reclaim_requested, 1);
+	Platform_WakeAll(&g_malloc.reclaim_requested);
+	Platform_WakeAll(&g_malloc.reclaim_stop);
+	Platform_ThreadJoin(&g_malloc.reclaim_thread);
+	g_malloc.reclaim_thread_state = 0;
+	g_malloc.reclaim_stop = 0;
+	g_malloc.reclaim_requested = 0;
+}
+// Over the hard watermark the callbacks run right away on the allocating thread, over the soft one the reclaim thread
+// is woken for them
+static void Mem_ReclaimWatermarks()
+{
+	size_t soft = g_malloc.soft_watermark;
+	size_t hard = g_malloc.hard_watermark;
+	size_t used;
+
+	if (g_thread_reclaiming)
+		return;
+
+	used = Mem_MemoryUsed();
+	if (hard && used > hard)
+		Mem_Reclaim(MEM_RECLAIM_HARD, soft && soft < hard ? soft : hard);
+	else if (soft && used > soft && !g_malloc.reclaim_requested)
+	{
+		if (!Mem_ReclaimThreadStart())
+		{
+			// nowhere else to run them
+			if (g_malloc.reclaim_thread_state == 3)
+				Mem_Reclaim(MEM_RECLAIM_SOFT, soft);
+		}
+		else if (Atomic_Exchange32(&g_malloc.reclaim_requested, 1) == 0)
+			Platform_WakeAll(&g_malloc.reclaim_requested);
+	}
+}
+// Called with no lock held after memory was charged. Below the watermarks, this is all it costs.
+static __forceinline void Mem_CheckWatermarks()
+{
+	int64_t trigger = g_malloc.reclaim_trigger;
+
+	if (trigger && g_malloc.memory_used > trigger)
+		Mem_ReclaimWatermarks();
+}
+// An allocation of bytes is about to fail for lack of memory. Gives the reclaim callbacks a chance to make room, and
+// returns nonzero if they were run, in which case it's worth trying again.
+static int Mem_ReclaimBeforeFail(size_t bytes)
+{
+	size_t limit = Mem_MemoryLimit();
+	size_t used;
+
+	if (!g_malloc.num_reclaimers || g_thread_reclaiming)
+		return 0;
+
+	// over the limit, or the C runtime or the OS ran out, in which case only what's freed can come back
+	used = Mem_MemoryUsed();
+	if (limit < used + bytes && limit >= bytes)
+		Mem_Reclaim(MEM_RECLAIM_LIMIT, limit - bytes);
+	else
+		Mem_Reclaim(MEM_RECLAIM_LIMIT, used > bytes ? used - bytes : 0);
+
+	return 1;
+}
+
+static void Mem_PrintStack(void **stack, int entries)
+{
+	int i;
+
+	for (i = entries - 1; i >=0; i--)
+	{
+		const symbol_t *symbol = SymbolCache_Resolve(stack[i]);
+		int j;
+
+		for (j = 0; j < entries - 1 - i; j++)
+			printf(" ");
+		printf("%s:%s():%i\n", symbol && symbol->file ? symbol->file : "<NULL>", symbol && symbol->function ? symbol->function : "<NULL>", symbol ? symbol->line : 0);
+	}
+}
+
+// What a walk gets to see of a block, copied out of the registry so it can be looked at without holding the shard lock
+typedef struct mem_snapshot_block_s
+{
+	void			*memblock;				// may have been freed since it was copied
+	size_t			memsize;
+	uint32_t		callsite;
+	uint32_t		generation;
+}mem_snapshot_block_t;
+
+typedef struct mem_snapshot_s
+{
+	mem_snapshot_block_t	*block;
+	size_t					count;
+	size_t					capacity;
+}mem_snapshot_t;
+
+static int Mem_WalkRegistrySnapshot(void *value, void *context)
+{
+	malloc_block_t *ptr = (malloc_block_t*)value;
+	mem_snapshot_t *snapshot = (mem_snapshot_t*)context;
+	mem_snapshot_block_t *block = &snapshot->block[snapshot->count++];
+
+	block->memblock = &ptr[1];
+	block->memsize = ptr->memsize;
+	block->callsite = ptr->callsite;
+	block->generation = Mem_BlockGeneration(ptr);
+
+	return 0;
+}
+
+// Calls callback_fp for every live block, stopping early if it returns nonzero. The shards are copied one at a time, each
+// in a single short critical section, and the callback runs with no lock held, so it can take as long as it likes and
+// even allocate and free. Every block is seen as it was at some point during the walk. Returns nonzero if the copy
+// couldn't be allocated.
+static int Mem_WalkSnapshot(void *context, int (*callback_fp)(const mem_snapshot_block_t *block, void *context))
+{
+	mem_snapshot_t snapshot = {0, 0, 0};
+	int i;
+
+	for (i = 0; i < MEM_NUM_SHARDS; i++)
+	{
+		mem_shard_t *shard = &g_malloc.shard[i];
+		size_t j;
+
+		Mem_ShardLock(shard);
+		while (shard->registry.count > snapshot.capacity)
+		{
+			// never allocate under the lock, the shard may have grown again once it's retaken
+			size_t capacity = shard->registry.count + shard->registry.count / 4;
+			mem_snapshot_block_t *block;
+
+			Mutex_Unlock(&shard->mutex);
+			block = realloc(snapshot.block, capacity * sizeof(mem_snapshot_block_t));
+			if (!block)
+			{
+				free(snapshot.block);
+				Mem_MallocFail(capacity * sizeof(mem_snapshot_block_t));
+
+				return -1;
+			}
+			snapshot.block = block;
+			snapshot.capacity = capacity;
+			Mem_ShardLock(shard);
+		}
+		snapshot.count = 0;
+		HashTable_Walk(&shard->registry, &snapshot, Mem_WalkRegistrySnapshot);
+		Mutex_Unlock(&shard->mutex);
+
+		for (j = 0; j < snapshot.count; j++)
+		{
+			if (callback_fp(&snapshot.block[j], context))
+			{
+				free(snapshot.block);
+				return 0;
+			}
+		}
+	}
+
+	free(snapshot.block);
+
+	return 0;
+}
+
+typedef struct mem_walk_s
+{
+	void			*context;
+	int				(*callback_fp)(const mem_block_info_t *block, void *context);
+}mem_walk_t;
+
+static int Mem_WalkSnapshotInfo(const mem_snapshot_block_t *block, void *context)
+{
+	mem_walk_t *walk = (mem_walk_t*)context;
+	const call_site_t *site = CallSite_Get(block->callsite);
+	mem_block_info_t info;
+
+	info.memblock = block->memblock;
+	info.size = block->memsize;
+	info.file = site->file;
+	info.function = site->function;
+	info.line = site->line;
+	info.tag = site->tag;
+	info.stack_entries = StackDepot_Get(site->stack_id, &info.stack);
+	if (!info.stack_entries)
+		info.stack = 0;
+	info.sample_rate = site->sample_rate;
+	info.generation = block->generation;
+
+	return walk->callback_fp(&info, walk->context);
+}
+
+typedef struct mem_report_totals_s
+{
+	uint32_t		since;					// generation of the oldest blocks to report
+	size_t			total;
+	size_t			tag_bytes[MEM_MAX_TAGS];	// per tag, rolled up into the parents once the walk is done
+	size_t			tag_blocks[MEM_MAX_TAGS];
+}mem_report_totals_t;
+
+static int Mem_WalkBlockPrint(const mem_block_info_t *block, void *context)
+{
+	mem_report_totals_t *totals = (mem_report_totals_t*)context;
+
+	if (block->generation < totals->since)
+		return 0;
+
+	totals->total += block->size;
+	totals->tag_bytes[block->tag] += block->size;
+	totals->tag_blocks[block->tag]++;
+
+	printf("Block of size %zu (%zu) allocated at %s:%s():%i 0x%p\n", block->size, block->size + sizeof(malloc_block_t), block->file ? block->file : "<NULL>", block->function ? block->function : "<NULL>", block->line, (void*)&((malloc_block_t*)block->memblock)[-1]);
+
+	Mem_PrintStack(block->stack, block->stack_entries);
+
+	return 0;
+}
+
+// Returns the number of blocks of this size that a sampled one stands for. A block of size bytes is sampled with
+// probability 1 - exp(-size / rate), so weighting by its inverse keeps the estimated live bytes unbiased regardless of
+// block size.
+static double Mem_SampleWeight(size_t size, size_t rate)
+{
+	return 1.0 / -expm1(-(double)(size ? size : 1) / (double)rate);
+}
+
+typedef struct mem_sample_totals_s
+{
+	uint32_t		num_stacks;
+	double			*bytes;					// indexed by stack id, 0 collects sampled blocks without a stack
+	double			*blocks;
+}mem_sample_totals_t;
+
+static int Mem_WalkSnapshotSample(const mem_snapshot_block_t *block, void *context)
+{
+	mem_sample_totals_t *totals = (mem_sample_totals_t*)context;
+	const call_site_t *site = CallSite_Get(block->callsite);
+	uint32_t id = site->stack_id;
+	double weight;
+
+	if (site->sample_rate == 0)
+		return 0;
+
+	if (id > totals->num_stacks)	// interned after the report started
+		id = 0;
+
+	weight = Mem_SampleWeight(block->memsize, site->sample_rate);
+	totals->bytes[id] += weight * (double)block->memsize;
+	totals->blocks[id] += weight;
+
+	return 0;
+}
+
+typedef struct mem_profile_totals_s
+{
+	uint32_t		num_sites;
+	int64_t			*bytes;					// indexed by call-site id, 0 collects blocks without one or interned after the walk started
+	int64_t			*blocks;
+}mem_profile_totals_t;
+
+static int Mem_WalkSnapshotProfile(const mem_snapshot_block_t *block, void *context)
+{
+	mem_profile_totals_t *totals = (mem_profile_totals_t*)context;
+	uint32_t id = block->callsite;
+
+	if (id > totals->num_sites)
+		id = 0;
+
+	totals->bytes[id] += (int64_t)block->memsize;
+	totals->blocks[id]++;
+
+	return 0;
+}
+
+// Returns the depot id of the caller's stack, or 0 if entries is zero
+static uint32_t Mem_PerformStackTrace(int entries)
+{
+	void **stack;
+
+	if (entries == 0)
+		return 0;
+
+	stack = _alloca(sizeof(void*) * entries);
+	entries = Mem_StackTrace_Snapshot(stack, entries, STACKTRACE_START_OFFSET);
+
+	return StackDepot_Intern(stack, entries);
+}
+
+// Draws the distance to the next sampled byte from an exponential distribution with the given mean, so sampling is a
+// Poisson process over allocated bytes and every byte has the same chance of being sampled.
+static int64_t Mem_SampleInterval(mem_thread_t *thread, size_t rate)
+{
+	uint64_t x = thread->sample_rng;
+	double u;
+
+	// xorshift64*
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	thread->sample_rng = x;
+	x *= 0x2545F4914F6CDD1Dull;
+
+	u = ((double)(x >> 11) + 1.0) / 9007199254740993.0;	// (0, 1]
+
+	return (int64_t)(-log(u) * (double)rate) + 1;
+}
+
+// Returns nonzero if an allocation of size bytes is to be sampled
+static int Mem_Sample(size_t size, size_t rate)
+{
+	mem_thread_t *thread = Mem_Thread();
+
+	if (!thread)
+		return 0;
+
+	if (!thread->sample_rng)
+	{
+		thread->sample_rng = ((uint64_t)(uintptr_t)thread * 0x9E3779B97F4A7C15ull) | 1;
+		thread->sample_bytes_left = Mem_SampleInterval(thread, rate);
+	}
+
+	thread->sample_bytes_left -= (int64_t)size;
+	if (thread->sample_bytes_left >= 0)
+		return 0;
+
+	thread->sample_bytes_left = Mem_SampleInterval(thread, rate);
+
+	return 1;
+}
+
+// Returns the id of the call site, reusing the calling thread's previous one if it's the same
+static uint32_t Mem_InternCallSite(const call_site_t *site)
+{
+	mem_thread_t *thread = g_thread;
+	call_site_t *last;
+	uint32_t id;
+
+	if (thread && thread->last_site_id)
+	{
+		last = &thread->last_site;
+		if (last->file == site->file && last->function == site->function && last->line == site->line && last->tag == site->tag && last->stack_id == site->stack_id && last->sample_rate == site->sample_rate)
+			return thread->last_site_id;
+	}
+
+	id = CallSite_Intern(site);
+	if (thread && id)
+	{
+		thread->last_site = *site;
+		thread->last_site_id = id;
+	}
+
+	return id;
+}
+
+static void Mem_DestroyCB(void *value, void *context)
+{
+	malloc_block_t *ptr = (malloc_block_t*)value;
+
+	size_t allocsize = Mem_BlockAllocSize(ptr);
+
+	Mem_SiteStatsFree(ptr->callsite, Mem_BlockGeneration(ptr), ptr->memsize);
+	Mem_Release(allocsize);
+	Mem_TagUncharge(Mem_BlockTag(ptr), MEM_TAG_NONE, allocsize);
+	Mem_ReleaseBase(Mem_BlockBase(ptr), ptr->size_class, allocsize);
+}
+
+// Registry helpers, only called when the shard mutex is already locked. The registry's own storage is charged against
+// the limit in the same way the block overheads are, so inserting a new block fails if the registry can't grow within
+// it. Putting back a block that's being moved is always allowed to grow it, since that block was already admitted.
+static int Mem_RegistryInsert(mem_shard_t *shard, malloc_block_t *block, int reinsert)
+{
+	size_t growth = HashTable_InsertCost(&shard->registry);
+
+	if (growth && reinsert)
+		Mem_UpdatePeak(Atomic_Add64(&g_malloc.memory_used, (int64_t)growth) + (int64_t)growth);
+	else if (growth && Mem_Reserve(growth))
+		return -1;
+
+	if (HashTable_Insert(&shard->registry, block))
+	{
+		Mem_Release(growth);
+		return -1;
+	}
+
+	return 0;
+}
+static int Mem_RegistryDelete(mem_shard_t *shard, malloc_block_t *block)
+{
+	size_t old_size = HashTable_MemUsed(&shard->registry);
+	int ret = HashTable_Delete(&shard->registry, block);
+
+	Mem_Release(old_size - HashTable_MemUsed(&shard->registry));
+
+	return ret;
+}
+static void Mem_RegistryDestroy(mem_shard_t *shard)
+{
+	Mem_Release(HashTable_MemUsed(&shard->registry));
+	HashTable_Destroy(&shard->registry, shard, Mem_DestroyCB);
+	Mem_LifetimeClear(shard);
+}
+
+// Makes the presence map storage at slot, if no other thread beat us to it. It's charged like the registry's storage
+// is when putting a block back, without ever being refused. Returns what's in slot, 0 if nothing could be made.
+static void *Mem_PresenceMake(void * volatile *slot, size_t size)
+{
+	void *made;
+	void *current;
+
+	if ((current = *slot) != 0)
+		return current;
+
+	made = Platform_MapPages(size, Platform_PageSize(), 0, 0);
+	if (!made)
+		return 0;
+	if ((current = Atomic_CompareExchangePtr(slot, made, 0)) != 0)
+	{
+		Platform_UnmapPages(made, size);
+		return current;
+	}
+	Mem_UpdatePeak(Atomic_Add64(&g_malloc.memory_used, (int64_t)size) + (int64_t)size);
+
+	return made;
+}
+// The word holding the presence bit of a header address, and the bit within it. Returns 0 for an address the map can't
+// hold, or if its bitmap doesn't exist and create is zero (or it couldn't be made).
+static volatile int64_t *Mem_PresenceWord(malloc_block_t *block, int create, int64_t *bit)
+{
+	uintptr_t address = (uintptr_t)block;
+	mem_presence_node_t *node;
+	mem_presence_leaf_t *leaf;
+	size_t index;
+
+	if (address % ((uintptr_t)1 << MEM_PRESENCE_GRANULARITY_LOG2) || (uint64_t)address >> MEM_PRESENCE_ADDRESS_LOG2)
+		return 0;
+
+	node = g_malloc.presence[address >> MEM_PRESENCE_NODE_LOG2];
+	if (!node && (!create || (node = Mem_PresenceMake((void * volatile*)&g_malloc.presence[address >> MEM_PRESENCE_NODE_LOG2], sizeof(mem_presence_node_t))) == 0))
+		return 0;
+
+	index = (address >> MEM_PRESENCE_LEAF_LOG2) & (MEM_PRESENCE_NODE_SIZE - 1);
+	leaf = node->leaf[index];
+	if (!leaf && (!create || (leaf = Mem_PresenceMake((void * volatile*)&node->leaf[index], sizeof(mem_presence_leaf_t))) == 0))
+		return 0;
+
+	index = (address & (((uintptr_t)1 << MEM_PRESENCE_LEAF_LOG2) - 1)) >> MEM_PRESENCE_GRANULARITY_LOG2;
+	*bit = (int64_t)1 << (index & 63);
+
+	return &leaf->bits[index / 64];
+}
+// Marks an untracked block live. Returns nonzero if the map can't hold it, in which case it has to go in the registry.
+static int Mem_PresenceSet(malloc_block_t *block)
+{
+	int64_t bit;
+	volatile int64_t *word = Mem_PresenceWord(block, 1, &bit);
+
+	if (!word)
+		return -1;
+	Atomic_Or64(word, bit);
+
+	return 0;
+}
+// Marks an untracked block no longer live. Returns nonzero if it was, so only one of two threads freeing it succeeds.
+static int Mem_PresenceClear(malloc_block_t *block)
+{
+	int64_t bit;
+	volatile int64_t *word = Mem_PresenceWord(block, 0, &bit);
+
+	return word && (*word & bit) && (Atomic_And64(word, ~bit) & bit);
+}
+static int Mem_PresenceTest(malloc_block_t *block)
+{
+	int64_t bit;
+	volatile int64_t *word = Mem_PresenceWord(block, 0, &bit);
+
+	return word && (*word & bit);
+}
+static void Mem_PresenceDestroy()
+{
+	size_t i;
+	size_t j;
+
+	for (i = 0; i < MEM_PRESENCE_ROOT_SIZE; i++)
+	{
+		mem_presence_node_t *node = g_malloc.presence[i];
+
+		if (!node)
+			continue;
+		for (j = 0; j < MEM_PRESENCE_NODE_SIZE; j++)
+		{
+			if (node->leaf[j])
+				Platform_UnmapPages(node->leaf[j], sizeof(mem_presence_leaf_t));
+		}
+		Platform_UnmapPages(node, sizeof(mem_presence_node_t));
+	}
+}
+
+static void Mem_OnMallocFailDefault(size_t allocation_size, size_t max_memory, size_t memory_remaining)
+{
+	void *stack[STACKTRACE_ONFAIL_MAX_DEPTH];
+	int entries = STACKTRACE_ONFAIL_MAX_DEPTH;
+	
+	printf("Failed to allocate %zu bytes (%zu total available, %zu remaining)\n", allocation_size, max_memory, memory_remaining);
+
+	entries = Mem_StackTrace_Snapshot(stack, entries, STACKTRACE_MALLOC_FAIL_OFFSET);
+
+	Mem_PrintStack(stack, entries);
+
+	fflush(stdout);
+	fflush(stderr);
+
+	*(int*)0 = 0;
+}
+static void Mem_OnFreeDanglingDefault(int type, void *old_block, size_t max_memory, size_t memory_remaining)
+{
+	void *stack[STACKTRACE_ONFAIL_MAX_DEPTH];
+	int entries = STACKTRACE_ONFAIL_MAX_DEPTH;
+
+	if (type == FREE_FAILURE_SIZE)
+		printf("Attempted to free 0x%p with the wrong size\n", old_block);
+	else if (type == FREE_FAILURE_CORRUPT)
+		printf("Attempted to free 0x%p, which isn't a block or has a corrupted header\n", old_block);
+	else
+		printf("Attempted to free dangling pointer 0x%p\n", old_block);
+
+	entries = Mem_StackTrace_Snapshot(stack, entries, STACKTRACE_FREE_FAIL_OFFSET);
+
+	Mem_PrintStack(stack, entries);
+
+
+	fflush(stdout);
+	fflush(stderr);
+
+	*(int*)0 = 0;
+}
+
+void Mem_Init()
+{
+	int i;
+
+	// only the first call does anything until Mem_Destroy, so that code running before main can initialize on demand
+	if (Atomic_CompareExchange32(&g_malloc.initialized, 1, 0) != 0)
+	{
+		while (g_malloc.initialized != 2)
+			;
+		return;
+	}
+
+	Mutex_Init(&g_malloc.mutex);
+	if (g_threads.thread_key == THREAD_KEY_INVALID)
+		g_threads.thread_key = Platform_ThreadKeyCreate(Mem_ThreadDetach);
+	for (i = 0; i < MEM_NUM_SHARDS; i++)
+	{
+		Mutex_Init(&g_malloc.shard[i].mutex);
+		HashTable_Init(&g_malloc.shard[i].registry);
+	}
+	for (i = 0; i < MEM_TCACHE_NUM_CLASSES; i++)
+	{
+		Mutex_Init(&g_malloc.slab[i].mutex);
+		g_malloc.slab[i].partial = 0;
+	}
+	Platform_Init();
+	if (g_cookie_key == 0)
+	{
+		// kept across Mem_Destroy, there's no need for a new one
+		uint64_t key = Platform_Cycles() ^ (uint64_t)(uintptr_t)&key ^ ((uint64_t)(uintptr_t)&g_malloc << 16);
+
+		key = (key ^ (key >> 31)) * 0x9E3779B97F4A7C15ull;
+		g_cookie_key = key ^ (key >> 29);
+	}
+	g_malloc.malloc_failure_fp = Mem_OnMallocFailDefault;
+	g_malloc.free_dangling_failure_fp = Mem_OnFreeDanglingDefault;
+	Atomic_Exchange32(&g_malloc.initialized, 2);
+}
+
+size_t Mem_MemSize(void *memblock)
+{
+	malloc_block_t *ptr;
+
+	if (!memblock)
+		return 0;
+
+	ptr = &((malloc_block_t*)memblock)[-1];
+
+	return ptr->memsize;
+}
+size_t Mem_BlockTotalMemUsed(void *memblock)
+{
+	if (!memblock)
+		return 0;
+
+	return Mem_BlockAllocSize(&((malloc_block_t*)memblock)[-1]);
+}
+
+// Makes the underlying allocation of a block and lays out its header, charged to the limit and to tag, but without a
+// call site and not yet registered. Failures are reported here.
+static malloc_block_t *Mem_NewBlock(int tag, size_t size, uint32_t alignment)
+{
+	malloc_block_t *ptr;
+	malloc_block_t *ptr_offset;
+	uintptr_t offset;
+	size_t allocsize;
+	size_t tag_charge;
+	int size_class;
+	int over_tag;
+	int large;
+	int attempt;
+
+	if (Mem_SizeOverflows(size, alignment))
+	{
+		Mem_MallocFail(size);
+
+		return 0;
+	}
+#ifdef MEM_COMPACT_HEADER
+	if ((uint64_t)size > MEM_COMPACT_MAX_SIZE)
+	{
+		Mem_MallocFail(size);
+
+		return 0;
+	}
+#endif
+
+	allocsize = size + sizeof(malloc_block_t) + alignment - 1;
+	large = Mem_IsLarge(allocsize);
+	size_class = large ? 0 : Mem_SizeClass(allocsize);
+	ptr = 0;
+
+	if (size_class)
+		allocsize = (size_t)size_class * MEM_TCACHE_GRANULARITY;	// round up so that any block of the class can serve any request mapping to it
+	if (large && (allocsize = Mem_LargeSize(size, alignment)) == 0)
+	{
+		Mem_MallocFail(size);
+
+		return 0;
+	}
+
+	// the tag budgets are checked first, so a component over its budget never touches the process-wide limit
+	tag_charge = allocsize;
+	if (tag != MEM_TAG_NONE && (over_tag = Mem_TagCharge(tag, tag_charge)) != 0)
+	{
+		Mem_TagFail(size, over_tag);
+
+		return 0;
+	}
+
+	if (size_class)
+	{
+		ptr = Mem_ThreadCachePop(size_class, &size_class);
+		if (ptr == 0 && g_malloc.slab_enabled && MEM_SLAB_ALIGNMENT % alignment == 0 && sizeof(malloc_block_t) % alignment == 0)
+		{
+			// slots are already aligned, so only the header has to fit in front of the data
+			int slab_class = Mem_SizeClass(size + sizeof(malloc_block_t));
+			size_t slab_size = (size_t)slab_class * MEM_TCACHE_GRANULARITY;
+
+			if (Mem_Charge(slab_size) == 0)
+			{
+				ptr = Mem_SlabAlloc(slab_class);
+				if (ptr)
+				{
+					size_class = slab_class | MEM_SIZE_CLASS_SLAB;
+					allocsize = slab_size;
+				}
+				else
+					Mem_Uncharge(slab_size);
+			}
+		}
+	}
+
+	for (attempt = 0; ptr == 0 && attempt < 2; attempt++)
+	{
+		int charged;
+
+		// out of memory, so the reclaim callbacks get one chance to make room
+		if (attempt && !Mem_ReclaimBeforeFail(allocsize))
+			break;
+
+		// the bytes are reserved before the allocation is made, so concurrent threads can never overshoot the limit
+		charged = Mem_Charge(allocsize) == 0;
+		if (!charged && g_thread && g_thread->cache_bytes)
+		{
+			// our own cached blocks count towards the limit, so give them back before failing
+			Mem_ThreadCacheFlush(g_thread);
+			charged = Mem_Charge(allocsize) == 0;
+		}
+
+		if (charged)
+		{
+			ptr = large ? Mem_LargeMap(allocsize, alignment) : malloc(allocsize);
+			if (ptr == 0)
+				Mem_Uncharge(allocsize);
+			else if (large)
+				size_class = MEM_SIZE_CLASS_LARGE;
+		}
+	}
+
+	if (ptr == 0)
+	{
+		Mem_TagUncharge(tag, MEM_TAG_NONE, tag_charge);
+		Mem_MallocFail(size);
+
+		return 0;
+	}
+	if (allocsize < tag_charge)
+		Mem_TagUncharge(tag, MEM_TAG_NONE, tag_charge - allocsize);
+
+	offset = (uintptr_t)ptr;
+	offset = ((offset + sizeof(malloc_block_t) + alignment - 1) / alignment) * alignment;
+
+	offset -= sizeof(malloc_block_t);
+	ptr_offset = (malloc_block_t*)offset;
+
+	Mem_BlockSetLayout(ptr_offset, (char*)ptr, allocsize, size);
+	ptr_offset->size_class = size_class;
+	if (Mem_BlockAllocSize(ptr_offset) < allocsize)
+	{
+		// the compact header couldn't hold all of the slack, so charge what it records
+		Mem_Uncharge(allocsize - Mem_BlockAllocSize(ptr_offset));
+		Mem_TagUncharge(tag, MEM_TAG_NONE, allocsize - Mem_BlockAllocSize(ptr_offset));
+	}
+	Mem_CheckWatermarks();
+
+	return ptr_offset;
+}
+// Undoes Mem_NewBlock
+static void Mem_DiscardBlock(malloc_block_t *block, int tag)
+{
+	size_t allocsize = Mem_BlockAllocSize(block);
+
+	Mem_ReleaseBase(Mem_BlockBase(block), block->size_class, allocsize);
+	Mem_Uncharge(allocsize);
+	Mem_TagUncharge(tag, MEM_TAG_NONE, allocsize);
+}
+
+void *Mem_MallocTagged_IMP(int tag, size_t size, uint32_t alignment, const char *file, const char *function, int line)
+{
+	malloc_block_t *ptr_offset;
+	mem_shard_t *shard;
+	call_site_t site;
+	size_t rate;
+	uint64_t start = Mem_StatsStart();
+
+	if (alignment < 1)
+		alignment = 1;
+	if (tag < 0 || tag > g_malloc.num_tags)
+		tag = MEM_TAG_NONE;
+
+	ptr_offset = Mem_NewBlock(tag, size, alignment);
+	if (!ptr_offset)
+		return 0;
+
+	site.file = file;
+	site.function = function;
+	site.line = line;
+	site.tag = tag;
+	site.stack_id = 0;
+	site.sample_rate = 0;
+	Mem_BlockSetGeneration(ptr_offset, Mem_CurrentGeneration());
+
+	rate = g_malloc.sample_rate;
+	if (rate == 0)
+		site.stack_id = Mem_PerformStackTrace(g_malloc.backtrace_max_depth);
+	else if (Mem_Sample(size, rate))
+	{
+		site.sample_rate = rate;
+		site.stack_id = Mem_PerformStackTrace(g_malloc.backtrace_max_depth ? g_malloc.backtrace_max_depth : STACKTRACE_SAMPLE_DEFAULT_DEPTH);
+	}
+	ptr_offset->callsite = Mem_InternCallSite(&site);
+
+	// a block that lost its call site would also lose track of its tag
+	if (ptr_offset->callsite == 0 && tag != MEM_TAG_NONE)
+	{
+		Mem_DiscardBlock(ptr_offset, tag);
+		Mem_MallocFail(size);
+
+		return 0;
+	}
+
+	if (g_malloc.untracked && Mem_PresenceSet(ptr_offset) == 0)
+		Mem_BlockSeal(ptr_offset, MEM_BLOCK_UNTRACKED);
+	else
+	{
+		Mem_BlockSeal(ptr_offset, MEM_BLOCK_TRACKED);
+		shard = Mem_Shard(ptr_offset);
+
+		Mem_ShardLock(shard);
+		if (Mem_RegistryInsert(shard, ptr_offset, 0))
+		{
+			Mutex_Unlock(&shard->mutex);
+			Mem_DiscardBlock(ptr_offset, tag);
+			Mem_MallocFail(size);
+
+			return 0;
+		}
+		Mem_LifetimeStart(shard, ptr_offset, start);
+		Mutex_Unlock(&shard->mutex);
+	}
+
+	Mem_SiteStatsAlloc(ptr_offset->callsite, Mem_BlockGeneration(ptr_offset), size);
+	Mem_StatsMalloc(start, size, alignment);
+
+	return &ptr_offset[1];
+}
+void *Mem_MallocAligned_IMP(size_t size, uint32_t alignment, const char *file, const char *function, int line)
+{
+	return Mem_MallocTagged_IMP(g_thread_tag, size, alignment, file, function, line);
+}
+// reclaim is zero on the retry after the reclaim callbacks ran
+static void *Mem_ReallocBlock(void *ptr, size_t size, uint32_t alignment, const char *file, const char *function, int line, int reclaim)
+{
+	malloc_block_t *old_ptr;
+	malloc_block_t *new_ptr;
+	mem_shard_t *shard;
+	void *memblock;
+	char *base;
+	size_t allocsize;
+	size_t old_total;
+	size_t copysize;
+	uintptr_t old_offset;
+	uintptr_t new_offset;
+	call_site_t site;
+	uint32_t callsite;
+	uint32_t old_callsite;
+	uint32_t generation;
+	uint32_t old_generation;
+	size_t old_memsize;
+	uint64_t start;
+	uint64_t allocated;
+	int tag;
+	int over_tag;
+	int remap;
+	int restored;
+	int state;
+
+	if (!ptr)
+		return Mem_MallocAligned_IMP(size, alignment, file, function, line);
+
+	start = Mem_StatsStart();
+
+	if (alignment < 1)
+		alignment = 1;
+
+	// nothing is touched, so the block stays as it was
+	if (Mem_SizeOverflows(size, alignment))
+	{
+		Mem_MallocFail(size);
+
+		return 0;
+	}
+
+	old_ptr = &((malloc_block_t*)ptr)[-1];
+	shard = Mem_Shard(old_ptr);
+	allocsize = size + sizeof(malloc_block_t) + alignment - 1;
+
+	// as in Mem_FreeBlock, the registry goes first, then the presence map, and the header is only read once one has it
+	Mem_ShardLock(shard);
+	if (HashTable_Contains(&shard->registry, old_ptr))
+		state = MEM_BLOCK_TRACKED;
+	else if (g_malloc.untracked_ever && Mem_PresenceTest(old_ptr))
+		state = MEM_BLOCK_UNTRACKED;
+	else
+	{
+		Mutex_Unlock(&shard->mutex);
+		Mem_FreeDanglingFail(ptr, FREE_FAILURE_DANGLING);
+
+		return 0;
+	}
+	if (Mem_BlockState(old_ptr) != state)
+	{
+		// dropped, as in Mem_FreeBlock, so that nothing goes by the header again
+		if (state == MEM_BLOCK_TRACKED)
+			Mem_RegistryDelete(shard, old_ptr);
+		else
+			Mem_PresenceClear(old_ptr);
+		Mutex_Unlock(&shard->mutex);
+		Mem_FreeDanglingFail(ptr, FREE_FAILURE_CORRUPT);
+
+		return 0;
+	}
+
+#ifdef MEM_COMPACT_HEADER
+	if ((uint64_t)size > MEM_COMPACT_MAX_SIZE)
+	{
+		Mutex_Unlock(&shard->mutex);
+		Mem_MallocFail(size);
+
+		return 0;
+	}
+#endif
+
+	// The block now belongs to this call site and generation, but keeps the backtrace, tag and sampling of the original
+	// allocation. If the new call site can't be recorded, it stays with the old one.
+	site = *CallSite_Get(old_ptr->callsite);
+	tag = site.tag;
+	site.file = file;
+	site.function = function;
+	site.line = line;
+	callsite = Mem_InternCallSite(&site);
+	if (callsite == 0)
+		callsite = old_ptr->callsite;
+	generation = Mem_CurrentGeneration();
+
+	old_total = Mem_BlockAllocSize(old_ptr);
+	old_memsize = old_ptr->memsize;
+	old_callsite = old_ptr->callsite;
+	old_generation = Mem_BlockGeneration(old_ptr);
+	base = Mem_BlockBase(old_ptr);
+
+	// A large block that stays large is remapped, keeping its data where it is in the mapping, as long as it needs no
+	// more than page alignment (which a moved mapping may not keep)
+	remap = old_ptr->size_class == MEM_SIZE_CLASS_LARGE && Mem_IsLarge(allocsize) && alignment <= Platform_PageSize() && (uintptr_t)ptr % alignment == 0;
+	if (remap)
+	{
+		size_t page = Platform_PageSize();
+		size_t lead = (size_t)((char*)ptr - base);
+
+		if (size > SIZE_MAX - lead - page)
+		{
+			Mutex_Unlock(&shard->mutex);
+			Mem_MallocFail(size);
+
+			return 0;
+		}
+		allocsize = (lead + size + page - 1) / page * page;
+	}
+
+	// Shrink, or grow into whatever the underlying allocation already has spare. A C runtime block that would be left
+	// mostly empty is resized below instead, so that the memory actually goes back, and a large block only stays put
+	// if it keeps exactly the pages it has.
+	if ((uintptr_t)ptr % alignment == 0 && size <= (size_t)(base + old_total - (char*)ptr) && Mem_BlockLayoutFits(old_ptr, old_total, size)
+		&& (old_ptr->size_class == MEM_SIZE_CLASS_LARGE ? remap && allocsize == old_total : old_ptr->size_class || allocsize >= old_total / 2))
+	{
+		Mem_BlockSetLayout(old_ptr, base, old_total, size);
+		old_ptr->callsite = callsite;
+		Mem_BlockSetGeneration(old_ptr, generation);
+		Mem_BlockSeal(old_ptr, state);
+		if (state == MEM_BLOCK_TRACKED)
+		{
+			Mem_LifetimeRecord(Mem_LifetimeTake(shard, old_ptr), start);
+			Mem_LifetimeStart(shard, old_ptr, start);
+		}
+		Mutex_Unlock(&shard->mutex);
+
+		// a reallocation counts as a free at the old call site and an allocation at the new one
+		Mem_SiteStatsFree(old_callsite, old_generation, old_memsize);
+		Mem_SiteStatsAlloc(callsite, generation, size);
+		Mem_StatsRealloc(start, size, alignment);
+
+		return ptr;
+	}
+
+	if (old_ptr->size_class ? !remap : Mem_IsLarge(allocsize))
+	{
+		// small blocks are recycled by size class, so they can't be resized underneath, and a block only changes between
+		// the C runtime and a mapping of its own by moving; move them instead
+		Mutex_Unlock(&shard->mutex);
+
+		memblock = Mem_MallocTagged_IMP(tag, size, alignment, file, function, line);
+		if (memblock == 0)
+			return 0;
+
+		memcpy(memblock, ptr, old_memsize < size ? old_memsize : size);
+		Mem_Free_IMP(ptr, file, function, line);
+		Mem_StatsRealloc(start, size, alignment);
+
+		return memblock;
+	}
+
+	old_offset = (uintptr_t)((char*)old_ptr - base);
+	copysize = old_memsize < size ? old_memsize : size;
+
+	// the data has to survive the resize at its old offset, which can need more than the new alignment's slack
+	if (allocsize < old_offset + sizeof(malloc_block_t) + copysize)
+		allocsize = old_offset + sizeof(malloc_block_t) + copysize;
+
+	// Resize the underlying C runtime block or mapping, so only the difference is ever held twice (and large blocks are
+	// moved by remapping rather than copying). Only the growth is charged against the limits.
+	if (allocsize > old_total)
+	{
+		if ((over_tag = Mem_TagCharge(tag, allocsize - old_total)) != 0)
+		{
+			Mutex_Unlock(&shard->mutex);
+			Mem_TagFail(size, over_tag);
+
+			return 0;
+		}
+		if (Mem_Charge(allocsize - old_total))
+		{
+			Mutex_Unlock(&shard->mutex);
+			Mem_TagUncharge(tag, MEM_TAG_NONE, allocsize - old_total);
+			// nothing has changed yet, so start over once the reclaim callbacks have made room
+			if (reclaim && Mem_ReclaimBeforeFail(allocsize - old_total))
+				return Mem_ReallocBlock(ptr, size, alignment, file, function, line, 0);
+			Mem_MallocFail(size);
+
+			return 0;
+		}
+	}
+
+	// The block leaves the registry, or the presence map, while it's being moved, so nothing can walk over it or free it.
+	// Its header is marked freed, which is what it has to say if it moves.
+	if (state == MEM_BLOCK_TRACKED)
+	{
+		Mem_RegistryDelete(shard, old_ptr);
+		allocated = Mem_LifetimeTake(shard, old_ptr);
+	}
+	else
+	{
+		Mem_PresenceClear(old_ptr);
+		allocated = 0;
+	}
+	Mem_BlockSeal(old_ptr, MEM_BLOCK_FREED);
+	Mutex_Unlock(&shard->mutex);
+
+	base = remap ? (char*)Mem_LargeRemap(base, old_total, allocsize) : (char*)realloc(base, allocsize);
+	if (!base)
+	{
+		// the original block is untouched. Putting it back only fails if the registry couldn't grow, in which case the
+		// block stays valid but untracked.
+		if (allocsize > old_total)
+		{
+			Mem_Uncharge(allocsize - old_total);
+			Mem_TagUncharge(tag, MEM_TAG_NONE, allocsize - old_total);
+		}
+		Mem_BlockSeal(old_ptr, state);
+		Mem_ShardLock(shard);
+		restored = state == MEM_BLOCK_TRACKED ? !Mem_RegistryInsert(shard, old_ptr, 1) : !Mem_PresenceSet(old_ptr);
+		if (!restored)
+		{
+			Mem_Uncharge(old_total);
+			Mem_TagUncharge(tag, MEM_TAG_NONE, old_total);
+			Mem_SiteStatsFree(old_callsite, old_generation, old_memsize);
+		}
+		else if (allocated)
+			Mem_LifetimeStart(shard, old_ptr, allocated);
+		Mutex_Unlock(&shard->mutex);
+		if (restored && reclaim && Mem_ReclaimBeforeFail(allocsize))
+			return Mem_ReallocBlock(ptr, size, alignment, file, function, line, 0);
+		Mem_MallocFail(size);
+
+		return 0;
+	}
+	if (allocsize < old_total)
+	{
+		Mem_Uncharge(old_total - allocsize);
+		Mem_TagUncharge(tag, MEM_TAG_NONE, old_total - allocsize);
+	}
+
+	if (remap)
+		new_offset = old_offset;
+	else
+		new_offset = (((uintptr_t)base + sizeof(malloc_block_t) + alignment - 1) / alignment) * alignment - sizeof(malloc_block_t) - (uintptr_t)base;
+	if (new_offset != old_offset)
+		memmove(base + new_offset, base + old_offset, sizeof(malloc_block_t) + copysize);
+
+	new_ptr = (malloc_block_t*)(base + new_offset);
+	Mem_BlockSetLayout(new_ptr, base, allocsize, size);
+	new_ptr->callsite = callsite;
+	Mem_BlockSetGeneration(new_ptr, generation);
+	if (Mem_BlockAllocSize(new_ptr) < allocsize)
+	{
+		Mem_Uncharge(allocsize - Mem_BlockAllocSize(new_ptr));
+		Mem_TagUncharge(tag, MEM_TAG_NONE, allocsize - Mem_BlockAllocSize(new_ptr));
+		allocsize = Mem_BlockAllocSize(new_ptr);
+	}
+	if (state == MEM_BLOCK_UNTRACKED && Mem_PresenceSet(new_ptr))
+		state = MEM_BLOCK_TRACKED;	// somewhere the map can't hold it
+	Mem_BlockSeal(new_ptr, state);
+
+	if (state == MEM_BLOCK_TRACKED)
+	{
+		shard = Mem_Shard(new_ptr);
+
+		Mem_ShardLock(shard);
+		if (Mem_RegistryInsert(shard, new_ptr, 1))
+		{
+			Mutex_Unlock(&shard->mutex);
+			Mem_ReleaseBase(base, new_ptr->size_class, allocsize);
+			Mem_Uncharge(allocsize);
+			Mem_TagUncharge(tag, MEM_TAG_NONE, allocsize);
+			Mem_SiteStatsFree(old_callsite, old_generation, old_memsize);
+			Mem_MallocFail(size);
+
+			return 0;
+		}
+		Mem_LifetimeStart(shard, new_ptr, start);
+		Mutex_Unlock(&shard->mutex);
+	}
+
+	Mem_LifetimeRecord(allocated, start);
+	Mem_SiteStatsFree(old_callsite, old_generation, old_memsize);
+	Mem_SiteStatsAlloc(callsite, generation, size);
+	Mem_StatsRealloc(start, size, alignment);
+	Mem_CheckWatermarks();
+
+	return &new_ptr[1];
+}
+void *Mem_ReallocAligned_IMP(void *ptr, size_t size, uint32_t alignment, const char *file, const char *function, int line)
+{
+	return Mem_ReallocBlock(ptr, size, alignment, file, function, line, 1);
+}
+void *Mem_Malloc_IMP(size_t size, const char *file, const char *function, int line)
+{
+	return Mem_MallocAligned_IMP(size, 1, file, function, line);
+}
+void *Mem_Realloc_IMP(void *ptr, size_t size, const char *file, const char *function, int line)
+{
+	return Mem_ReallocAligned_IMP(ptr, size, 1, file, function, line);
+}
+
+// Claims a block the registry doesn't have, returning 0 if it's a live untracked block, -1 if it isn't a live block and
+// -2 if its header is corrupt. The header is only read once the presence map says there's a block there.
+static int Mem_ClaimUnregistered(malloc_block_t *block)
+{
+	if (!g_malloc.untracked_ever || !Mem_PresenceClear(block))
+		return -1;
+
+	// out of the map now, but as with a block out of the registry, a corrupt header can't be trusted to release anything
+	if (Mem_BlockState(block) != MEM_BLOCK_UNTRACKED)
+		return -2;
+	Mem_BlockSeal(block, MEM_BLOCK_FREED);
+
+	return 0;
+}
+// Returns -1, without touching anything, if memblock isn't a live block, -2 if its header is corrupt, and 1 if it was
+// freed but size was given and doesn't match it
+static int Mem_FreeBlock(void *memblock, size_t size)
+{
+	malloc_block_t *ptr;
+	mem_shard_t *shard;
+	char *base;
+	size_t allocsize;
+	uint64_t start;
+	uint64_t allocated;
+	int size_class;
+	int mismatch;
+	int ret;
+
+	start = Mem_StatsStart();
+	ptr = &((malloc_block_t*)memblock)[-1];
+
+	// The registry goes first, and a miss goes to the presence map once blocks may have been left out of it. Either way
+	// nothing is read at memblock until it's known to be a live block.
+	shard = Mem_Shard(ptr);
+
+	Mem_ShardLock(shard);
+	if (Mem_RegistryDelete(shard, ptr))
+	{
+		allocated = Mem_LifetimeTake(shard, ptr);
+		Mutex_Unlock(&shard->mutex);
+
+		// out of the registry now, but a header this far gone can't be trusted to release anything
+		if (Mem_BlockState(ptr) != MEM_BLOCK_TRACKED)
+			return -2;
+		Mem_BlockSeal(ptr, MEM_BLOCK_FREED);
+	}
+	else
+	{
+		Mutex_Unlock(&shard->mutex);
+
+		if ((ret = Mem_ClaimUnregistered(ptr)) != 0)
+			return ret;
+		allocated = 0;
+	}
+
+	// the block is no longer reachable through the registry, so the rest can happen outside the lock. A cached block
+	// keeps its charge against the process limit, but not against its tag.
+	base = Mem_BlockBase(ptr);
+	allocsize = Mem_BlockAllocSize(ptr);
+	size_class = ptr->size_class;
+	mismatch = size != MEM_SIZE_UNKNOWN && size != (size_t)ptr->memsize;
+	Mem_SiteStatsFree(ptr->callsite, Mem_BlockGeneration(ptr), ptr->memsize);
+	Mem_TagUncharge(Mem_BlockTag(ptr), MEM_TAG_NONE, allocsize);
+	if (!size_class || !Mem_ThreadCachePush(base, size_class))
+	{
+		Mem_Uncharge(allocsize);
+		Mem_ReleaseBase(base, size_class, allocsize);
+	}
+
+	Mem_LifetimeRecord(allocated, start);
+	Mem_StatsFree(start);
+
+	return mismatch;
+}
+// Of a nonzero Mem_FreeBlock return
+static __forceinline int Mem_FreeFailureType(int ret)
+{
+	return ret == -2 ? FREE_FAILURE_CORRUPT : ret < 0 ? FREE_FAILURE_DANGLING : FREE_FAILURE_SIZE;
+}
+void Mem_Free_IMP(void *memblock, const char *file, const char *function, int line)
+{
+	int ret;
+
+	if (!memblock)
+	{
+		if (g_malloc.free_null_failure_fp)
+		{
+			size_t maxmem = Mem_MemoryLimit();
+			size_t usedmem = Mem_MemoryUsed();
+			size_t remaining;
+
+			Mutex_Lock(&g_malloc.mutex);
+
+			if (usedmem > maxmem)
+				remaining = 0;
+			else
+				remaining = maxmem - usedmem;
+			if (g_malloc.free_null_failure_fp)	// needed because the pointer might've changed after the if but before the lock was acquired
+				g_malloc.free_null_failure_fp(FREE_FAILURE_NULL, 0, maxmem, remaining);
+
+			Mutex_Unlock(&g_malloc.mutex);
+		}
+		return;
+	}
+
+	ret = Mem_FreeBlock(memblock, MEM_SIZE_UNKNOWN);
+	if (ret)
+		Mem_FreeDanglingFail(memblock, Mem_FreeFailureType(ret));
+}
+void Mem_FreeSized_IMP(void *memblock, size_t size, const char *file, const char *function, int line)
+{
+	int ret;
+
+	if (!memblock)
+	{
+		Mem_Free_IMP(memblock, file, function, line);
+		return;
+	}
+
+	// the size is already in the header, so it only serves as a check
+	ret = Mem_FreeBlock(memblock, size);
+	if (ret)
+		Mem_FreeDanglingFail(memblock, Mem_FreeFailureType(ret));
+}
+int Mem_TryFree(void *memblock)
+{
+	int ret;
+
+	if (!memblock)
+		return -1;
+
+	// a block with a corrupt header is still one of ours, so it's reported rather than left to the caller
+	ret = Mem_FreeBlock(memblock, MEM_SIZE_UNKNOWN);
+	if (ret == -2)
+		Mem_FreeDanglingFail(memblock, FREE_FAILURE_CORRUPT);
+
+	return ret;
+}
+// Batches. The blocks of a batch are put in shard order, so that each shard's lock is only taken once per batch.
+static __forceinline int Mem_MemblockShardIndex(void *memblock)
+{
+	return Mem_ShardIndex(&((malloc_block_t*)memblock)[-1]);
+}
+// In-place bucket sort of user pointers by shard, NULLs included
+static void Mem_SortByShard(void **memblocks, size_t count)
+{
+	size_t end[MEM_NUM_SHARDS];
+	size_t next[MEM_NUM_SHARDS];
+	size_t i;
+	int s;
+
+	memset(end, 0, sizeof(end));
+	for (i = 0; i < count; i++)
+		end[Mem_MemblockShardIndex(memblocks[i])]++;
+	for (s = 0, i = 0; s < MEM_NUM_SHARDS; s++)
+	{
+		next[s] = i;
+		i += end[s];
+		end[s] = i;
+	}
+
+	// swap every block straight into its own shard's range
+	for (s = 0; s < MEM_NUM_SHARDS; s++)
+	{
+		while (next[s] < end[s])
+		{
+			void *memblock = memblocks[next[s]];
+			int home = Mem_MemblockShardIndex(memblock);
+
+			if (home == s)
+				next[s]++;
+			else
+			{
+				memblocks[next[s]] = memblocks[next[home]];
+				memblocks[next[home]++] = memblock;
+			}
+		}
+	}
+}
+// Takes shard-sorted blocks out of the registry, or claims the untracked ones by their cookies. Blocks that weren't live
+// are reported as dangling, once their shard is unlocked, and set to NULL. NULLs are skipped.
+static void Mem_BatchUnregister(void **memblocks, size_t count)
+{
+	size_t i = 0;
+
+	while (i < count)
+	{
+		int index = Mem_MemblockShardIndex(memblocks[i]);
+		mem_shard_t *shard = &g_malloc.shard[index];
+		size_t run = i;
+		size_t kept = i;
+		size_t j;
+
+		Mem_ShardLock(shard);
+		for (; i < count && Mem_MemblockShardIndex(memblocks[i]) == index; i++)
+		{
+			malloc_block_t *ptr;
+
+			if (!memblocks[i])
+				continue;
+
+			ptr = &((malloc_block_t*)memblocks[i])[-1];
+			if (Mem_RegistryDelete(shard, ptr))
+			{
+				void *memblock = memblocks[i];
+
+				Mem_LifetimeRecord(Mem_LifetimeTake(shard, ptr), 0);
+				memblocks[i] = memblocks[kept];
+				memblocks[kept++] = memblock;
+			}
+		}
+		Mutex_Unlock(&shard->mutex);
+
+		for (j = run; j < kept; j++)
+		{
+			malloc_block_t *ptr = &((malloc_block_t*)memblocks[j])[-1];
+
+			// as in Mem_FreeBlock, a corrupt header can't be trusted to release anything
+			if (Mem_BlockState(ptr) != MEM_BLOCK_TRACKED)
+			{
+				Mem_FreeDanglingFail(memblocks[j], FREE_FAILURE_CORRUPT);
+				memblocks[j] = 0;
+			}
+			else
+				Mem_BlockSeal(ptr, MEM_BLOCK_FREED);
+		}
+
+		// the blocks the registry didn't have are now at the end of the run, and only an untracked one can be live
+		for (j = kept; j < i; j++)
+		{
+			int ret;
+
+			if (!memblocks[j] || (ret = Mem_ClaimUnregistered(&((malloc_block_t*)memblocks[j])[-1])) == 0)
+				continue;
+			Mem_FreeDanglingFail(memblocks[j], Mem_FreeFailureType(ret));
+			memblocks[j] = 0;
+		}
+	}
+}
+// Releases blocks already taken out of the registry, skipping NULLs. Consecutive blocks of the same call site and
+// generation are applied to its statistics together.
+static void Mem_BatchRelease(void **memblocks, size_t count)
+{
+	uint32_t callsite = 0;
+	uint32_t generation = 0;
+	int64_t bytes = 0;
+	int64_t frees = 0;
+	size_t i;
+
+	for (i = 0; i < count; i++)
+	{
+		malloc_block_t *ptr;
+		char *base;
+		size_t allocsize;
+		int size_class;
+
+		if (!memblocks[i])
+			continue;
+
+		ptr = &((malloc_block_t*)memblocks[i])[-1];
+		if (ptr->callsite != callsite || Mem_BlockGeneration(ptr) != generation)
+		{
+			Mem_SiteStatsAdd(callsite, generation, -bytes, 0, frees);
+			callsite = ptr->callsite;
+			generation = Mem_BlockGeneration(ptr);
+			bytes = 0;
+			frees = 0;
+		}
+		bytes += (int64_t)ptr->memsize;
+		frees++;
+
+		base = Mem_BlockBase(ptr);
+		allocsize = Mem_BlockAllocSize(ptr);
+		size_class = ptr->size_class;
+		Mem_TagUncharge(Mem_BlockTag(ptr), MEM_TAG_NONE, allocsize);
+		if (!size_class || !Mem_ThreadCachePush(base, size_class))
+		{
+			Mem_Uncharge(allocsize);
+			Mem_ReleaseBase(base, size_class, allocsize);
+		}
+	}
+	Mem_SiteStatsAdd(callsite, generation, -bytes, 0, frees);
+}
+
+int Mem_MallocBatch_IMP(size_t count, size_t size, void **out, const char *file, const char *function, int line)
+{
+	int tag = g_thread_tag;
+	call_site_t site;
+	uint32_t callsite;
+	uint32_t sampled_callsite = 0;
+	uint32_t generation;
+	int64_t sampled = 0;
+	size_t rate;
+	size_t created;
+	size_t tracked = 0;
+	size_t i;
+	int untracked = g_malloc.untracked;
+	int failed;
+
+	if (count == 0)
+		return 0;
+
+	// every block of the batch shares the one backtrace, sampled blocks included
+	site.file = file;
+	site.function = function;
+	site.line = line;
+	site.tag = tag;
+	site.stack_id = 0;
+	site.sample_rate = 0;
+	generation = Mem_CurrentGeneration();
+
+	rate = g_malloc.sample_rate;
+	if (rate == 0)
+		site.stack_id = Mem_PerformStackTrace(g_malloc.backtrace_max_depth);
+	callsite = Mem_InternCallSite(&site);
+
+	for (i = 0; i < count; i++)
+	{
+		malloc_block_t *ptr = Mem_NewBlock(tag, size, 1);
+
+		if (!ptr)
+			break;
+
+		ptr->callsite = callsite;
+		Mem_BlockSetGeneration(ptr, generation);
+		if (rate && Mem_Sample(size, rate))
+		{
+			if (!sampled_callsite)
+			{
+				site.sample_rate = rate;
+				site.stack_id = Mem_PerformStackTrace(g_malloc.backtrace_max_depth ? g_malloc.backtrace_max_depth : STACKTRACE_SAMPLE_DEFAULT_DEPTH);
+				sampled_callsite = Mem_InternCallSite(&site);
+			}
+			ptr->callsite = sampled_callsite;
+			sampled++;
+		}
+		// a block that lost its call site would also lose track of its tag
+		if (ptr->callsite == 0 && tag != MEM_TAG_NONE)
+		{
+			Mem_DiscardBlock(ptr, tag);
+			Mem_MallocFail(size);
+			break;
+		}
+		// the blocks going in the registry are kept at the front, which is all of them unless it's off
+		out[i] = &ptr[1];
+		if (untracked && Mem_PresenceSet(ptr) == 0)
+			Mem_BlockSeal(ptr, MEM_BLOCK_UNTRACKED);
+		else
+		{
+			Mem_BlockSeal(ptr, MEM_BLOCK_TRACKED);
+			out[i] = out[tracked];
+			out[tracked++] = &ptr[1];
+		}
+	}
+
+	// every block made so far is discarded on failure, including those that never got into the registry
+	created = i;
+	failed = created < count;
+	if (!failed && tracked)
+	{
+		size_t inserted = 0;
+
+		Mem_SortByShard(out, tracked);
+		while (inserted < tracked)
+		{
+			int index = Mem_MemblockShardIndex(out[inserted]);
+			mem_shard_t *shard = &g_malloc.shard[index];
+
+			Mem_ShardLock(shard);
+			for (; inserted < tracked && Mem_MemblockShardIndex(out[inserted]) == index; inserted++)
+			{
+				malloc_block_t *ptr = &((malloc_block_t*)out[inserted])[-1];
+
+				if (Mem_RegistryInsert(shard, ptr, 0))
+					break;
+				Mem_LifetimeStart(shard, ptr, 0);
+			}
+			Mutex_Unlock(&shard->mutex);
+
+			if (inserted < tracked && Mem_MemblockShardIndex(out[inserted]) == index)
+			{
+				// the registry couldn't grow, so undo the ones already in it
+				Mem_BatchUnregister(out, inserted);
+				Mem_MallocFail(size);
+				failed = 1;
+				break;
+			}
+		}
+	}
+
+	if (failed)
+	{
+		for (i = 0; i < created; i++)
+		{
+			malloc_block_t *ptr = &((malloc_block_t*)out[i])[-1];
+
+			if (i >= tracked)
+				Mem_PresenceClear(ptr);
+			Mem_DiscardBlock(ptr, tag);
+		}
+		memset(out, 0, count * sizeof(void*));
+
+		return -1;
+	}
+
+	Mem_SiteStatsAdd(callsite, generation, ((int64_t)count - sampled) * (int64_t)size, (int64_t)count - sampled, 0);
+	if (sampled)
+		Mem_SiteStatsAdd(sampled_callsite, generation, sampled * (int64_t)size, sampled, 0);
+	for (i = 0; i < count; i++)
+		Mem_StatsMalloc(0, size, 1);
+
+	return 0;
+}
+void Mem_FreeBatch_IMP(void **memblocks, size_t count, const char *file, const char *function, int line)
+{
+	Mem_SortByShard(memblocks, count);
+	Mem_BatchUnregister(memblocks, count);
+	Mem_BatchRelease(memblocks, count);
+}
+int Mem_IsManaged(void *memblock)
+{
+	malloc_block_t *ptr;
+	mem_shard_t *shard;
+	int ret;
+
+	if (!memblock)
+		return 0;
+
+	// only the address is looked up, the header of a foreign block is never read
+	ptr = &((malloc_block_t*)memblock)[-1];
+	shard = Mem_Shard(ptr);
+
+	Mem_ShardLock(shard);
+	ret = HashTable_Contains(&shard->registry, ptr);
+	Mutex_Unlock(&shard->mutex);
+
+	if (!ret && g_malloc.untracked_ever)
+		ret = Mem_PresenceTest(ptr);
+
+	return ret;
+}
+void Mem_FreeZ_IMP(void **memblock, const char *file, const char *function, int line)
+{
+	if (!memblock)
+	{
+		if (g_malloc.freeZ_null_failure_fp)
+		{
+			size_t maxmem = Mem_MemoryLimit();
+			size_t usedmem = Mem_MemoryUsed();
+			size_t remaining;
+
+			Mutex_Lock(&g_malloc.mutex);
+
+			if (usedmem > maxmem)
+				remaining = 0;
+			else
+				remaining = maxmem - usedmem;
+
+			if (g_malloc.freeZ_null_failure_fp)	// needed because the pointer might've changed after the if but before the lock was acquired
+				g_malloc.freeZ_null_failure_fp(FREE_FAILURE_NULL, 0, maxmem, remaining);
+
+			Mutex_Unlock(&g_malloc.mutex);
+		}
+		return;
+	}
+
+	Mem_Free_IMP(*memblock, file, function, line);
+	*memblock = 0;
+}
+static size_t Mem_ReportBlocks(uint32_t since)
+{
+	mem_report_totals_t *totals = calloc(1, sizeof(mem_report_totals_t));
+	size_t total;
+	int num_tags = g_malloc.num_tags;
+	int i;
+
+	if (!totals)
+	{
+		Mem_MallocFail(sizeof(mem_report_totals_t));
+
+		return 0;
+	}
+	totals->since = since;
+
+	Mem_WalkAllocatedBlocks(totals, Mem_WalkBlockPrint);
+
+	if (num_tags)
+	{
+		// parents are always created before their children, so one pass from the back rolls everything up
+		for (i = num_tags; i > MEM_TAG_NONE; i--)
+		{
+			totals->tag_bytes[g_malloc.tag[i].parent] += totals->tag_bytes[i];
+			totals->tag_blocks[g_malloc.tag[i].parent] += totals->tag_blocks[i];
+		}
+
+		for (i = MEM_TAG_NONE; i <= num_tags; i++)
+		{
+			mem_tag_stats_t stats;
+			int t;
+
+			Mem_GetTagStats(i, &stats);
+			for (t = i; t != MEM_TAG_NONE; t = g_malloc.tag[t].parent)
+				printf(" ");
+			printf("Tag %s: %zu bytes in %zu blocks (used %zu, peak %zu, limit %zu)\n", stats.name, totals->tag_bytes[i], totals->tag_blocks[i], stats.used, stats.peak, stats.limit);
+		}
+	}
+
+	total = totals->total;
+	free(totals);
+
+	return total;
+}
+int Mem_WalkAllocatedBlocks(void *context, int (*callback_fp)(const mem_block_info_t *block, void *context))
+{
+	mem_walk_t walk;
+
+	walk.context = context;
+	walk.callback_fp = callback_fp;
+
+	return Mem_WalkSnapshot(&walk, Mem_WalkSnapshotInfo);
+}
+size_t Mem_ReportAllocatedBlocks()
+{
+	return Mem_ReportBlocks(0);
+}
+size_t Mem_ReportGenerationBlocks(uint32_t since)
+{
+	return Mem_ReportBlocks(since);
+}
+size_t Mem_ReportSampledBlocks()
+{
+	mem_sample_totals_t totals;
+	double total = 0.0;
+	uint32_t id;
+
+	totals.num_stacks = StackDepot_Count();
+	totals.bytes = calloc((size_t)totals.num_stacks + 1, sizeof(double));
+	totals.blocks = calloc((size_t)totals.num_stacks + 1, sizeof(double));
+
+	if (!totals.bytes || !totals.blocks)
+	{
+		free(totals.bytes);
+		free(totals.blocks);
+		Mem_MallocFail(((size_t)totals.num_stacks + 1) * sizeof(double));
+
+		return 0;
+	}
+
+	Mem_WalkSnapshot(&totals, Mem_WalkSnapshotSample);
+
+	for (id = 0; id <= totals.num_stacks; id++)
+	{
+		void **stack;
+		int entries;
+
+		if (totals.blocks[id] == 0.0)
+			continue;
+
+		total += totals.bytes[id];
+		entries = StackDepot_Get(id, &stack);
+
+		printf("Estimated %.0f bytes in %.0f blocks allocated at stack %u\n", totals.bytes[id], totals.blocks[id], id);
+		Mem_PrintStack(stack, entries);
+	}
+
+	free(totals.bytes);
+	free(totals.blocks);
+
+	return (size_t)total;
+}
+int Mem_WriteHeapProfile(const char *path)
+{
+	mem_profile_totals_t totals;
+	profile_writer_t writer;
+	mem_thread_t *thread;
+	uint32_t id;
+
+	totals.num_sites = CallSite_Count();
+	totals.bytes = calloc((size_t)totals.num_sites + 1, sizeof(int64_t));
+	totals.blocks = calloc((size_t)totals.num_sites + 1, sizeof(int64_t));
+
+	if (!totals.bytes || !totals.blocks)
+	{
+		free(totals.bytes);
+		free(totals.blocks);
+		Mem_MallocFail(((size_t)totals.num_sites + 1) * sizeof(int64_t));
+
+		return -1;
+	}
+
+	if (Mem_WalkSnapshot(&totals, Mem_WalkSnapshotProfile))
+	{
+		free(totals.bytes);
+		free(totals.blocks);
+
+		return -1;
+	}
+
+	for (thread = g_threads.head; thread; thread = thread->next)
+		Mem_SiteDeltaFlush(thread);
+
+	if (ProfileWriter_Open(&writer, path))
+	{
+		free(totals.bytes);
+		free(totals.blocks);
+
+		return -1;
+	}
+
+	for (id = 1; id <= totals.num_sites; id++)
+	{
+		const call_site_t *site = CallSite_Get(id);
+		uint32_t line_id = CallSite_LineId(id);
+		int64_t values[PROFILE_NUM_VALUES] = {0, 0, totals.blocks[id], totals.bytes[id]};
+		void **stack;
+		int entries = StackDepot_Get(site->stack_id, &stack);
+
+		// allocation totals are only kept per line, so they go with the line's own call site, which has no stack
+		if (line_id == id)
+		{
+			call_site_stats_t *line = CallSite_GetStats(id);
+
+			values[0] = line->total_allocs;
+			values[1] = line->total_bytes;
+		}
+
+		if (values[0] == 0 && values[2] == 0)
+			continue;
+
+		if (entries)
+			ProfileWriter_StackSample(&writer, stack, entries, values);
+		else
+			ProfileWriter_LineSample(&writer, line_id, site->file, site->function, site->line, values);
+	}
+
+	free(totals.bytes);
+	free(totals.blocks);
+
+	return ProfileWriter_Close(&writer);
+}
+void Mem_FreeAll()
+{
+	int i;
+
+	for (i = 0; i < MEM_NUM_SHARDS; i++)
+	{
+		Mem_ShardLock(&g_malloc.shard[i]);
+		Mem_RegistryDestroy(&g_malloc.shard[i]);
+		Mutex_Unlock(&g_malloc.shard[i].mutex);
+	}
+	Mem_ThreadCacheFlushAll();
+}
+void Mem_Destroy()
+{
+	mem_thread_t *thread;
+	int i;
+
+	Mem_ReclaimThreadStop();
+	Mem_ThreadCacheFlushAll();
+
+	for (i = 0; i < MEM_NUM_SHARDS; i++)
+	{
+		Mem_RegistryDestroy(&g_malloc.shard[i]);
+		Mutex_Delete(&g_malloc.shard[i].mutex);
+	}
+	for (i = 0; i < MEM_TCACHE_NUM_CLASSES; i++)
+		Mutex_Delete(&g_malloc.slab[i].mutex);
+	Mutex_Delete(&g_malloc.mutex);
+	StackDepot_Destroy();
+	SymbolCache_Destroy();
+	CallSite_Destroy();
+	for (thread = g_threads.head; thread; thread = thread->next)
+	{
+		// the ids are about to be handed out again, so nothing buffered against them can be applied any more
+		thread->last_site_id = 0;
+		memset(thread->site_delta, 0, sizeof(thread->site_delta));
+#ifndef MEM_DISABLE_STATS
+		memset(&thread->stats, 0, sizeof(mem_stats_t));
+#endif
+	}
+	Mem_ReclaimCredit();
+	Mem_PresenceDestroy();
+	memset(&g_malloc, 0, sizeof(mem_managed_t));
+	g_malloc.large_threshold = MEM_LARGE_DEFAULT_THRESHOLD;
+}
+size_t Mem_MemoryUsed()
+{
+	int64_t total = g_malloc.memory_used;
+	mem_thread_t *thread;
+
+	// don't need mutex here, credit is reserved but not handed out yet, so it isn't in use
+	for (thread = g_threads.head; thread; thread = thread->next)
+		total -= thread->credit;
+	if (total < 0)	// a thread took credit between the two reads
+		total = 0;
+
+	return (size_t)total + StackDepot_MemUsed() + SymbolCache_MemUsed() + CallSite_MemUsed();
+}
+size_t Mem_MemoryLimit()
+{
+	// don't need mutex here
+	return g_malloc.max_memory ? g_malloc.max_memory : (size_t)(-1);
+}
+size_t Mem_MemoryRemaining()
+{
+	size_t memory_used;
+	size_t memory_limit;
+
+	// don't need mutex here
+	memory_limit = Mem_MemoryLimit();
+	memory_used = Mem_MemoryUsed();
+	if (memory_used > memory_limit)
+		return 0;
+
+	return memory_limit - memory_used;
+}
+void Mem_SetMallocFailCallback(void (*malloc_failure_fp)(size_t allocation_size, size_t max_memory, size_t memory_remaining))
+{
+	Mutex_Lock(&g_malloc.mutex);
+	g_malloc.malloc_failure_fp = malloc_failure_fp;
+	Mutex_Unlock(&g_malloc.mutex);
+}
+void Mem_SetFreeNullCallback(void (*free_failure_fp)(int type, void *old_block, size_t max_memory, size_t memory_remaining))
+{
+	Mutex_Lock(&g_malloc.mutex);
+	g_malloc.free_null_failure_fp = free_failure_fp;
+	Mutex_Unlock(&g_malloc.mutex);
+}
+void Mem_SetFreeDanglingCallback(void (*free_failure_fp)(int type, void *old_block, size_t max_memory, size_t memory_remaining))
+{
+	Mutex_Lock(&g_malloc.mutex);
+	g_malloc.free_dangling_failure_fp = free_failure_fp;
+	Mutex_Unlock(&g_malloc.mutex);
+}
+void Mem_SetFreeZNullCallback(void (*freeZ_failure_fp)(int type, void **old_block, size_t max_memory, size_t memory_remaining))
+{
+	Mutex_Lock(&g_malloc.mutex);
+	g_malloc.freeZ_null_failure_fp = freeZ_failure_fp;
+	Mutex_Unlock(&g_malloc.mutex);
+}
+void Mem_SetBacktraceDepth(uint32_t max_depth)
+{
+	Mutex_Lock(&g_malloc.mutex);
+	g_malloc.backtrace_max_depth = max_depth;
+	Mutex_Unlock(&g_malloc.mutex);
+}
+void Mem_SetSlabBackend(int enabled)
+{
+	// don't need mutex here, every block records which backend it came from
+	g_malloc.slab_enabled = enabled;
+}
+void Mem_SetLargeThreshold(size_t bytes)
+{
+	// don't need mutex here, every block records which backend it came from
+	g_malloc.large_threshold = bytes;
+}
+void Mem_SetHugePages(int enabled)
+{
+	g_malloc.huge_pages = enabled;
+}
+void Mem_SetBlockRegistry(int enabled)
+{
+#ifndef MEM_COMPACT_HEADER
+	// the frees have to start looking at cookies before any block goes without the registry
+	if (!enabled)
+		Atomic_Exchange32(&g_malloc.untracked_ever, 1);
+	Atomic_Exchange32(&g_malloc.untracked, !enabled);
+#endif
+}
+void Mem_SetSampleRate(size_t bytes)
+{
+	// don't need mutex here, threads pick the new rate up at their next sample
+	g_malloc.sample_rate = bytes;
+}
+void Mem_SetMemoryLimit(size_t size)
+{
+	// don't need mutex here
+	g_malloc.max_memory = size;
+}
+void Mem_SetWatermarks(size_t soft, size_t hard)
+{
+	size_t trigger = soft && (!hard || soft < hard) ? soft : hard;
+
+	// don't need mutex here, a check racing with this only sees one side of the change
+	g_malloc.soft_watermark = soft;
+	g_malloc.hard_watermark = hard;
+	g_malloc.reclaim_trigger = trigger > INT64_MAX ? INT64_MAX : (int64_t)trigger;
+}
+int Mem_AddReclaimCallback(int priority, void (*reclaim_fp)(int level, size_t bytes_wanted, void *context), void *context)
+{
+	int i;
+	int id;
+
+	Mutex_Lock(&g_malloc.mutex);
+	if (g_malloc.num_reclaimers == MEM_MAX_RECLAIMERS)
+	{
+		Mutex_Unlock(&g_malloc.mutex);
+
+		return -1;
+	}
+
+	// after any of the same priority, so those run in the order they were added
+	for (i = g_malloc.num_reclaimers; i > 0 && g_malloc.reclaimer[i - 1].priority > priority; i--)
+		g_malloc.reclaimer[i] = g_malloc.reclaimer[i - 1];
+	id = ++g_malloc.next_reclaimer_id;
+	g_malloc.reclaimer[i].reclaim_fp = reclaim_fp;
+	g_malloc.reclaimer[i].context = context;
+	g_malloc.reclaimer[i].priority = priority;
+	g_malloc.reclaimer[i].id = id;
+	g_malloc.num_reclaimers++;
+	Mutex_Unlock(&g_malloc.mutex);
+
+	return id;
+}
+void Mem_RemoveReclaimCallback(int id)
+{
+	int i;
+
+	// waits for a reclaim in progress to finish, unless it's this thread's, since it may still call the callback
+	if (!g_thread_reclaiming)
+		Mutex_Lock(&g_malloc.reclaim_mutex);
+	Mutex_Lock(&g_malloc.mutex);
+	for (i = 0; i < g_malloc.num_reclaimers; i++)
+	{
+		if (g_malloc.reclaimer[i].id == id)
+		{
+			memmove(&g_malloc.reclaimer[i], &g_malloc.reclaimer[i + 1], sizeof(mem_reclaimer_t) * (g_malloc.num_reclaimers - i - 1));
+			g_malloc.num_reclaimers--;
+			break;
+		}
+	}
+	Mutex_Unlock(&g_malloc.mutex);
+	if (!g_thread_reclaiming)
+		Mutex_Unlock(&g_malloc.reclaim_mutex);
+}
+int Mem_CreateTag(const char *name, int parent, size_t limit)
+{
+	mem_tag_t *budget;
+	int tag;
+
+	Mutex_Lock(&g_malloc.mutex);
+	tag = g_malloc.num_tags + 1;
+	if (parent < 0 || parent >= tag || tag >= MEM_MAX_TAGS)
+	{
+		Mutex_Unlock(&g_malloc.mutex);
+		return -1;
+	}
+
+	budget = &g_malloc.tag[tag];
+	budget->name = name;
+	budget->parent = parent;
+	budget->used = 0;
+	budget->peak = 0;
+	budget->limit = (int64_t)limit;
+
+	// only publish once the record is complete, allocations check tags against num_tags without the lock
+	Atomic_Exchange32(&g_malloc.num_tags, tag);
+	Mutex_Unlock(&g_malloc.mutex);
+
+	return tag;
+}
+void Mem_SetTagLimit(int tag, size_t limit)
+{
+	// don't need mutex here, lowering a limit below the current usage only fails later allocations
+	if (tag > MEM_TAG_NONE && tag <= g_malloc.num_tags)
+		g_malloc.tag[tag].limit = (int64_t)limit;
+	else if (tag == MEM_TAG_NONE)
+		Mem_SetMemoryLimit(limit);
+}
+int Mem_SetThreadTag(int tag)
+{
+	int old_tag = g_thread_tag;
+
+	g_thread_tag = tag;
+
+	return old_tag;
+}
+int Mem_GetThreadTag()
+{
+	return g_thread_tag;
+}
+int Mem_GetTagStats(int tag, mem_tag_stats_t *stats)
+{
+	if (tag < MEM_TAG_NONE || tag > g_malloc.num_tags)
+		return -1;
+
+	if (tag == MEM_TAG_NONE)
+	{
+		stats->name = "process";
+		stats->parent = MEM_TAG_NONE;
+		stats->used = Mem_MemoryUsed();
+		stats->peak = (size_t)g_malloc.memory_peak;
+		stats->limit = g_malloc.max_memory;
+
+		return 0;
+	}
+
+	stats->name = g_malloc.tag[tag].name;
+	stats->parent = g_malloc.tag[tag].parent;
+	stats->used = (size_t)g_malloc.tag[tag].used;
+	stats->peak = (size_t)g_malloc.tag[tag].peak;
+	stats->limit = (size_t)g_malloc.tag[tag].limit;
+
+	return 0;
+}
+// Adds entry to the max_count entries of stats with the most live bytes, which are kept sorted as they fill up
+static void Mem_InsertTopStats(mem_callsite_stats_t *stats, size_t *num_stats, size_t max_count, const mem_callsite_stats_t *entry)
+{
+	size_t i;
+
+	if (*num_stats < max_count)
+		i = (*num_stats)++;
+	else if (max_count && stats[max_count - 1].live_bytes < entry->live_bytes)
+		i = max_count - 1;
+	else
+		return;
+
+	for (; i > 0 && stats[i - 1].live_bytes < entry->live_bytes; i--)
+		stats[i] = stats[i - 1];
+	stats[i] = *entry;
+}
+
+static void Mem_SiteDeltaFlushAll()
+{
+	mem_thread_t *thread;
+
+	// the threads keep running, they only hand over what they've buffered so far
+	for (thread = g_threads.head; thread; thread = thread->next)
+		Mem_SiteDeltaFlush(thread);
+}
+
+size_t Mem_GetCallSiteStats(mem_callsite_stats_t *stats, size_t max_count)
+{
+	uint32_t count;
+	uint32_t id;
+	size_t num_stats = 0;
+
+	Mem_SiteDeltaFlushAll();
+
+	count = CallSite_Count();
+	for (id = 1; id <= count; id++)
+	{
+		const call_site_t *site = CallSite_Get(id);
+		call_site_stats_t *line = CallSite_GetStats(id);
+		mem_callsite_stats_t entry;
+
+		// each line has one call site without a stack, tag or sampling, and that's the one holding its statistics
+		if (!line || CallSite_LineId(id) != id || line->total_allocs == 0)
+			continue;
+
+		entry.file = site->file;
+		entry.function = site->function;
+		entry.line = site->line;
+		entry.live_bytes = line->live_bytes > 0 ? (size_t)line->live_bytes : 0;	// a free can be applied before its allocation
+		entry.live_blocks = line->live_blocks > 0 ? (size_t)line->live_blocks : 0;
+		entry.total_allocs = (uint64_t)line->total_allocs;
+		entry.total_bytes = (uint64_t)line->total_bytes;
+		entry.total_frees = (uint64_t)line->total_frees;
+		entry.peak_bytes = (size_t)line->peak_bytes;
+
+		Mem_InsertTopStats(stats, &num_stats, max_count, &entry);
+	}
+
+	return num_stats;
+}
+size_t Mem_GetGenerationStats(uint32_t since, mem_callsite_stats_t *stats, size_t max_count)
+{
+	uint32_t count;
+	uint32_t id;
+	size_t num_stats = 0;
+
+	// generation 0 is everything, which is what the lines' own totals hold
+	if (since == 0)
+		return Mem_GetCallSiteStats(stats, max_count);
+
+	Mem_SiteDeltaFlushAll();
+
+	count = CallSite_Count();
+	for (id = 1; id <= count; id++)
+	{
+		const call_site_t *site = CallSite_Get(id);
+		call_site_stats_t line;
+		mem_callsite_stats_t entry;
+		int ret;
+
+		// the generations are only kept on the lines' own records
+		if (CallSite_LineId(id) != id)
+			continue;
+		ret = CallSite_GetGenerationStats(id, since, &line);
+		if (ret > 0)
+			return MEM_GENERATION_EXPIRED;
+		if (ret || line.total_allocs == 0)
+			continue;
+
+		entry.file = site->file;
+		entry.function = site->function;
+		entry.line = site->line;
+		entry.live_bytes = line.live_bytes > 0 ? (size_t)line.live_bytes : 0;	// a free can be applied before its allocation
+		entry.live_blocks = line.live_blocks > 0 ? (size_t)line.live_blocks : 0;
+		entry.total_allocs = (uint64_t)line.total_allocs;
+		entry.total_bytes = (uint64_t)line.total_bytes;
+		entry.total_frees = (uint64_t)line.total_frees;
+		entry.peak_bytes = 0;
+
+		Mem_InsertTopStats(stats, &num_stats, max_count, &entry);
+	}
+
+	return num_stats;
+}
+uint32_t Mem_MarkGeneration()
+{
+	uint32_t generation;
+
+	Mutex_Lock(&g_malloc.mutex);
+	generation = (uint32_t)g_malloc.generation + 1;
+	Atomic_Exchange32(&g_malloc.generation, (int32_t)generation);
+	Mutex_Unlock(&g_malloc.mutex);
+
+	return generation;
+}
+uint32_t Mem_GetGeneration()
+{
+	return (uint32_t)g_malloc.generation;
+}
+
+#ifndef MEM_DISABLE_STATS
+static void Mem_HistogramMerge(mem_histogram_t *dst, const mem_histogram_t *src)
+{
+	int i;
+
+	dst->count += src->count;
+	dst->sum += src->sum;
+	for (i = 0; i < MEM_STATS_BUCKETS; i++)
+		dst->bucket[i] += src->bucket[i];
+}
+#endif
+int Mem_GetStats(mem_stats_t *stats)
+{
+#ifndef MEM_DISABLE_STATS
+	mem_thread_t *thread;
+#endif
+
+	memset(stats, 0, sizeof(mem_stats_t));
+
+#ifdef MEM_DISABLE_STATS
+	return -1;
+#else
+	// the records of exited threads are kept, and so are their statistics
+	for (thread = g_threads.head; thread; thread = thread->next)
+	{
+		Mem_HistogramMerge(&stats->malloc_cycles, &thread->stats.malloc_cycles);
+		Mem_HistogramMerge(&stats->realloc_cycles, &thread->stats.realloc_cycles);
+		Mem_HistogramMerge(&stats->free_cycles, &thread->stats.free_cycles);
+		Mem_HistogramMerge(&stats->request_size, &thread->stats.request_size);
+		Mem_HistogramMerge(&stats->alignment, &thread->stats.alignment);
+		stats->lock_acquisitions += thread->stats.lock_acquisitions;
+		Mem_HistogramMerge(&stats->lock_wait_cycles, &thread->stats.lock_wait_cycles);
+		Mem_HistogramMerge(&stats->lifetime_cycles, &thread->stats.lifetime_cycles);
+	}
+
+	return 0;
+#endif
+}
+
+void (*Mem_GetDefaultMallocFail())(size_t allocation_size, size_t max_memory, size_t memory_remaining)
+{
+	return Mem_OnMallocFailDefault;
+}
+void (*Mem_GetDefaultFreeDanglingFail())(int type, void *old_block, size_t max_memory, size_t memory_remaining)
+{
+	return Mem_OnFreeDanglingDefault;
+}
+void (*Mem_GetDefaultFreeNULLFail())(int type, void *old_block, size_t max_memory, size_t memory_remaining)
+{
+	return 0;
+}
+void (*Mem_GetDefaultFreeZNULLFail())(int type, void **old_block, size_t max_memory, size_t memory_remaining)
+{
+	return 0;
+}
+
+void *Mem_RawToManaged(void *memblock, size_t size)
+{
+	void *ptr = Mem_Malloc_IMP(size, __FILE__, __FUNCTION__, __LINE__);
+
+	memcpy(ptr, memblock, size);
+
+	free(memblock);
+
+	return ptr;
+}
+void *Mem_RawToManagedAligned(void *memblock, size_t size, uint32_t alignment)
+{
+	void *ptr = Mem_MallocAligned_IMP(size, alignment, __FILE__, __FUNCTION__, __LINE__);
+
+	memcpy(ptr, memblock, size);
+
+	free(memblock);
+
+	return ptr;
 }
\ No newline at end of file
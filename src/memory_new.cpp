@@ -0,0 +1,147 @@
+// Replacement global operator new and delete, built into libmanagedmalloc_new.a by make cxx. Linking it along with the
+// library sends every new and delete in the program through it, including those made inside the C++ runtime. Static
+// constructors can allocate before main, so the library is initialized on first use. Mem_Destroy must not be called
+// while anything can still be deleted, which includes static destructors. A failed allocation goes to the malloc failure
+// callback before anything else, so set it to NULL to have new throw std::bad_alloc instead of stopping there.
+
+#include <cstdlib>
+#include <new>
+
+#include "../inc/memory.hpp"
+
+#define NEW_DEFAULT_ALIGNMENT		__STDCPP_DEFAULT_NEW_ALIGNMENT__
+
+static bool g_new_initialized = false;
+
+// Returns 0 if out of memory and there's no new handler to free some up
+static void *New_Allocate(std::size_t size, std::size_t alignment)
+{
+	void *ptr;
+
+	if (!g_new_initialized)
+	{
+		Mem_Init();
+		g_new_initialized = true;
+	}
+	if (alignment > UINT32_MAX)
+		return 0;
+
+	// a new handler is expected to free something up, or throw
+	while ((ptr = Mem_MallocAligned_IMP(size, (uint32_t)alignment, __FILE__, __FUNCTION__, __LINE__)) == 0)
+	{
+		std::new_handler handler = std::get_new_handler();
+
+		if (!handler)
+			return 0;
+		handler();
+	}
+
+	return ptr;
+}
+static void *New_AllocateOrThrow(std::size_t size, std::size_t alignment)
+{
+	void *ptr = New_Allocate(size, alignment);
+
+	if (!ptr)
+		throw std::bad_alloc();
+
+	return ptr;
+}
+static void *New_AllocateNoThrow(std::size_t size, std::size_t alignment) noexcept
+{
+	try
+	{
+		return New_Allocate(size, alignment);
+	}
+	catch (...)
+	{
+		return 0;
+	}
+}
+
+void *operator new(std::size_t size)
+{
+	return New_AllocateOrThrow(size, NEW_DEFAULT_ALIGNMENT);
+}
+void *operator new[](std::size_t size)
+{
+	return New_AllocateOrThrow(size, NEW_DEFAULT_ALIGNMENT);
+}
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+	return New_AllocateNoThrow(size, NEW_DEFAULT_ALIGNMENT);
+}
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+	return New_AllocateNoThrow(size, NEW_DEFAULT_ALIGNMENT);
+}
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+	return New_AllocateOrThrow(size, (std::size_t)alignment);
+}
+void *operator new[](std::size_t size, std::align_val_t alignment)
+{
+	return New_AllocateOrThrow(size, (std::size_t)alignment);
+}
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+	return New_AllocateNoThrow(size, (std::size_t)alignment);
+}
+void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+	return New_AllocateNoThrow(size, (std::size_t)alignment);
+}
+
+// Every block is freed the same way whatever its alignment. The sized forms have the block's size checked against it.
+void operator delete(void *ptr) noexcept
+{
+	if (ptr)
+		Mem_Free_IMP(ptr, __FILE__, __FUNCTION__, __LINE__);
+}
+void operator delete[](void *ptr) noexcept
+{
+	if (ptr)
+		Mem_Free_IMP(ptr, __FILE__, __FUNCTION__, __LINE__);
+}
+void operator delete(void *ptr, std::size_t size) noexcept
+{
+	if (ptr)
+		Mem_FreeSized_IMP(ptr, size, __FILE__, __FUNCTION__, __LINE__);
+}
+void operator delete[](void *ptr, std::size_t size) noexcept
+{
+	if (ptr)
+		Mem_FreeSized_IMP(ptr, size, __FILE__, __FUNCTION__, __LINE__);
+}
+void operator delete(void *ptr, const std::nothrow_t &) noexcept
+{
+	operator delete(ptr);
+}
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept
+{
+	operator delete[](ptr);
+}
+void operator delete(void *ptr, std::align_val_t) noexcept
+{
+	operator delete(ptr);
+}
+void operator delete[](void *ptr, std::align_val_t) noexcept
+{
+	operator delete[](ptr);
+}
+void operator delete(void *ptr, std::size_t size, std::align_val_t) noexcept
+{
+	operator delete(ptr, size);
+}
+void operator delete[](void *ptr, std::size_t size, std::align_val_t) noexcept
+{
+	operator delete[](ptr, size);
+}
+void operator delete(void *ptr, std::align_val_t, const std::nothrow_t &) noexcept
+{
+	operator delete(ptr);
+}
+void operator delete[](void *ptr, std::align_val_t, const std::nothrow_t &) noexcept
+{
+	operator delete[](ptr);
+}
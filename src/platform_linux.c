@@ -0,0 +1,297 @@
+#ifndef _WIN32
+
+#define _GNU_SOURCE		// for dladdr and pthread_getattr_np
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <unwind.h>
+#include <sys/mman.h>
+
+#include "../inc/platform.h"
+
+typedef struct platform_unwind_s
+{
+	void		**stack;
+	int			entries;
+	int			skip;
+	int			count;
+}platform_unwind_t;
+
+// bounds of the calling thread's stack, so the frame-pointer walk never follows a pointer out of it
+static PLATFORM_THREAD_LOCAL uintptr_t g_stack_lo = 0;
+static PLATFORM_THREAD_LOCAL uintptr_t g_stack_hi = 0;
+
+void Platform_Init()
+{
+}
+
+static _Unwind_Reason_Code Platform_UnwindCB(struct _Unwind_Context *context, void *arg)
+{
+	platform_unwind_t *unwind = (platform_unwind_t*)arg;
+	void *ip = (void*)_Unwind_GetIP(context);
+
+	if (!ip)
+		return _URC_END_OF_STACK;
+
+	if (unwind->skip > 0)
+		unwind->skip--;
+	else if (unwind->count < unwind->entries)
+		unwind->stack[unwind->count++] = ip;
+
+	return unwind->count < unwind->entries ? _URC_NO_REASON : _URC_END_OF_STACK;
+}
+
+static __attribute__((noinline)) int Platform_StackTrace_Unwind(void **stack, int entries, int skip)
+{
+	platform_unwind_t unwind;
+
+	unwind.stack = stack;
+	unwind.entries = entries;
+	unwind.skip = skip + 2;		// this function and Platform_StackTrace_Snapshot
+	unwind.count = 0;
+
+	_Unwind_Backtrace(Platform_UnwindCB, &unwind);
+
+	return unwind.count;
+}
+
+static void Platform_StackBounds()
+{
+	pthread_attr_t attr;
+	void *addr;
+	size_t size;
+
+	if (pthread_getattr_np(pthread_self(), &attr))
+		return;
+	if (!pthread_attr_getstack(&attr, &addr, &size))
+	{
+		g_stack_lo = (uintptr_t)addr;
+		g_stack_hi = (uintptr_t)addr + size;
+	}
+	pthread_attr_destroy(&attr);
+}
+
+// Walks the frame-pointer chain, which is a handful of loads per frame. Every step has to stay inside the thread's stack
+// and move strictly towards its base. A walk that neither fills the buffer nor ends cleanly on the zeroed frame pointer
+// of the thread's entry point went through a frame built without frame pointers, in which case the much slower but
+// always correct _Unwind_Backtrace is used instead.
+__attribute__((noinline)) int Platform_StackTrace_Snapshot(void **stack, int entries, int skip)
+{
+#if defined(__x86_64__) || defined(__aarch64__)
+	uintptr_t *fp = (uintptr_t*)__builtin_frame_address(0);
+	int remaining_skip = skip;
+	int count = 0;
+
+	if (!g_stack_hi)
+		Platform_StackBounds();
+
+	while (count < entries && (uintptr_t)fp >= g_stack_lo && (uintptr_t)fp + 2 * sizeof(uintptr_t) <= g_stack_hi && !((uintptr_t)fp & (sizeof(uintptr_t) - 1)))
+	{
+		uintptr_t *next = (uintptr_t*)fp[0];
+		void *ip = (void*)fp[1];
+
+		if (!ip)
+			break;
+
+		if (remaining_skip > 0)
+			remaining_skip--;
+		else
+			stack[count++] = ip;
+
+		if (!next)
+			return count;
+		if (next <= fp)
+			break;
+		fp = next;
+	}
+
+	if (count == entries)
+		return count;
+#endif
+
+	return Platform_StackTrace_Unwind(stack, entries, skip);
+}
+
+int Platform_ResolveSymbol(void *address, char *file, size_t file_size, char *function, size_t function_size, int *line)
+{
+	Dl_info info;
+
+	// no line information without a DWARF reader, so report the containing module as the file
+	if (!dladdr(address, &info) || !info.dli_fname)
+		return -1;
+
+	snprintf(file, file_size, "%s", info.dli_fname);
+	snprintf(function, function_size, "%s", info.dli_sname ? info.dli_sname : "??");
+	*line = 0;
+
+	return 0;
+}
+
+void *Platform_MapSpan(size_t size)
+{
+	// over-map by the alignment and trim both ends
+	char *ptr = mmap(NULL, size * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	char *aligned;
+
+	if (ptr == MAP_FAILED)
+		return 0;
+
+	aligned = (char*)(((uintptr_t)ptr + size - 1) & ~(uintptr_t)(size - 1));
+	if (aligned != ptr)
+		munmap(ptr, aligned - ptr);
+	munmap(aligned + size, ptr + size * 2 - (aligned + size));
+
+	return aligned;
+}
+
+void Platform_UnmapSpan(void *span, size_t size)
+{
+	munmap(span, size);
+}
+
+size_t Platform_PageSize()
+{
+	static size_t page_size = 0;
+
+	if (!page_size)
+		page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+	return page_size;
+}
+
+void *Platform_MapPages(size_t size, size_t alignment, size_t offset, int huge)
+{
+	size_t extra = alignment > Platform_PageSize() ? alignment : 0;
+	char *ptr;
+	char *aligned;
+
+	if (size > SIZE_MAX - extra)
+		return 0;
+
+	// over-map by the alignment and trim both ends, as for spans
+	ptr = mmap(NULL, size + extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ptr == MAP_FAILED)
+		return 0;
+
+	aligned = ptr;
+	if (extra)
+	{
+		aligned = (char*)((((uintptr_t)ptr + offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - offset);
+		if (aligned != ptr)
+			munmap(ptr, aligned - ptr);
+		if (aligned + size != ptr + size + extra)
+			munmap(aligned + size, ptr + size + extra - (aligned + size));
+	}
+
+#ifdef MADV_HUGEPAGE
+	if (huge)
+		madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+
+	return aligned;
+}
+
+void Platform_UnmapPages(void *ptr, size_t size)
+{
+	munmap(ptr, size);
+}
+
+void *Platform_RemapPages(void *ptr, size_t old_size, size_t new_size)
+{
+	void *remapped = mremap(ptr, old_size, new_size, MREMAP_MAYMOVE);
+
+	return remapped == MAP_FAILED ? 0 : remapped;
+}
+
+thread_key_t Platform_ThreadKeyCreate(void (PLATFORM_CALLBACK *destructor_fp)(void *value))
+{
+	pthread_key_t key;
+
+	if (pthread_key_create(&key, destructor_fp))
+		return THREAD_KEY_INVALID;
+
+	return key;
+}
+
+void Platform_ThreadKeySet(thread_key_t key, void *value)
+{
+	pthread_setspecific(key, value);
+}
+
+static void *Platform_ThreadMain(void *arg)
+{
+	platform_thread_t *thread = (platform_thread_t*)arg;
+
+	thread->thread_fp(thread->arg);
+
+	return 0;
+}
+
+int Platform_ThreadCreate(platform_thread_t *thread, void (*thread_fp)(void *arg), void *arg)
+{
+	thread->thread_fp = thread_fp;
+	thread->arg = arg;
+
+	return pthread_create(&thread->handle, NULL, Platform_ThreadMain, thread);
+}
+
+void Platform_ThreadJoin(platform_thread_t *thread)
+{
+	pthread_join(thread->handle, NULL);
+}
+
+void Platform_Wait(volatile int32_t *address, int32_t value, int timeout_ms)
+{
+	struct timespec timeout;
+
+	timeout.tv_sec = timeout_ms / 1000;
+	timeout.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+	syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, value, timeout_ms < 0 ? NULL : &timeout, NULL, 0);
+}
+
+void Platform_WakeAll(volatile int32_t *address)
+{
+	syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+int Platform_EnumerateModules(void *context, void (*callback_fp)(const platform_module_t *module, void *context))
+{
+	FILE *maps = fopen("/proc/self/maps", "r");
+	char line[PATH_MAX + 128];
+
+	if (!maps)
+		return -1;
+
+	while (fgets(line, sizeof(line), maps))
+	{
+		platform_module_t module;
+		unsigned long long start;
+		unsigned long long end;
+		unsigned long long offset;
+		char perms[8];
+		int path = 0;
+
+		// start-end perms offset dev inode path
+		if (sscanf(line, "%llx-%llx %7s %llx %*s %*s %n", &start, &end, perms, &offset, &path) < 4 || !path)
+			continue;
+
+		// only file-backed code can be symbolized
+		if (perms[2] != 'x' || line[path] != '/')
+			continue;
+
+		line[path + strcspn(line + path, "\n")] = 0;
+		module.start = (uintptr_t)start;
+		module.end = (uintptr_t)end;
+		module.offset = (uint64_t)offset;
+		module.path = line + path;
+		callback_fp(&module, context);
+	}
+	fclose(maps);
+
+	return 0;
+}
+
+#endif
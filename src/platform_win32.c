@@ -0,0 +1,216 @@
+#ifdef _WIN32
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <Dbghelp.h>
+
+#include "../inc/platform.h"
+
+#include <psapi.h>
+
+void Platform_Init()
+{
+	SymSetOptions(SYMOPT_LOAD_LINES);
+	SymInitialize(GetCurrentProcess(), NULL, TRUE);
+}
+
+int Platform_StackTrace_Snapshot(void **stack, int entries, int skip)
+{
+	return CaptureStackBackTrace(skip + 1, entries, stack, NULL);
+}
+
+int Platform_ResolveSymbol(void *address, char *file, size_t file_size, char *function, size_t function_size, int *line)
+{
+	DWORD				offset = 0;
+	SYMBOL_INFO			*symbol;
+	ULONG64				buffer[(sizeof(SYMBOL_INFO) + MAX_SYM_NAME*sizeof(TCHAR) + sizeof(ULONG64) - 1) / sizeof(ULONG64)];
+	IMAGEHLP_LINE64		line_info = {0};
+
+	symbol = (SYMBOL_INFO*)buffer;
+	symbol->MaxNameLen   = MAX_SYM_NAME;
+	symbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+
+	line_info.SizeOfStruct = sizeof(IMAGEHLP_LINE64);
+
+	if (!SymFromAddr(GetCurrentProcess(), (DWORD64)address, 0, symbol))
+		return -1;
+	if (!SymGetLineFromAddr64(GetCurrentProcess(), (DWORD64)address, &offset, &line_info))
+		return -1;
+
+	_snprintf_s(file, file_size, _TRUNCATE, "%s", line_info.FileName);
+	_snprintf_s(function, function_size, _TRUNCATE, "%s", symbol->Name);
+	*line = line_info.LineNumber;
+
+	return 0;
+}
+
+void *Platform_MapSpan(size_t size)
+{
+	// VirtualAlloc reservations are 64KiB-aligned, so anything larger has to be carved out of a bigger reservation
+	void *ptr = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+	if (ptr && ((uintptr_t)ptr & (size - 1)))
+	{
+		char *reserved;
+
+		VirtualFree(ptr, 0, MEM_RELEASE);
+
+		reserved = VirtualAlloc(NULL, size * 2, MEM_RESERVE, PAGE_NOACCESS);
+		if (!reserved)
+			return 0;
+
+		ptr = (void*)(((uintptr_t)reserved + size - 1) & ~(uintptr_t)(size - 1));
+		VirtualFree(reserved, 0, MEM_RELEASE);
+
+		// racy if another thread maps in between, in which case we just fail
+		ptr = VirtualAlloc(ptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	}
+
+	return ptr;
+}
+
+void Platform_UnmapSpan(void *span, size_t size)
+{
+	VirtualFree(span, 0, MEM_RELEASE);
+}
+
+size_t Platform_PageSize()
+{
+	static size_t page_size = 0;
+
+	if (!page_size)
+	{
+		SYSTEM_INFO info;
+
+		GetSystemInfo(&info);
+		page_size = info.dwPageSize;
+	}
+
+	return page_size;
+}
+
+// Large pages need a privilege most processes don't hold, so huge is ignored
+void *Platform_MapPages(size_t size, size_t alignment, size_t offset, int huge)
+{
+	char *reserved;
+	char *ptr;
+	char *base;
+
+	// reservations are 64KiB-aligned, so anything else has to be carved out of a bigger reservation
+	if (alignment <= 65536 && offset % alignment == 0)
+		return VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (size > SIZE_MAX - alignment - 65536)
+		return 0;
+
+	reserved = VirtualAlloc(NULL, size + alignment + 65536, MEM_RESERVE, PAGE_NOACCESS);
+	if (!reserved)
+		return 0;
+
+	ptr = (char*)((((uintptr_t)reserved + 65536 + offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - offset);
+	base = (char*)((uintptr_t)ptr & ~(uintptr_t)65535);
+	VirtualFree(reserved, 0, MEM_RELEASE);
+
+	// racy if another thread maps in between, in which case we just fail
+	if (VirtualAlloc(base, ptr + size - base, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE) != base)
+		return 0;
+
+	return ptr;
+}
+
+// ptr may be past the start of its reservation, see above
+void Platform_UnmapPages(void *ptr, size_t size)
+{
+	MEMORY_BASIC_INFORMATION info;
+
+	if (VirtualQuery(ptr, &info, sizeof(info)))
+		VirtualFree(info.AllocationBase, 0, MEM_RELEASE);
+}
+
+// A reservation can't be grown or partly released, so only shrinking is done in place, by decommitting the tail
+void *Platform_RemapPages(void *ptr, size_t old_size, size_t new_size)
+{
+	if (new_size > old_size)
+		return 0;
+	if (new_size < old_size)
+		VirtualFree((char*)ptr + new_size, old_size - new_size, MEM_DECOMMIT);
+
+	return ptr;
+}
+
+thread_key_t Platform_ThreadKeyCreate(void (PLATFORM_CALLBACK *destructor_fp)(void *value))
+{
+	return FlsAlloc(destructor_fp);
+}
+
+void Platform_ThreadKeySet(thread_key_t key, void *value)
+{
+	FlsSetValue(key, value);
+}
+
+static DWORD WINAPI Platform_ThreadMain(LPVOID arg)
+{
+	platform_thread_t *thread = (platform_thread_t*)arg;
+
+	thread->thread_fp(thread->arg);
+
+	return 0;
+}
+
+int Platform_ThreadCreate(platform_thread_t *thread, void (*thread_fp)(void *arg), void *arg)
+{
+	thread->thread_fp = thread_fp;
+	thread->arg = arg;
+	thread->handle = CreateThread(NULL, 0, Platform_ThreadMain, thread, 0, NULL);
+
+	return thread->handle == NULL;
+}
+
+void Platform_ThreadJoin(platform_thread_t *thread)
+{
+	WaitForSingleObject(thread->handle, INFINITE);
+	CloseHandle(thread->handle);
+}
+
+// needs synchronization.lib
+void Platform_Wait(volatile int32_t *address, int32_t value, int timeout_ms)
+{
+	WaitOnAddress(address, &value, sizeof(value), timeout_ms < 0 ? INFINITE : (DWORD)timeout_ms);
+}
+
+void Platform_WakeAll(volatile int32_t *address)
+{
+	WakeByAddressAll((PVOID)address);
+}
+
+int Platform_EnumerateModules(void *context, void (*callback_fp)(const platform_module_t *module, void *context))
+{
+	HMODULE		modules[1024];
+	DWORD		needed;
+	DWORD		i;
+
+	if (!EnumProcessModules(GetCurrentProcess(), modules, sizeof(modules), &needed))
+		return -1;
+
+	for (i = 0; i < needed / sizeof(HMODULE) && i < sizeof(modules) / sizeof(HMODULE); i++)
+	{
+		MODULEINFO			info;
+		char				path[MAX_PATH];
+		platform_module_t	module;
+
+		if (!GetModuleInformation(GetCurrentProcess(), modules[i], &info, sizeof(info)))
+			continue;
+		if (!GetModuleFileNameExA(GetCurrentProcess(), modules[i], path, sizeof(path)))
+			continue;
+
+		// images are mapped whole, so the file offset of the base is always zero
+		module.start = (uintptr_t)info.lpBaseOfDll;
+		module.end = module.start + info.SizeOfImage;
+		module.offset = 0;
+		module.path = path;
+		callback_fp(&module, context);
+	}
+
+	return 0;
+}
+
+#endif
@@ -0,0 +1,303 @@
+#ifndef _WIN32
+
+// Replaces the C runtime's allocator for a whole process, so that libraries calling malloc directly are tracked too:
+//
+//     LD_PRELOAD=./libmanagedmalloc_preload.so program
+//
+// Everything the library itself allocates goes to glibc instead, and so does anything allocated before the library
+// is initialized. Those blocks are told apart from managed ones by the registry, so either kind can be freed anywhere.
+// Configured through the environment, read once on the first allocation:
+//
+//     MEM_PRELOAD_TRACKING=0			forward every call to glibc, to measure the cost of the interposer itself
+//     MEM_PRELOAD_BACKTRACE=depth		see Mem_SetBacktraceDepth
+//     MEM_PRELOAD_SAMPLE_RATE=bytes	see Mem_SetSampleRate
+//     MEM_PRELOAD_LIMIT=bytes			see Mem_SetMemoryLimit, allocations over it return NULL
+//     MEM_PRELOAD_SLAB=1				see Mem_SetSlabBackend
+//     MEM_PRELOAD_PROFILE=path			write a heap profile on exit, see Mem_WriteHeapProfile
+
+#define _GNU_SOURCE		// for RTLD_NEXT
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <dlfcn.h>
+
+#include "../inc/platform.h"
+#include "../inc/memory.h"
+
+#define PRELOAD_ALIGNMENT			16		// what glibc guarantees, and what callers count on
+
+#define PRELOAD_STATE_NONE			0
+#define PRELOAD_STATE_STARTING		1		// being initialized, every call goes to glibc until it's done
+#define PRELOAD_STATE_TRACKING		2
+#define PRELOAD_STATE_FORWARDING	3		// MEM_PRELOAD_TRACKING=0
+
+// glibc's own entry points, which unlike dlsym never allocate
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+typedef struct preload_s
+{
+	volatile int32_t	state;
+	size_t				(*usable_size_fp)(void *ptr);	// glibc's malloc_usable_size, only looked up when first needed
+	const char			*profile_path;
+}preload_t;
+
+static preload_t g_preload =
+{
+	.state = PRELOAD_STATE_NONE,
+	.usable_size_fp = 0,
+	.profile_path = 0,
+};
+
+// Nonzero while the calling thread is inside the library, whose own allocations (and those libc makes on its behalf)
+// go to glibc. Initial-exec, so that reading it can never allocate.
+static __thread int g_preload_depth __attribute__((tls_model("initial-exec"))) = 0;
+
+static size_t Preload_EnvSize(const char *name, size_t fallback)
+{
+	const char *value = getenv(name);
+
+	return value && *value ? (size_t)strtoull(value, 0, 0) : fallback;
+}
+
+static void Preload_Init()
+{
+	if (Atomic_CompareExchange32(&g_preload.state, PRELOAD_STATE_STARTING, PRELOAD_STATE_NONE) != PRELOAD_STATE_NONE)
+		return;
+
+	g_preload_depth++;
+	if (Preload_EnvSize("MEM_PRELOAD_TRACKING", 1))
+	{
+		Mem_Init();
+		// the caller sees a failed allocation as NULL and ENOMEM, as it would from glibc
+		Mem_SetMallocFailCallback(0);
+		Mem_SetBacktraceDepth((uint32_t)Preload_EnvSize("MEM_PRELOAD_BACKTRACE", 0));
+		Mem_SetSampleRate(Preload_EnvSize("MEM_PRELOAD_SAMPLE_RATE", 0));
+		Mem_SetMemoryLimit(Preload_EnvSize("MEM_PRELOAD_LIMIT", 0));
+		Mem_SetSlabBackend(Preload_EnvSize("MEM_PRELOAD_SLAB", 0) != 0);
+		g_preload.profile_path = getenv("MEM_PRELOAD_PROFILE");
+		Atomic_Exchange32(&g_preload.state, PRELOAD_STATE_TRACKING);
+	}
+	else
+		Atomic_Exchange32(&g_preload.state, PRELOAD_STATE_FORWARDING);
+	g_preload_depth--;
+}
+
+// Returns nonzero if the call is to be tracked, in which case Preload_Leave has to follow
+static __forceinline int Preload_Enter()
+{
+	if (g_preload_depth)
+		return 0;
+	if (g_preload.state != PRELOAD_STATE_TRACKING)
+	{
+		Preload_Init();
+		if (g_preload.state != PRELOAD_STATE_TRACKING)
+			return 0;
+	}
+
+	g_preload_depth++;
+
+	return 1;
+}
+static __forceinline void Preload_Leave()
+{
+	g_preload_depth--;
+}
+
+// Only called between Preload_Enter and Preload_Leave. Every block is recorded as allocated by the interposer, so
+// set MEM_PRELOAD_BACKTRACE to tell the callers apart.
+static void *Preload_Malloc(size_t size, size_t alignment, const char *function, int line)
+{
+	void *ptr;
+
+	if (alignment > UINT32_MAX)
+	{
+		errno = ENOMEM;
+		return 0;
+	}
+
+	ptr = Mem_MallocAligned_IMP(size, (uint32_t)alignment, __FILE__, function, line);
+	if (!ptr)
+		errno = ENOMEM;
+
+	return ptr;
+}
+// alignment is a power of two
+static void *Preload_Memalign(size_t alignment, size_t size, const char *function, int line)
+{
+	void *ptr;
+
+	if (!Preload_Enter())
+		return __libc_memalign(alignment, size);
+
+	ptr = Preload_Malloc(size, alignment < PRELOAD_ALIGNMENT ? PRELOAD_ALIGNMENT : alignment, function, line);
+	Preload_Leave();
+
+	return ptr;
+}
+
+void *malloc(size_t size)
+{
+	void *ptr;
+
+	if (!Preload_Enter())
+		return __libc_malloc(size);
+
+	ptr = Preload_Malloc(size, PRELOAD_ALIGNMENT, __FUNCTION__, __LINE__);
+	Preload_Leave();
+
+	return ptr;
+}
+void *calloc(size_t count, size_t size)
+{
+	void *ptr;
+
+	if (size && count > SIZE_MAX / size)
+	{
+		errno = ENOMEM;
+		return 0;
+	}
+	if (!Preload_Enter())
+		return __libc_calloc(count, size);
+
+	ptr = Preload_Malloc(count * size, PRELOAD_ALIGNMENT, __FUNCTION__, __LINE__);
+	Preload_Leave();
+	if (ptr)
+		memset(ptr, 0, count * size);
+
+	return ptr;
+}
+void *realloc(void *ptr, size_t size)
+{
+	void *new_ptr;
+
+	if (!ptr)
+		return malloc(size);
+	if (!Preload_Enter())
+		return __libc_realloc(ptr, size);
+
+	// a block glibc handed out stays with glibc
+	if (!Mem_IsManaged(ptr))
+	{
+		Preload_Leave();
+		return __libc_realloc(ptr, size);
+	}
+
+	// glibc frees the block and returns NULL, so do the same
+	if (size == 0)
+	{
+		Mem_TryFree(ptr);
+		Preload_Leave();
+		return 0;
+	}
+
+	new_ptr = Mem_ReallocAligned_IMP(ptr, size, PRELOAD_ALIGNMENT, __FILE__, __FUNCTION__, __LINE__);
+	Preload_Leave();
+	if (!new_ptr)
+		errno = ENOMEM;
+
+	return new_ptr;
+}
+void free(void *ptr)
+{
+	int ret;
+
+	if (!ptr)
+		return;
+	if (Preload_Enter())
+	{
+		// only a block the library has never seen goes to glibc. One with a corrupt header was reported by Mem_TryFree,
+		// and glibc never allocated it.
+		ret = Mem_TryFree(ptr);
+		Preload_Leave();
+		if (ret != -1)
+			return;
+	}
+
+	__libc_free(ptr);
+}
+void *memalign(size_t alignment, size_t size)
+{
+	// glibc rounds any other alignment up to a power of two
+	if (alignment & (alignment - 1))
+	{
+		if (alignment > SIZE_MAX / 2 + 1)
+		{
+			errno = ENOMEM;
+			return 0;
+		}
+		alignment = (size_t)1 << (Platform_HighestBit(alignment) + 1);
+	}
+
+	return Preload_Memalign(alignment, size, __FUNCTION__, __LINE__);
+}
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	if (alignment & (alignment - 1))
+	{
+		errno = EINVAL;
+		return 0;
+	}
+
+	return Preload_Memalign(alignment, size, __FUNCTION__, __LINE__);
+}
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	void *ptr;
+	int saved_errno = errno;
+
+	if (alignment < sizeof(void*) || (alignment & (alignment - 1)))
+		return EINVAL;
+
+	ptr = Preload_Memalign(alignment, size, __FUNCTION__, __LINE__);
+	if (!ptr)
+	{
+		errno = saved_errno;
+		return ENOMEM;
+	}
+	*memptr = ptr;
+
+	return 0;
+}
+size_t malloc_usable_size(void *ptr)
+{
+	size_t size;
+
+	if (!ptr)
+		return 0;
+	if (Preload_Enter())
+	{
+		int managed = Mem_IsManaged(ptr);
+
+		size = managed ? Mem_MemSize(ptr) : 0;
+		Preload_Leave();
+		if (managed)
+			return size;
+	}
+
+	if (!g_preload.usable_size_fp)
+	{
+		// dlsym can allocate, which has to go to glibc
+		g_preload_depth++;
+		g_preload.usable_size_fp = (size_t (*)(void*))dlsym(RTLD_NEXT, "malloc_usable_size");
+		g_preload_depth--;
+	}
+
+	return g_preload.usable_size_fp ? g_preload.usable_size_fp(ptr) : 0;
+}
+
+static __attribute__((destructor)) void Preload_Exit()
+{
+	if (g_preload.state != PRELOAD_STATE_TRACKING || !g_preload.profile_path)
+		return;
+
+	g_preload_depth++;
+	Mem_WriteHeapProfile(g_preload.profile_path);
+	g_preload_depth--;
+}
+
+#endif
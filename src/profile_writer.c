@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "../inc/platform.h"
+#include "../inc/hash_table.h"
+#include "../inc/symbol_cache.h"
+#include "../inc/profile_writer.h"
+
+// Field numbers of profile.proto. Repeated fields may be interleaved freely, so strings, mappings, functions and
+// locations are each written just before the first message referring to them.
+#define PROFILE_SAMPLE_TYPE				1
+#define PROFILE_SAMPLE					2
+#define PROFILE_MAPPING					3
+#define PROFILE_LOCATION				4
+#define PROFILE_FUNCTION				5
+#define PROFILE_STRING_TABLE			6
+#define PROFILE_TIME_NANOS				9
+#define PROFILE_PERIOD_TYPE				11
+#define PROFILE_DEFAULT_SAMPLE_TYPE		14
+
+#define PROFILE_WIRE_VARINT				0
+#define PROFILE_WIRE_BYTES				2
+
+#define PROFILE_MAX_VARINT				10
+#define PROFILE_MIN_BUFFER				256
+
+// Call-site locations have no address, so their ids (and their functions') are kept apart from the address-based ones
+#define PROFILE_SITE_ID					((uint64_t)1 << 63)
+
+static const char *g_sample_types[PROFILE_NUM_VALUES][2] =
+{
+	{"alloc_objects", "count"},
+	{"alloc_space", "bytes"},
+	{"inuse_objects", "count"},
+	{"inuse_space", "bytes"},
+};
+
+static __forceinline size_t ProfileWriter_EncodeVarint(uint8_t *out, uint64_t value)
+{
+	size_t size = 0;
+
+	while (value >= 0x80)
+	{
+		out[size++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	out[size++] = (uint8_t)value;
+
+	return size;
+}
+
+static __forceinline size_t ProfileWriter_VarintSize(uint64_t value)
+{
+	size_t size = 1;
+
+	while (value >= 0x80)
+	{
+		value >>= 7;
+		size++;
+	}
+
+	return size;
+}
+
+static void ProfileWriter_Write(profile_writer_t *writer, const void *data, size_t size)
+{
+	if (size && fwrite(data, 1, size, writer->file) != size)
+		writer->failed = 1;
+}
+
+// Writes a top-level field straight to the file, for the ones that aren't messages
+static void ProfileWriter_WriteField(profile_writer_t *writer, int field, int wire, uint64_t value)
+{
+	uint8_t prefix[2 * PROFILE_MAX_VARINT];
+	size_t size;
+
+	size = ProfileWriter_EncodeVarint(prefix, ((uint64_t)field << 3) | (uint64_t)wire);
+	size += ProfileWriter_EncodeVarint(prefix + size, value);
+	ProfileWriter_Write(writer, prefix, size);
+}
+
+// Returns the index of the string in the string table
+static int64_t ProfileWriter_String(profile_writer_t *writer, const char *string)
+{
+	size_t length = strlen(string);
+
+	ProfileWriter_WriteField(writer, PROFILE_STRING_TABLE, PROFILE_WIRE_BYTES, length);
+	ProfileWriter_Write(writer, string, length);
+
+	return writer->num_strings++;
+}
+
+static void ProfileWriter_Varint(profile_writer_t *writer, uint64_t value)
+{
+	if (writer->buffer_size + PROFILE_MAX_VARINT > writer->buffer_capacity)
+	{
+		size_t capacity = writer->buffer_capacity ? writer->buffer_capacity * 2 : PROFILE_MIN_BUFFER;
+		uint8_t *buffer = realloc(writer->buffer, capacity);
+
+		if (!buffer)
+		{
+			writer->failed = 1;
+			return;
+		}
+		writer->buffer = buffer;
+		writer->buffer_capacity = capacity;
+	}
+
+	writer->buffer_size += ProfileWriter_EncodeVarint(writer->buffer + writer->buffer_size, value);
+}
+
+static __forceinline void ProfileWriter_Key(profile_writer_t *writer, int field, int wire)
+{
+	ProfileWriter_Varint(writer, ((uint64_t)field << 3) | (uint64_t)wire);
+}
+
+// Adds a field to the message being built, leaving it out if zero like any proto3 default
+static void ProfileWriter_Field(profile_writer_t *writer, int field, uint64_t value)
+{
+	if (value)
+	{
+		ProfileWriter_Key(writer, field, PROFILE_WIRE_VARINT);
+		ProfileWriter_Varint(writer, value);
+	}
+}
+
+// Writes the message that was built as a top-level field, and starts the next one
+static void ProfileWriter_Emit(profile_writer_t *writer, int field)
+{
+	ProfileWriter_WriteField(writer, field, PROFILE_WIRE_BYTES, writer->buffer_size);
+	ProfileWriter_Write(writer, writer->buffer, writer->buffer_size);
+	writer->buffer_size = 0;
+}
+
+// Adds Location.line, a Line message of function_id and line
+static void ProfileWriter_Line(profile_writer_t *writer, uint64_t function_id, int line)
+{
+	size_t size = 1 + ProfileWriter_VarintSize(function_id);
+
+	if (line > 0)
+		size += 1 + ProfileWriter_VarintSize((uint64_t)line);
+
+	ProfileWriter_Key(writer, 4, PROFILE_WIRE_BYTES);
+	ProfileWriter_Varint(writer, size);
+	ProfileWriter_Field(writer, 1, function_id);
+	if (line > 0)
+		ProfileWriter_Field(writer, 2, (uint64_t)line);
+}
+
+// Adds Sample.value, packed
+static void ProfileWriter_Values(profile_writer_t *writer, const int64_t *values)
+{
+	size_t size = 0;
+	int i;
+
+	for (i = 0; i < PROFILE_NUM_VALUES; i++)
+		size += ProfileWriter_VarintSize((uint64_t)values[i]);
+
+	ProfileWriter_Key(writer, 2, PROFILE_WIRE_BYTES);
+	ProfileWriter_Varint(writer, size);
+	for (i = 0; i < PROFILE_NUM_VALUES; i++)
+		ProfileWriter_Varint(writer, (uint64_t)values[i]);
+}
+
+// Returns nonzero if the key was already marked, or couldn't be
+static int ProfileWriter_Mark(profile_writer_t *writer, hash_table_t *seen, void *key)
+{
+	if (HashTable_Contains(seen, key))
+		return 1;
+
+	// an unmarked key would be written twice, which makes the whole profile invalid
+	if (HashTable_Insert(seen, key))
+	{
+		writer->failed = 1;
+		return 1;
+	}
+
+	return 0;
+}
+
+static void ProfileWriter_Function(profile_writer_t *writer, hash_table_t *seen, uint64_t id, const char *name, const char *file)
+{
+	int64_t name_index;
+	int64_t file_index;
+
+	if (ProfileWriter_Mark(writer, seen, (void*)name))
+		return;
+
+	name_index = ProfileWriter_String(writer, name);
+	file_index = file ? ProfileWriter_String(writer, file) : 0;
+
+	ProfileWriter_Field(writer, 1, id);
+	ProfileWriter_Field(writer, 2, (uint64_t)name_index);
+	ProfileWriter_Field(writer, 3, (uint64_t)name_index);
+	ProfileWriter_Field(writer, 4, (uint64_t)file_index);
+	ProfileWriter_Emit(writer, PROFILE_FUNCTION);
+}
+
+static void ProfileWriter_MappingCB(const platform_module_t *module, void *context)
+{
+	profile_writer_t *writer = (profile_writer_t*)context;
+	int64_t filename;
+
+	if (writer->num_mappings == writer->mapping_capacity)
+	{
+		size_t capacity = writer->mapping_capacity ? writer->mapping_capacity * 2 : 64;
+		profile_mapping_t *mapping = realloc(writer->mapping, capacity * sizeof(profile_mapping_t));
+
+		if (!mapping)
+		{
+			writer->failed = 1;
+			return;
+		}
+		writer->mapping = mapping;
+		writer->mapping_capacity = capacity;
+	}
+
+	writer->mapping[writer->num_mappings].start = module->start;
+	writer->mapping[writer->num_mappings].end = module->end;
+	writer->num_mappings++;
+
+	filename = ProfileWriter_String(writer, module->path);
+
+	ProfileWriter_Field(writer, 1, writer->num_mappings);
+	ProfileWriter_Field(writer, 2, module->start);
+	ProfileWriter_Field(writer, 3, module->end);
+	ProfileWriter_Field(writer, 4, module->offset);
+	ProfileWriter_Field(writer, 5, (uint64_t)filename);
+	ProfileWriter_Emit(writer, PROFILE_MAPPING);
+}
+
+// Writes the location of a return address, if it hasn't been already. Its id is the address itself.
+static void ProfileWriter_Frame(profile_writer_t *writer, void *address)
+{
+	const symbol_t *symbol;
+	uint64_t mapping_id = 0;
+	size_t i;
+
+	if (ProfileWriter_Mark(writer, &writer->frames, address))
+		return;
+
+	symbol = SymbolCache_Resolve(address);
+	if (symbol && symbol->function)
+		ProfileWriter_Function(writer, &writer->functions, (uint64_t)(uintptr_t)symbol->function, symbol->function, symbol->file);
+
+	for (i = 0; i < writer->num_mappings; i++)
+	{
+		if ((uintptr_t)address >= writer->mapping[i].start && (uintptr_t)address < writer->mapping[i].end)
+		{
+			mapping_id = i + 1;
+			break;
+		}
+	}
+
+	ProfileWriter_Field(writer, 1, (uint64_t)(uintptr_t)address);
+	ProfileWriter_Field(writer, 2, mapping_id);
+	ProfileWriter_Field(writer, 3, (uint64_t)(uintptr_t)address - 1);	// inside the call instruction, for symbolizers
+	if (symbol && symbol->function)
+		ProfileWriter_Line(writer, (uint64_t)(uintptr_t)symbol->function, symbol->line);
+	ProfileWriter_Emit(writer, PROFILE_LOCATION);
+}
+
+int ProfileWriter_Open(profile_writer_t *writer, const char *path)
+{
+	int64_t type[PROFILE_NUM_VALUES];
+	int i;
+
+	memset(writer, 0, sizeof(profile_writer_t));
+	HashTable_Init(&writer->frames);
+	HashTable_Init(&writer->lines);
+	HashTable_Init(&writer->functions);
+	HashTable_Init(&writer->site_functions);
+
+	writer->file = fopen(path, "wb");
+	if (!writer->file)
+		return -1;
+
+	ProfileWriter_String(writer, "");
+
+	for (i = 0; i < PROFILE_NUM_VALUES; i++)
+	{
+		type[i] = ProfileWriter_String(writer, g_sample_types[i][0]);
+		ProfileWriter_Field(writer, 1, (uint64_t)type[i]);
+		ProfileWriter_Field(writer, 2, (uint64_t)ProfileWriter_String(writer, g_sample_types[i][1]));
+		ProfileWriter_Emit(writer, PROFILE_SAMPLE_TYPE);
+	}
+	ProfileWriter_Field(writer, 1, (uint64_t)ProfileWriter_String(writer, "space"));
+	ProfileWriter_Field(writer, 2, (uint64_t)ProfileWriter_String(writer, "bytes"));
+	ProfileWriter_Emit(writer, PROFILE_PERIOD_TYPE);
+	ProfileWriter_WriteField(writer, PROFILE_DEFAULT_SAMPLE_TYPE, PROFILE_WIRE_VARINT, (uint64_t)type[3]);
+	ProfileWriter_WriteField(writer, PROFILE_TIME_NANOS, PROFILE_WIRE_VARINT, (uint64_t)time(NULL) * 1000000000ull);
+
+	// without the mappings the addresses can't be symbolized anywhere else, but the names resolved here still work
+	Platform_EnumerateModules(writer, ProfileWriter_MappingCB);
+
+	return 0;
+}
+
+void ProfileWriter_StackSample(profile_writer_t *writer, void **stack, int entries, const int64_t *values)
+{
+	size_t size = 0;
+	int i;
+
+	for (i = 0; i < entries; i++)
+	{
+		ProfileWriter_Frame(writer, stack[i]);
+		size += ProfileWriter_VarintSize((uint64_t)(uintptr_t)stack[i]);
+	}
+
+	// leaf first, like the stack
+	ProfileWriter_Key(writer, 1, PROFILE_WIRE_BYTES);
+	ProfileWriter_Varint(writer, size);
+	for (i = 0; i < entries; i++)
+		ProfileWriter_Varint(writer, (uint64_t)(uintptr_t)stack[i]);
+	ProfileWriter_Values(writer, values);
+	ProfileWriter_Emit(writer, PROFILE_SAMPLE);
+}
+
+void ProfileWriter_LineSample(profile_writer_t *writer, uint32_t key, const char *file, const char *function, int line, const int64_t *values)
+{
+	uint64_t id = PROFILE_SITE_ID | key;
+
+	if (!ProfileWriter_Mark(writer, &writer->lines, (void*)(uintptr_t)key))
+	{
+		if (function)
+			ProfileWriter_Function(writer, &writer->site_functions, PROFILE_SITE_ID | (uint64_t)(uintptr_t)function, function, file);
+
+		ProfileWriter_Field(writer, 1, id);
+		if (function)
+			ProfileWriter_Line(writer, PROFILE_SITE_ID | (uint64_t)(uintptr_t)function, line);
+		ProfileWriter_Emit(writer, PROFILE_LOCATION);
+	}
+
+	ProfileWriter_Key(writer, 1, PROFILE_WIRE_BYTES);
+	ProfileWriter_Varint(writer, ProfileWriter_VarintSize(id));
+	ProfileWriter_Varint(writer, id);
+	ProfileWriter_Values(writer, values);
+	ProfileWriter_Emit(writer, PROFILE_SAMPLE);
+}
+
+int ProfileWriter_Close(profile_writer_t *writer)
+{
+	int failed = writer->failed;
+
+	if (fclose(writer->file))
+		failed = 1;
+
+	free(writer->buffer);
+	free(writer->mapping);
+	HashTable_Destroy(&writer->frames, 0, 0);
+	HashTable_Destroy(&writer->lines, 0, 0);
+	HashTable_Destroy(&writer->functions, 0, 0);
+	HashTable_Destroy(&writer->site_functions, 0, 0);
+	memset(writer, 0, sizeof(profile_writer_t));
+
+	return failed ? -1 : 0;
+}
@@ -0,0 +1,94 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "../inc/platform.h"
+#include "../inc/intern_table.h"
+#include "../inc/stack_depot.h"
+
+typedef struct stack_record_s
+{
+	intern_record_t		intern;
+	int					num_entries;
+	void				*entry[1];
+}stack_record_t;
+
+typedef struct stack_key_s
+{
+	void	**stack;
+	int		num_entries;
+}stack_key_t;
+
+static intern_table_t g_depot = INTERNTABLE_INIT;
+
+static __forceinline uint32_t StackDepot_Hash(void **stack, int num_entries)
+{
+	uint64_t h = 0xCBF29CE484222325ull ^ (uint64_t)num_entries;
+	int i;
+
+	for (i = 0; i < num_entries; i++)
+	{
+		h ^= (uint64_t)(uintptr_t)stack[i];
+		h *= 0x9E3779B97F4A7C15ull;
+		h ^= h >> 29;
+	}
+
+	return (uint32_t)(h ^ (h >> 32));
+}
+
+static int StackDepot_Equal(const intern_record_t *record, const void *key)
+{
+	const stack_record_t *stack_record = (const stack_record_t*)record;
+	const stack_key_t *stack_key = (const stack_key_t*)key;
+
+	return stack_record->num_entries == stack_key->num_entries && !memcmp(stack_record->entry, stack_key->stack, sizeof(void*) * stack_key->num_entries);
+}
+
+static void StackDepot_Init(intern_record_t *record, const void *key, void *context)
+{
+	stack_record_t *stack_record = (stack_record_t*)record;
+	const stack_key_t *stack_key = (const stack_key_t*)key;
+
+	stack_record->num_entries = stack_key->num_entries;
+	memcpy(stack_record->entry, stack_key->stack, sizeof(void*) * stack_key->num_entries);
+}
+
+uint32_t StackDepot_Intern(void **stack, int num_entries)
+{
+	stack_key_t key;
+
+	key.stack = stack;
+	key.num_entries = num_entries;
+
+	return InternTable_Intern(&g_depot, StackDepot_Hash(stack, num_entries), &key,
+		offsetof(stack_record_t, entry) + sizeof(void*) * (num_entries ? num_entries : 1), StackDepot_Equal, StackDepot_Init, 0);
+}
+
+int StackDepot_Get(uint32_t id, void ***stack)
+{
+	stack_record_t *record = (stack_record_t*)InternTable_Get(&g_depot, id);
+
+	*stack = 0;
+
+	if (!record)
+		return 0;
+
+	*stack = record->entry;
+
+	return record->num_entries;
+}
+
+uint32_t StackDepot_Count()
+{
+	return InternTable_Count(&g_depot);
+}
+
+size_t StackDepot_MemUsed()
+{
+	return InternTable_MemUsed(&g_depot);
+}
+
+void StackDepot_Destroy()
+{
+	InternTable_Destroy(&g_depot);
+}
@@ -0,0 +1,289 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "../inc/platform.h"
+#include "../inc/symbol_cache.h"
+
+#define SYMBOLCACHE_MIN_CAPACITY		1024	// power-of-two
+#define SYMBOLCACHE_CHUNK_SIZE			65536	// records and strings are bump-allocated from chunks of this size
+#define SYMBOLCACHE_MAX_NAME			2048
+
+typedef struct symbol_cache_s
+{
+	mutex_t				mutex;				// shared for lookups, exclusive to resolve and insert
+	symbol_t			**symbol;			// open-addressing, keyed by address
+	size_t				symbol_capacity;
+	size_t				symbol_count;
+	char				**string;			// open-addressing set of interned strings
+	size_t				string_capacity;
+	size_t				string_count;
+	char				*chunk;
+	size_t				chunk_used;
+	size_t				chunk_size;
+	void				*chunks;			// every chunk, singly linked through its first word
+	size_t				memory_used;
+}symbol_cache_t;
+
+static symbol_cache_t g_symbols =
+{
+	.mutex = MUTEX_INIT,
+	.symbol = 0,
+	.symbol_capacity = 0,
+	.symbol_count = 0,
+	.string = 0,
+	.string_capacity = 0,
+	.string_count = 0,
+	.chunk = 0,
+	.chunk_used = 0,
+	.chunk_size = 0,
+	.chunks = 0,
+	.memory_used = 0,
+};
+
+static __forceinline size_t SymbolCache_HashAddress(void *address)
+{
+	uint64_t h = (uint64_t)(uintptr_t)address * 0x9E3779B97F4A7C15ull;
+
+	return (size_t)(h ^ (h >> 32));
+}
+
+static __forceinline size_t SymbolCache_HashString(const char *string)
+{
+	uint64_t h = 0xCBF29CE484222325ull;
+
+	while (*string)
+	{
+		h ^= (unsigned char)*string++;
+		h *= 0x100000001B3ull;
+	}
+
+	return (size_t)(h ^ (h >> 32));
+}
+
+// Everything below is only called with the mutex locked exclusively
+
+static void *SymbolCache_Alloc(size_t size)
+{
+	void *ptr;
+
+	size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+
+	if (!g_symbols.chunk || g_symbols.chunk_used + size > g_symbols.chunk_size)
+	{
+		size_t chunk_size = size + sizeof(void*) > SYMBOLCACHE_CHUNK_SIZE ? size + sizeof(void*) : SYMBOLCACHE_CHUNK_SIZE;
+		char *chunk = malloc(chunk_size);
+
+		if (!chunk)
+			return 0;
+
+		*(void**)chunk = g_symbols.chunks;
+		g_symbols.chunks = chunk;
+		g_symbols.chunk = chunk;
+		g_symbols.chunk_used = sizeof(void*);
+		g_symbols.chunk_size = chunk_size;
+		g_symbols.memory_used += chunk_size;
+	}
+
+	ptr = g_symbols.chunk + g_symbols.chunk_used;
+	g_symbols.chunk_used += size;
+
+	return ptr;
+}
+
+static int SymbolCache_Grow(void ***table, size_t *capacity, size_t (*hash_fp)(void *value))
+{
+	size_t new_capacity = *capacity ? *capacity * 2 : SYMBOLCACHE_MIN_CAPACITY;
+	void **new_table = calloc(new_capacity, sizeof(void*));
+	size_t i;
+
+	if (!new_table)
+		return -1;
+
+	for (i = 0; i < *capacity; i++)
+	{
+		size_t index;
+
+		if (!(*table)[i])
+			continue;
+
+		index = hash_fp((*table)[i]) & (new_capacity - 1);
+		while (new_table[index])
+			index = (index + 1) & (new_capacity - 1);
+		new_table[index] = (*table)[i];
+	}
+
+	g_symbols.memory_used += (new_capacity - *capacity) * sizeof(void*);
+	free(*table);
+	*table = new_table;
+	*capacity = new_capacity;
+
+	return 0;
+}
+
+static size_t SymbolCache_SymbolHash(void *value)
+{
+	return SymbolCache_HashAddress(((symbol_t*)value)->address);
+}
+
+static size_t SymbolCache_StringHash(void *value)
+{
+	return SymbolCache_HashString((char*)value);
+}
+
+static const char *SymbolCache_Intern(const char *string)
+{
+	size_t index;
+	size_t len;
+	char *copy;
+
+	if (!string)
+		return 0;
+
+	if ((g_symbols.string_count + 1) * 2 > g_symbols.string_capacity)
+	{
+		if (SymbolCache_Grow((void***)&g_symbols.string, &g_symbols.string_capacity, SymbolCache_StringHash))
+			return 0;
+	}
+
+	index = SymbolCache_HashString(string) & (g_symbols.string_capacity - 1);
+	while (g_symbols.string[index])
+	{
+		if (!strcmp(g_symbols.string[index], string))
+			return g_symbols.string[index];
+		index = (index + 1) & (g_symbols.string_capacity - 1);
+	}
+
+	len = strlen(string);
+	copy = SymbolCache_Alloc(len + 1);
+	if (!copy)
+		return 0;
+
+	memcpy(copy, string, len + 1);
+	g_symbols.string[index] = copy;
+	g_symbols.string_count++;
+
+	return copy;
+}
+
+static void SymbolCache_Lookup(symbol_t *symbol)
+{
+	char file[SYMBOLCACHE_MAX_NAME];
+	char function[SYMBOLCACHE_MAX_NAME];
+	int line;
+
+	if (Platform_ResolveSymbol(symbol->address, file, sizeof(file), function, sizeof(function), &line))
+		return;
+
+	symbol->file = SymbolCache_Intern(file);
+	symbol->function = SymbolCache_Intern(function);
+	symbol->line = line;
+}
+
+static const symbol_t *SymbolCache_Find(void *address)
+{
+	size_t index;
+
+	if (!g_symbols.symbol_capacity)
+		return 0;
+
+	index = SymbolCache_HashAddress(address) & (g_symbols.symbol_capacity - 1);
+	while (g_symbols.symbol[index])
+	{
+		if (g_symbols.symbol[index]->address == address)
+			return g_symbols.symbol[index];
+		index = (index + 1) & (g_symbols.symbol_capacity - 1);
+	}
+
+	return 0;
+}
+
+const symbol_t *SymbolCache_Resolve(void *address)
+{
+	const symbol_t *found;
+	symbol_t *symbol;
+	size_t index;
+
+	Mutex_LockShared(&g_symbols.mutex);
+	found = SymbolCache_Find(address);
+	Mutex_UnlockShared(&g_symbols.mutex);
+
+	if (found)
+		return found;
+
+	Mutex_Lock(&g_symbols.mutex);
+
+	found = SymbolCache_Find(address);
+	if (found)
+	{
+		Mutex_Unlock(&g_symbols.mutex);
+		return found;
+	}
+
+	if ((g_symbols.symbol_count + 1) * 2 > g_symbols.symbol_capacity)
+	{
+		if (SymbolCache_Grow((void***)&g_symbols.symbol, &g_symbols.symbol_capacity, SymbolCache_SymbolHash))
+		{
+			Mutex_Unlock(&g_symbols.mutex);
+			return 0;
+		}
+	}
+
+	symbol = SymbolCache_Alloc(sizeof(symbol_t));
+	if (!symbol)
+	{
+		Mutex_Unlock(&g_symbols.mutex);
+		return 0;
+	}
+
+	// unresolvable addresses are cached too, so they're only ever looked up once. This is always called with the cache
+	// locked exclusively, which also serialises the resolver (DbgHelp isn't thread-safe).
+	symbol->address = address;
+	symbol->file = 0;
+	symbol->function = 0;
+	symbol->line = 0;
+	SymbolCache_Lookup(symbol);
+
+	index = SymbolCache_HashAddress(address) & (g_symbols.symbol_capacity - 1);
+	while (g_symbols.symbol[index])
+		index = (index + 1) & (g_symbols.symbol_capacity - 1);
+	g_symbols.symbol[index] = symbol;
+	g_symbols.symbol_count++;
+
+	Mutex_Unlock(&g_symbols.mutex);
+
+	return symbol;
+}
+
+size_t SymbolCache_MemUsed()
+{
+	return g_symbols.memory_used;
+}
+
+void SymbolCache_Destroy()
+{
+	void *chunk = g_symbols.chunks;
+
+	while (chunk)
+	{
+		void *next = *(void**)chunk;
+
+		free(chunk);
+		chunk = next;
+	}
+
+	free(g_symbols.symbol);
+	free(g_symbols.string);
+
+	g_symbols.symbol = 0;
+	g_symbols.symbol_capacity = 0;
+	g_symbols.symbol_count = 0;
+	g_symbols.string = 0;
+	g_symbols.string_capacity = 0;
+	g_symbols.string_count = 0;
+	g_symbols.chunk = 0;
+	g_symbols.chunk_used = 0;
+	g_symbols.chunk_size = 0;
+	g_symbols.chunks = 0;
+	g_symbols.memory_used = 0;
+}
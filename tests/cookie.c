@@ -0,0 +1,265 @@
+// Double frees, foreign pointers and corrupted headers, with the registry on and off. Prints OK and exits 0 on success.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "../inc/memory.h"
+
+#define CHECK(cond) do { if (!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); exit(1); } } while (0)
+
+static volatile int g_failures[8];
+static void *volatile g_last;
+
+static void OnFreeFail(int type, void *old_block, size_t max_memory, size_t memory_remaining)
+{
+	__atomic_add_fetch(&g_failures[type], 1, __ATOMIC_SEQ_CST);
+	g_last = old_block;
+}
+
+// Checks that exactly count failures of type were reported since the last call, and the last was for block
+static void Expect(int type, int count, void *block)
+{
+	static int seen[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+	{
+		CHECK(g_failures[i] - seen[i] == (i == type ? count : 0));
+		seen[i] = g_failures[i];
+	}
+	if (count)
+		CHECK(g_last == block);
+}
+
+static void TestDoubleFree()
+{
+	char *small = Mem_Malloc(40);
+	char *big = Mem_Malloc(200000);
+	char *large = Mem_Malloc(3 << 20);
+	char *moved;
+	void *batch[4];
+
+	Mem_Free(small);
+	Mem_Free(small);
+	Expect(FREE_FAILURE_DANGLING, 1, small);
+	Mem_Free(big);
+	Mem_Free(big);
+	Expect(FREE_FAILURE_DANGLING, 1, big);
+	Mem_Free(large);
+	CHECK(Mem_TryFree(large) != 0);
+	CHECK(Mem_Realloc(large, 10) == 0);
+	Expect(FREE_FAILURE_DANGLING, 1, large);
+
+	CHECK(Mem_MallocBatch(4, 24, batch) == 0);
+	Mem_Free(batch[2]);
+	small = batch[2];
+	Mem_FreeBatch(batch, 4);
+	Expect(FREE_FAILURE_DANGLING, 1, small);
+
+	// the C runtime moves a block that can't grow in place, which leaves the old pointer dangling
+	big = Mem_Malloc(2000);
+	small = Mem_Malloc(2000);
+	memset(big, 7, 2000);
+	moved = Mem_Realloc(big, 100000);
+	CHECK(moved && moved != big && moved[1999] == 7);
+	CHECK(!Mem_IsManaged(big));
+	Mem_Free(big);
+	Expect(FREE_FAILURE_DANGLING, 1, big);
+	Mem_Free(moved);
+	Mem_Free(small);
+	Expect(FREE_FAILURE_DANGLING, 0, 0);
+}
+
+static void TestForeign()
+{
+	char *heap = malloc(256);
+	char stack[256];
+
+	memset(heap, 0x5A, 256);
+	memset(stack, 0, sizeof(stack));
+	CHECK(!Mem_IsManaged(heap + 64));
+	CHECK(!Mem_IsManaged(stack + 128));
+	Mem_Free(heap + 64);
+	Expect(FREE_FAILURE_DANGLING, 1, heap + 64);
+	Mem_Free(stack + 128);
+	Expect(FREE_FAILURE_DANGLING, 1, stack + 128);
+	CHECK(Mem_TryFree(stack + 64) != 0);
+	Expect(FREE_FAILURE_DANGLING, 0, 0);
+	free(heap);
+}
+
+#ifndef MEM_COMPACT_HEADER
+static int CountBlock(const mem_block_info_t *block, void *context)
+{
+	(*(int*)context)++;
+	return 0;
+}
+static int Walk()
+{
+	int count = 0;
+
+	Mem_WalkAllocatedBlocks(&count, CountBlock);
+	return count;
+}
+
+static void TestCorruption()
+{
+	char *overwritten = Mem_Malloc(64);
+	char *overflowed;
+	char *resized = Mem_Malloc(64);
+
+	// a corrupt block is reported and left alone, so it never reaches the C runtime
+	((malloc_block_t*)overwritten)[-1].allocsize += 16;
+	Mem_Free(overwritten);
+	Expect(FREE_FAILURE_CORRUPT, 1, overwritten);
+	Mem_Free(overwritten);
+	Expect(FREE_FAILURE_DANGLING, 1, overwritten);
+
+	// an overflow from the block in front reaches the end of the header
+	overflowed = Mem_Malloc(40);
+	memset(overflowed - 8, 0x41, 8);
+	CHECK(Mem_Realloc(overflowed, 100) == 0);
+	Expect(FREE_FAILURE_CORRUPT, 1, overflowed);
+
+	((malloc_block_t*)resized)[-1].size_class ^= 1;
+	Mem_Free(resized);
+	Expect(FREE_FAILURE_CORRUPT, 1, resized);
+}
+
+static void *volatile g_shared;
+static pthread_barrier_t g_barrier;
+
+static void *RaceFree(void *arg)
+{
+	int i;
+
+	for (i = 0; i < 1000; i++)
+	{
+		pthread_barrier_wait(&g_barrier);
+		Mem_Free(g_shared);
+		pthread_barrier_wait(&g_barrier);
+	}
+	return 0;
+}
+
+static void TestUntracked()
+{
+	char *tracked = Mem_Malloc(100);
+	char *tracked_big = Mem_Malloc(200000);
+	char *tracked_large = Mem_Malloc(3 << 20);
+	int before = Walk();
+	char *untracked;
+	char *moved;
+	void *batch[300];
+	void *mixed[10];
+	pthread_t thread;
+	int i;
+
+	Mem_SetBlockRegistry(0);
+
+	untracked = Mem_Malloc(100);
+	CHECK(Walk() == before);
+	CHECK(Mem_IsManaged(untracked));
+	Mem_Free(untracked);
+	CHECK(!Mem_IsManaged(untracked));
+	Mem_Free(untracked);
+	Expect(FREE_FAILURE_DANGLING, 1, untracked);
+
+	// blocks allocated before the switch are still judged by the registry, even once their memory is gone
+	Mem_Free(tracked);
+	Mem_Free(tracked);
+	Expect(FREE_FAILURE_DANGLING, 1, tracked);
+	Mem_Free(tracked_big);
+	Mem_Free(tracked_big);
+	Expect(FREE_FAILURE_DANGLING, 1, tracked_big);
+	Mem_Free(tracked_large);
+	Mem_Free(tracked_large);
+	Expect(FREE_FAILURE_DANGLING, 1, tracked_large);
+	CHECK(Walk() == before - 3);
+
+	// as are the untracked ones whose memory went back to the OS
+	untracked = Mem_Malloc(3 << 20);
+	Mem_Free(untracked);
+	Mem_Free(untracked);
+	Expect(FREE_FAILURE_DANGLING, 1, untracked);
+
+	TestForeign();
+	TestCorruption();
+
+	// a block that moves leaves nothing live behind
+	untracked = Mem_Malloc(5000);
+	memset(untracked, 3, 5000);
+	moved = Mem_Realloc(untracked, 200000);
+	CHECK(moved && moved[4999] == 3);
+	if (moved != untracked)
+	{
+		Mem_Free(untracked);
+		Expect(FREE_FAILURE_DANGLING, 1, untracked);
+	}
+	moved = Mem_Realloc(moved, 5 << 20);
+	CHECK(moved && moved[4999] == 3);
+	untracked = Mem_Realloc(moved, 10);
+	CHECK(untracked && untracked[9] == 3);
+	Mem_Free(untracked);
+	Expect(FREE_FAILURE_DANGLING, 0, 0);
+
+	// a batch with a block in it twice
+	CHECK(Mem_MallocBatch(300, 48, batch) == 0);
+	CHECK(Walk() == before - 3);
+	untracked = batch[5];
+	batch[17] = untracked;
+	Mem_FreeBatch(batch, 300);
+	Expect(FREE_FAILURE_DANGLING, 1, untracked);
+
+	// and one mixing both kinds
+	Mem_SetBlockRegistry(1);
+	for (i = 0; i < 5; i++)
+		mixed[i] = Mem_Malloc(30);
+	Mem_SetBlockRegistry(0);
+	for (i = 5; i < 10; i++)
+		mixed[i] = Mem_Malloc(30);
+	CHECK(Walk() == before + 2);
+	Mem_FreeBatch(mixed, 10);
+	CHECK(Walk() == before - 3);
+	Expect(FREE_FAILURE_DANGLING, 0, 0);
+
+	// of two threads freeing a block at once, exactly one succeeds
+	pthread_barrier_init(&g_barrier, 0, 2);
+	pthread_create(&thread, 0, RaceFree, 0);
+	for (i = 0; i < 1000; i++)
+	{
+		g_shared = Mem_Malloc(24);
+		untracked = g_shared;
+		pthread_barrier_wait(&g_barrier);
+		Mem_Free(g_shared);
+		pthread_barrier_wait(&g_barrier);
+		Expect(FREE_FAILURE_DANGLING, 1, untracked);
+	}
+	pthread_join(thread, 0);
+	pthread_barrier_destroy(&g_barrier);
+
+	Mem_SetBlockRegistry(1);
+}
+#endif
+
+int main()
+{
+	Mem_Init();
+	if (getenv("MEM_TEST_SLAB"))
+		Mem_SetSlabBackend(1);
+	Mem_SetFreeDanglingCallback(OnFreeFail);
+
+	TestDoubleFree();
+	TestForeign();
+#ifndef MEM_COMPACT_HEADER
+	TestCorruption();
+	TestUntracked();
+	TestDoubleFree();
+#endif
+
+	Mem_Destroy();
+	printf("OK\n");
+
+	return 0;
+}
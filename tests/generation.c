@@ -0,0 +1,212 @@
+// Generations: per-line statistics since a mark, blocks that outlive more marks than a line keeps apart, the generation
+// walks report for each block, and a mark every few allocations for a long time without the call-site table growing.
+// Prints OK and exits 0 on success.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../inc/memory.h"
+
+#define CHECK(cond) do { if (!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); exit(1); } } while (0)
+
+#define MARKS		100000
+#define KEPT		16			// generations each line keeps apart
+
+#ifndef MEM_COMPACT_HEADER
+static const mem_callsite_stats_t *Find(const mem_callsite_stats_t *stats, size_t count, int line)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (stats[i].line == line)
+			return &stats[i];
+	}
+
+	return 0;
+}
+
+typedef struct walk_s
+{
+	void		*block;
+	uint32_t	generation;			// of block, once found
+	size_t		since_bytes;		// in generation since or later
+	uint32_t	since;
+}walk_t;
+
+static int WalkBlock(const mem_block_info_t *block, void *context)
+{
+	walk_t *walk = (walk_t*)context;
+
+	if (block->memblock == walk->block)
+		walk->generation = block->generation;
+	if (block->generation >= walk->since)
+		walk->since_bytes += block->size;
+
+	return 0;
+}
+
+static void TestStats()
+{
+	void *before[10];
+	void *after[10];
+	void *moved;
+	mem_callsite_stats_t stats[16];
+	const mem_callsite_stats_t *entry;
+	walk_t walk = { 0 };
+	size_t count;
+	int line_after;
+	int line_moved;
+	int i;
+
+	for (i = 0; i < 10; i++)
+		before[i] = Mem_Malloc(10);
+	CHECK(Mem_MarkGeneration() == 1);
+	line_after = __LINE__ + 2;
+	for (i = 0; i < 10; i++)
+		after[i] = Mem_Malloc(20);
+	for (i = 0; i < 5; i++)
+		Mem_Free(before[i]);
+	CHECK(Mem_MarkGeneration() == 2);
+	line_moved = __LINE__ + 1;
+	moved = Mem_Realloc(before[5], 100);
+	CHECK(moved);
+
+	count = Mem_GetGenerationStats(1, stats, 16);
+	CHECK(count == 2);
+	entry = Find(stats, count, line_after);
+	CHECK(entry && entry->live_bytes == 200 && entry->live_blocks == 10 && entry->total_allocs == 10);
+	entry = Find(stats, count, line_moved);
+	CHECK(entry && entry->live_bytes == 100 && entry->live_blocks == 1);
+
+	count = Mem_GetGenerationStats(2, stats, 16);
+	CHECK(count == 1 && stats[0].line == line_moved);
+
+	walk.block = moved;
+	walk.since = 1;
+	Mem_WalkAllocatedBlocks(&walk, WalkBlock);
+	CHECK(walk.generation == 2 && walk.since_bytes == 300);
+
+	Mem_Free(moved);
+	for (i = 6; i < 10; i++)
+		Mem_Free(before[i]);
+	for (i = 0; i < 10; i++)
+		Mem_Free(after[i]);
+	count = Mem_GetGenerationStats(1, stats, 16);
+	for (i = 0; i < (int)count; i++)
+		CHECK(stats[i].live_bytes == 0);
+}
+
+// A line that allocates across more generations than it keeps apart, with the blocks of the early ones still live
+static void TestLongLived()
+{
+	void *blocks[KEPT + 4];
+	mem_callsite_stats_t stats[16];
+	const mem_callsite_stats_t *entry;
+	uint32_t first = Mem_MarkGeneration();
+	size_t count;
+	int line;
+	int i;
+
+	line = __LINE__ + 3;
+	for (i = 0; i < KEPT + 4; i++)
+	{
+		blocks[i] = Mem_Malloc(50);
+		Mem_MarkGeneration();
+	}
+
+	count = Mem_GetGenerationStats(first, stats, 16);
+	entry = Find(stats, count, line);
+	CHECK(entry && entry->live_blocks == KEPT + 4 && entry->live_bytes == 50 * (KEPT + 4));
+	CHECK(Mem_GetGenerationStats(first + 2, stats, 16) == MEM_GENERATION_EXPIRED);
+	count = Mem_GetGenerationStats(first + 4, stats, 16);
+	entry = Find(stats, count, line);
+	CHECK(count == 1 && entry && entry->live_blocks == KEPT);
+
+	// frees of the early blocks still reach the older generations' total
+	for (i = 0; i < 4; i++)
+		Mem_Free(blocks[i]);
+	count = Mem_GetGenerationStats(first, stats, 16);
+	entry = Find(stats, count, line);
+	CHECK(entry && entry->live_blocks == KEPT && entry->total_frees == 4);
+	for (i = 4; i < KEPT + 4; i++)
+		Mem_Free(blocks[i]);
+}
+
+// Marks as often as blocks are allocated, which must cost nothing once every line has its ring
+static void TestManyMarks()
+{
+	int line_old = __LINE__ + 1;
+	void *old = Mem_Malloc(30);
+	int line_churn;
+	uint32_t first = Mem_MarkGeneration();
+	mem_callsite_stats_t stats[16];
+	const mem_callsite_stats_t *entry;
+	walk_t walk = { 0 };
+	size_t count;
+	size_t used = 0;
+	int i;
+
+	Mem_SetBacktraceDepth(8);
+	line_churn = __LINE__ + 3;
+	for (i = 0; i < MARKS; i++)
+	{
+		Mem_Free(Mem_Malloc(30));
+		Mem_MarkGeneration();
+		if (i == 100)
+			used = Mem_MemoryUsed();
+	}
+	CHECK(Mem_MemoryUsed() == used);
+	Mem_SetBacktraceDepth(0);
+	CHECK(Mem_GetGeneration() == first + MARKS);
+
+	// a line only keeps its last generations apart, but still counts every one of them
+	count = Mem_GetGenerationStats(first - 1, stats, 16);
+	entry = Find(stats, count, line_old);
+	CHECK(entry && entry->live_bytes == 30);
+	entry = Find(stats, count, line_churn);
+	CHECK(entry && entry->live_bytes == 0 && entry->total_allocs == MARKS && entry->total_frees == MARKS);
+	CHECK(Mem_GetGenerationStats(first + 50, stats, 16) == MEM_GENERATION_EXPIRED);
+	count = Mem_GetGenerationStats(first + MARKS - 5, stats, 16);
+	entry = Find(stats, count, line_churn);
+	CHECK(count == 1 && entry && entry->total_allocs == 5);
+
+	walk.block = old;
+	Mem_WalkAllocatedBlocks(&walk, WalkBlock);
+	CHECK(walk.generation == first - 1);
+
+	Mem_Free(old);
+}
+#else
+// There's no room for the generation, so marks leave every block in generation 0
+static void TestCompact()
+{
+	mem_callsite_stats_t stats[4];
+	void *block;
+
+	CHECK(Mem_MarkGeneration() == 1);
+	block = Mem_Malloc(10);
+	CHECK(Mem_GetGenerationStats(1, stats, 4) == 0);
+	Mem_Free(block);
+}
+#endif
+
+int main()
+{
+	Mem_Init();
+	if (getenv("MEM_TEST_SLAB"))
+		Mem_SetSlabBackend(1);
+
+#ifndef MEM_COMPACT_HEADER
+	TestStats();
+	TestLongLived();
+	TestManyMarks();
+#else
+	TestCompact();
+#endif
+
+	Mem_Destroy();
+	CHECK(Mem_GetGeneration() == 0);
+	printf("OK\n");
+
+	return 0;
+}
@@ -0,0 +1,112 @@
+// Many threads allocating, reallocating and freeing against a small limit, which must never be exceeded. Prints OK and
+// exits 0 on success.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "../inc/platform.h"
+#include "../inc/memory.h"
+
+#define CHECK(cond) do { if (!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); exit(1); } } while (0)
+
+#define LIMIT			(8 << 20)
+#define THREADS			16
+#define ITERATIONS		100000
+#define SLOTS			256
+
+static volatile int64_t g_live;			// underlying allocations of the blocks the threads hold, never above what's charged
+static volatile int64_t g_over;
+static volatile int64_t g_failures;
+
+static void OnMallocFail(size_t allocation_size, size_t max_memory, size_t memory_remaining)
+{
+	Atomic_Add64(&g_failures, 1);
+}
+
+static void Hold(void *block, int64_t sign)
+{
+	int64_t bytes = sign * (int64_t)Mem_BlockTotalMemUsed(block);
+
+	if (Atomic_Add64(&g_live, bytes) + bytes > LIMIT)
+		Atomic_Add64(&g_over, 1);
+}
+
+static void Churn(void *arg)
+{
+	uint64_t seed = (uintptr_t)arg * 2654435761u + 1;
+	void *held[SLOTS] = { 0 };
+	int i;
+
+	for (i = 0; i < ITERATIONS; i++)
+	{
+		int slot;
+		size_t size;
+
+		seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+		slot = (int)((seed >> 33) % SLOTS);
+		size = (size_t)((seed >> 20) % ((seed >> 60) ? 512 : 200000));
+
+		if (!held[slot])
+		{
+			held[slot] = Mem_Malloc(size);
+			Hold(held[slot], 1);
+		}
+		else if ((seed >> 10) & 1)
+		{
+			void *moved;
+
+			// given up first, so the count stays below what's charged while the block changes
+			Hold(held[slot], -1);
+			moved = Mem_Realloc(held[slot], size);
+			if (moved)
+				held[slot] = moved;
+			Hold(held[slot], 1);
+		}
+		else
+		{
+			Hold(held[slot], -1);
+			Mem_FreeZ(&held[slot]);
+		}
+	}
+
+	for (i = 0; i < SLOTS; i++)
+	{
+		Hold(held[i], -1);
+		Mem_Free(held[i]);
+	}
+}
+
+static void Run()
+{
+	platform_thread_t thread[THREADS];
+	int i;
+
+	g_live = 0;
+	g_over = 0;
+	g_failures = 0;
+	for (i = 0; i < THREADS; i++)
+		CHECK(Platform_ThreadCreate(&thread[i], Churn, (void*)(uintptr_t)(i + 1)) == 0);
+	for (i = 0; i < THREADS; i++)
+		Platform_ThreadJoin(&thread[i]);
+
+	CHECK(g_over == 0);
+	CHECK(g_failures > 0);	// or the limit was never tested
+	CHECK(g_live == 0);
+	CHECK(Mem_MemoryUsed() <= LIMIT);
+}
+
+int main()
+{
+	Mem_Init();
+	Mem_SetMemoryLimit(LIMIT);
+	Mem_SetMallocFailCallback(OnMallocFail);
+
+	Run();
+	Mem_SetSlabBackend(1);
+	Run();
+
+	Mem_Destroy();
+	printf("OK\n");
+
+	return 0;
+}
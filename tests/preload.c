@@ -0,0 +1,115 @@
+// The interposer in src/preload_linux.c, linked into the test itself so that its malloc is the process's: sizes too
+// large for a block header and its alignment fail as they do in glibc, and a block with a corrupt header never reaches
+// glibc's free. Prints OK and exits 0 on success.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <malloc.h>
+#include "../inc/memory.h"
+
+#define CHECK(cond) do { if (!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); exit(1); } } while (0)
+
+static volatile int g_malloc_failures;
+
+static void OnMallocFail(size_t allocation_size, size_t max_memory, size_t memory_remaining)
+{
+	g_malloc_failures++;
+}
+
+#ifndef MEM_COMPACT_HEADER
+static volatile int g_corrupt;
+
+static void OnFreeFail(int type, void *old_block, size_t max_memory, size_t memory_remaining)
+{
+	if (type == FREE_FAILURE_CORRUPT)
+		g_corrupt++;
+}
+#endif
+
+// volatile, so that the compiler can't see the sizes and fold the calls away
+static volatile size_t g_huge[] = { SIZE_MAX, SIZE_MAX - 8, SIZE_MAX - 16, SIZE_MAX - 4096, SIZE_MAX / 2 + 1 };
+
+extern void *__libc_malloc(size_t size);
+
+#define NUM_HUGE	(sizeof(g_huge) / sizeof(g_huge[0]))
+
+static void TestHuge()
+{
+	void *block = malloc(64);
+	void *ptr;
+	size_t i;
+
+	CHECK(block && Mem_IsManaged(block));
+	for (i = 0; i < NUM_HUGE; i++)
+	{
+		size_t size = g_huge[i];
+
+		errno = 0;
+		CHECK(malloc(size) == 0 && errno == ENOMEM);
+		errno = 0;
+		CHECK(memalign(4096, size) == 0 && errno == ENOMEM);
+		CHECK(posix_memalign(&ptr, 64, size) == ENOMEM);
+		errno = 0;
+		CHECK(realloc(block, size) == 0 && errno == ENOMEM);
+		CHECK(Mem_IsManaged(block) && Mem_MemSize(block) == 64);
+
+		Mem_SetMallocFailCallback(OnMallocFail);
+		g_malloc_failures = 0;
+		CHECK(Mem_Malloc(size) == 0);
+		CHECK(Mem_MallocAligned(size, 4096) == 0);
+		CHECK(Mem_Realloc(block, size) == 0);
+		CHECK(g_malloc_failures == 3);
+		Mem_SetMallocFailCallback(0);
+	}
+	free(block);
+}
+
+#ifndef MEM_COMPACT_HEADER
+// Out of line, so that the compiler, which knows what malloc and free do, can't drop the writes to a block being freed
+static __attribute__((noinline)) malloc_block_t *Header(void *block)
+{
+	return &((malloc_block_t*)block)[-1];
+}
+
+// A managed block with a corrupt header is reported, and kept away from glibc, which never allocated it
+static void TestCorrupt()
+{
+	char *block = malloc(64);
+	char *foreign;
+
+	CHECK(block && Mem_IsManaged(block));
+	Mem_SetFreeDanglingCallback(OnFreeFail);
+	Header(block)->allocsize += 16;
+	free(block);
+	CHECK(g_corrupt == 1);
+	block = malloc(32);
+	Header(block)->size_class ^= 1;
+	CHECK(realloc(block, 0) == 0);
+	CHECK(g_corrupt == 2);
+
+	// while a block the library never saw still goes to glibc
+	foreign = __libc_malloc(64);
+	CHECK(foreign && !Mem_IsManaged(foreign));
+	free(foreign);
+	CHECK(g_corrupt == 2);
+	Mem_SetFreeDanglingCallback(0);
+}
+#endif
+
+int main()
+{
+	free(malloc(1));	// the interposer starts on its first call
+	if (getenv("MEM_TEST_SLAB"))
+		Mem_SetSlabBackend(1);
+
+	TestHuge();
+#ifndef MEM_COMPACT_HEADER
+	TestCorrupt();
+#endif
+
+	printf("OK\n");
+
+	return 0;
+}